@@ -1,16 +1,25 @@
 #pragma once
 
 
+// CHIP8 core: no SFML in here so it can be run headless (see headless.hpp).
+// The windowed frontend lives in user_interface.hpp
+
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <memory>
 #include <fstream>
 #include <string>
-#include <SFML/Graphics.hpp>
-#include <SFML/Audio.hpp>
+#include <algorithm>
+#include <chrono>
 
 #include "structs.hpp"
 #include "init.hpp"
-#include "user_interface.hpp"
+#include "opcodes.hpp"
+#include "block_cache.hpp"
+#include "jit.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
 
 
 void update_timers(chip8_t& chip8)
@@ -23,516 +32,358 @@ void update_timers(chip8_t& chip8)
 
 }
 
-#ifdef DEBUG_ON
-void run_single_opcode_d(chip8_t chip8, const config_t config)
-{
-	bool carry;
 
-	switch ((chip8.inst.opcode >> 12) & 0xF)
-	{
-	// 1NNN: Jump to address
-	case 0x1:
-		printf("<0x%X> PC = 0x%X:  Jumping to address 0x%X\n", chip8.inst.opcode, chip8.PC - 2, chip8.inst.NNN);
-		break;
-		
-	// 2NNN: Call to address and put return address on stack
-	case 0x2:
-		printf("<0x%X> PC = 0x%X:  Calling to address 0x%X and pushing to stack at 0x%X\n",
-			chip8.inst.opcode, 
-			chip8.PC - 2,
-			chip8.inst.NNN,
-			chip8.stack_ptr--);
-		break;
+// The switch interpreter, specialised for quirk profile Q
+template <typename Q>
+void run_single_opcode(chip8_t& chip8, const config_t& config)
+{
+	
+	// A jump or call can leave PC anywhere up to 0xFFFF, RAM wraps at 4K as the other interpreters fetch it
+	chip8.PC &= 0xFFF;
+	chip8.inst.opcode = (chip8.ram[chip8.PC] << 8) | (chip8.ram[(chip8.PC + 1) & 0xFFF]);
+	chip8.PC += 2; // 16 bit instructions so add 2
 
-	// 3XNN: if (Vx == NN)
-	case 0x3:
-		printf("<0x%X> PC = 0x%X:  if (V%X == 0x%X)\n", 
-			chip8.inst.opcode, 
-			chip8.PC - 2, 
-			chip8.regs.V[chip8.inst.X], 
-			chip8.inst.NN);
-		break;
+	chip8.inst.NNN = (chip8.inst.opcode)  	  & 0xFFF;	// Address
+	chip8.inst.NN  = (chip8.inst.opcode)	  & 0xFF;	// 8-bit constant
+	chip8.inst.N   = (chip8.inst.opcode)  	  & 0xF;	// 4-bit constant
+	chip8.inst.X   = (chip8.inst.opcode >> 8) & 0xF;	// 4-bit register identifier
+	chip8.inst.Y   = (chip8.inst.opcode >> 4) & 0xF;	// 4-bit register identifier
 
-	// 4XNN: if (Vx != NN)
-	case 0x4:
-		printf("<0x%X> PC = 0x%X:  if (V%X != 0x%X)\n", 
-			chip8.inst.opcode, 
-			chip8.PC - 2, 
-			chip8.regs.V[chip8.inst.X], 
-			chip8.inst.NN);
-		break;
+	const instruction_t& inst = chip8.inst;
 
-	// 5XNN: if (Vx == Vy)
-	case 0x5:
-		printf("<0x%X> PC = 0x%X:  if (V%X == 0x%X)\n", 
-			chip8.inst.opcode, 
-			chip8.PC - 2, 
-			chip8.regs.V[chip8.inst.X], 
-			chip8.regs.V[chip8.inst.Y]);
-		break;
+	switch ((inst.opcode >> 12) & 0xF)
+	{
+	// 00E0: Clear Screen/Return from call, and the SUPER-CHIP/XO-CHIP display opcodes
+	case 0x0:
+		if (inst.NN == 0xE0)
+			op_00E0(chip8, config, inst);
 		
-	// 6XNN: Vx = NN
-	case 0x6:
-		printf("<0x%X> PC = 0x%X:  V%X = 0x%X\n", chip8.inst.opcode, chip8.PC - 2, chip8.inst.X, chip8.inst.NN);
-		break;
-
-	// 7XNN: Vx += NN
-	case 0x7:
-		printf("<0x%X> PC = 0x%X:  V%X += 0x%X (V%d = 0x%X)\n",
-			chip8.inst.opcode, 
-			chip8.PC - 2,  
-			chip8.inst.X, 
-			chip8.inst.NN, 
-			chip8.inst.X, 
-			chip8.regs.V[chip8.inst.X]);
-		break;
+		if (inst.NN == 0xEE)
+			op_00EE(chip8, config, inst);
 
-		// 8XY0/1/2/3/4/5/6/7/E
-	case 0x8:
-		switch (chip8.inst.N)
+		if constexpr (Q::hires)
 		{
+			if ((inst.NN & 0xF0) == 0xC0)
+				op_00CN<Q>(chip8, config, inst);
 
-			// Vx = Vy
-		case 0x0:
-			printf("<0x%X> PC = 0x%X:  V%X = 0x%X\n",
-				chip8.inst.opcode,
-				chip8.PC - 2,
-				chip8.regs.V[chip8.inst.X],
-				chip8.regs.V[chip8.inst.Y]);
-			break;
-			// Vx |= Vy
-		case 0x1:
-			printf("<0x%X> PC = 0x%X:  V%X |= 0x%X\n",
-				chip8.inst.opcode,
-				chip8.PC - 2,
-				chip8.regs.V[chip8.inst.X],
-				chip8.regs.V[chip8.inst.Y]);
-			break;
-
-			// Vx &= Vy
-		case 0x2:
-			printf("<0x%X> PC = 0x%X:  V%X &= 0x%X\n",
-				chip8.inst.opcode,
-				chip8.PC - 2,
-				chip8.regs.V[chip8.inst.X],
-				chip8.regs.V[chip8.inst.Y]);
-			break;
-
-			// Vx ^= Vy
-		case 0x3:
-			printf("<0x%X> PC = 0x%X:  V%X ^= 0x%X\n",
-				chip8.inst.opcode,
-				chip8.PC - 2,
-				chip8.regs.V[chip8.inst.X],
-				chip8.regs.V[chip8.inst.Y]);
-			break;
-
-			// Vx += Vy
-		case 0x4:
-			printf("<0x%X> PC = 0x%X:  V%X += 0x%X \n",
-				chip8.inst.opcode,
-				chip8.PC - 2,
-				chip8.regs.V[chip8.inst.X],
-				chip8.regs.V[chip8.inst.Y]);
-			break;
-
-			// Vx -= Vy
-		case 0x5:
-			printf("<0x%X> PC = 0x%X:  V%X -= 0x%X \n",
-				chip8.inst.opcode,
-				chip8.PC - 2,
-				chip8.regs.V[chip8.inst.X],
-				chip8.regs.V[chip8.inst.Y]);
-			break;
+			if (inst.NN == 0xFB)
+				op_00FB<Q>(chip8, config, inst);
 
-			// Vx >>= 1
-		case 0x6:
-			printf("<0x%X> PC = 0x%X:  V%X >>= 1 \n",
-				chip8.inst.opcode,
-				chip8.PC - 2,
-				chip8.regs.V[chip8.inst.X]);
-			break;
+			if (inst.NN == 0xFC)
+				op_00FC<Q>(chip8, config, inst);
 
-			// Vy -= Vx
-		case 0x7:
-			printf("<0x%X> PC = 0x%X:  V%X -= 0x%X \n",
-				chip8.inst.opcode,
-				chip8.PC - 2,
-				chip8.regs.V[chip8.inst.Y],
-				chip8.regs.V[chip8.inst.X]);
-			break;
+			if (inst.NN == 0xFE)
+				op_00FE(chip8, config, inst);
 
-			// Vx <<= 1
-		case 0xE:
-			printf("<0x%X> PC = 0x%X:  V%X <<= 1 \n",
-				chip8.inst.opcode,
-				chip8.PC - 2,
-				chip8.regs.V[chip8.inst.X]);
-			break;
+			if (inst.NN == 0xFF)
+				op_00FF(chip8, config, inst);
 		}
 
-
-	// ANNN: I = NNN
-	case 0xA:
-		printf("<0x%X> PC = 0x%X:  I = 0x%X\n", chip8.inst.opcode, chip8.PC - 2, chip8.inst.NNN);
+		if constexpr (Q::bitplanes)
+		{
+			if ((inst.NN & 0xF0) == 0xD0)
+				op_00DN<Q>(chip8, config, inst);
+		}
 		break;
 
-	case 0xB:
-		printf("<0x%X> PC = 0x%X:  PC = 0x%X + V0\n", chip8.inst.opcode, chip8.PC - 2, chip8.inst.NNN);
-		break;
+	case 0x1: op_1NNN(chip8, config, inst); break;
+	case 0x2: op_2NNN(chip8, config, inst); break;
+	case 0x3: op_3XNN(chip8, config, inst); break;
+	case 0x4: op_4XNN(chip8, config, inst); break;
+	case 0x5: op_5XY0(chip8, config, inst); break;
+	case 0x6: op_6XNN(chip8, config, inst); break;
+	case 0x7: op_7XNN(chip8, config, inst); break;
 
-	case 0xC:
-		printf("<0x%X> PC = 0x%X:  V%X = rand() %% 256 & NN (0x%02X)\n", chip8.inst.opcode, chip8.PC - 2, chip8.regs.V[0], chip8.inst.NN);
+	// 8XY0/1/2/3/4/5/6/7/E
+	case 0x8:
+		switch (inst.N)
+		{
+		case 0x0: op_8XY0(chip8, config, inst); break;
+		case 0x1: op_8XY1<Q>(chip8, config, inst); break;
+		case 0x2: op_8XY2<Q>(chip8, config, inst); break;
+		case 0x3: op_8XY3<Q>(chip8, config, inst); break;
+		case 0x4: op_8XY4(chip8, config, inst); break;
+		case 0x5: op_8XY5(chip8, config, inst); break;
+		case 0x6: op_8XY6<Q>(chip8, config, inst); break;
+		case 0x7: op_8XY7(chip8, config, inst); break;
+		case 0xE: op_8XYE<Q>(chip8, config, inst); break;
+		}
 		break;
 
-		/* DXYN:
-		  *  It will draw an N pixels tall sprite from the memory location that the I index register is holding to the screen,
-		  *  at the horizontal X coordinate in VX and the Y coordinate in VY.
-		  *  All the pixels that are on in the sprite will flip the pixels on the screen that it is drawn to (from left to right, from most to least significant bit).
-		  *  If any pixels on the screen were turned off by this, the VF flag register is set to 1. Otherwise, its set to 0.
-		*/
-	case 0xD:
-		printf("<0x%X> PC = 0x%X:  Displaying pixel at address 0x%X (X, Y = %d, %d) of %d rows\n",chip8.inst.opcode, 
-			chip8.PC - 2, 
-			chip8.regs.I,
-			chip8.regs.V[chip8.inst.X],
-			chip8.regs.V[chip8.inst.Y],
-			chip8.inst.N);
-		
-		break;
+	case 0x9: op_9XY0(chip8, config, inst); break;
+	case 0xA: op_ANNN(chip8, config, inst); break;
+	case 0xB: op_BNNN<Q>(chip8, config, inst); break;
+	case 0xC: op_CXNN(chip8, config, inst); break;
+	case 0xD: op_DXYN<Q>(chip8, config, inst); break;
 
 	case 0xE:
-		// EX9E: Skip next instruction if key in VX is pressed
-		if (chip8.inst.NN == 0x9E)
-		{
-			printf("<0x%X> PC = 0x%X:  Skip next instruction if key in V%X (0x%X) is pressed; Keypad value: %d\n",
-				chip8.inst.opcode,
-				chip8.PC - 2,
-				chip8.inst.X,
-				chip8.regs.V[chip8.inst.X],
-				chip8.keypad[chip8.regs.V[chip8.inst.X]]);
-		}
+		if (inst.NN == 0x9E)
+			op_EX9E(chip8, config, inst);
 
-		// EXA1: Skip next instruction if key in VX is NOT pressed
-		if (chip8.inst.NN == 0xA1)
-		{
-			printf("<0x%X> PC = 0x%X:  Skip next instruction if key in V%X (0x%X) is NOT pressed; Keypad value: %d\n",
-				chip8.inst.opcode,
-				chip8.PC - 2,
-				chip8.inst.X,
-				chip8.regs.V[chip8.inst.X],
-				chip8.keypad[chip8.regs.V[chip8.inst.X]]);
-		}
+		if (inst.NN == 0xA1)
+			op_EXA1(chip8, config, inst);
 		break;
 
 	case 0xF:
-		switch (chip8.inst.NN)
+		switch (inst.NN)
 		{
-			// FX0A: VX = get_key(); Await until a keypress, and store in VX
-		case 0xA:
-			printf("<0x%X> PC = 0x%X:  Await until a key is pressed; store key in V%X\n", chip8.inst.opcode, chip8.PC - 2, chip8.inst.X);
-			break;
-
-			// FX1E: I += VX; Add Vx to register I. For non-Amiga CHIP8, does not affect VF
-		case 0x1E:
-			printf("<0x%X> PC = 0x%X:  I += V%X (0x%X += 0x%X)\n", 
-				chip8.inst.opcode, 
-				chip8.PC - 2, 
-				chip8.inst.X, 
-				chip8.regs.I, 
-				chip8.regs.V[chip8.inst.X]);
-
+		case 0x0A: op_FX0A(chip8, config, inst); break;
+		case 0x1E: op_FX1E(chip8, config, inst); break;
+		case 0x07: op_FX07(chip8, config, inst); break;
+		case 0x15: op_FX15(chip8, config, inst); break;
+		case 0x18: op_FX18(chip8, config, inst); break;
+		case 0x29: op_FX29(chip8, config, inst); break;
+		case 0x33: op_FX33(chip8, config, inst); break;
+		case 0x55: op_FX55<Q>(chip8, config, inst); break;
+		case 0x65: op_FX65<Q>(chip8, config, inst); break;
+		case 0x01:
+			if constexpr (Q::bitplanes)
+				op_FN01(chip8, config, inst);
 			break;
 		default:
 			break;
 		}
-
+		break;
+	
 	default:
-		printf("<0x%X> PC = 0x%X:  Unimpletmented opcode 0x%X\n", chip8.inst.opcode, chip8.PC - 2, chip8.inst.opcode);
 		break;
 	}
 }
-#endif
 
 
-void run_single_opcode(chip8_t& chip8, const config_t& config, sfml_t& sfml)
+typedef void (*interpreter_t)(chip8_t& chip8, const config_t& config);
+
+// The switch interpreter for a --quirks profile
+interpreter_t switch_interpreter(const uint8_t quirks)
 {
-	
-	chip8.inst.opcode = (chip8.ram[chip8.PC] << 8) | (chip8.ram[chip8.PC + 1]);
-	chip8.PC += 2; // 16 bit instructions so add 2
+	return with_quirks(quirks, []<typename Q>() -> interpreter_t { return run_single_opcode<Q>; });
+}
 
-	chip8.inst.NNN = (chip8.inst.opcode)  	  & 0xFFF;	// Address
-	chip8.inst.NN  = (chip8.inst.opcode)	  & 0xFF;	// 8-bit constant
-	chip8.inst.N   = (chip8.inst.opcode)  	  & 0xF;	// 4-bit constant
-	chip8.inst.X   = (chip8.inst.opcode >> 8) & 0xF;	// 4-bit register identifier
-	chip8.inst.Y   = (chip8.inst.opcode >> 4) & 0xF;	// 4-bit register identifier
 
-#ifdef DEBUG_ON
-	run_single_opcode_d(chip8, config);
-#endif // DEBUG
+void run_single_opcode_table(chip8_t& chip8, const config_t& config, const decode_table_t& table)
+{
+	const uint32_t PC = chip8.PC & 0xFFF;
+	const uint16_t opcode = (chip8.ram[PC] << 8) | (chip8.ram[(PC + 1) & 0xFFF]);
+	chip8.PC = PC + 2;
 
-	uint32_t X_coord;		// Used for DXYN 
-	uint32_t Y_coord;		// Used for DXYN
-	uint8_t  orig_X;		// Used for DXYN
-	bool carry;
-	bool any_key_press;
+	const decoded_t& decoded = table[opcode];
 
-	switch ((chip8.inst.opcode >> 12) & 0xF)
-	{
-	// 00E0: Clear Screen/Return from call
-	case 0x0:
-		if (chip8.inst.NN == 0xE0)
-			clear_screen(sfml, config);
-		
-		if (chip8.inst.NN == 0xEE)
-			chip8.PC = *--chip8.stack_ptr;
+	decoded.handler(chip8, config, decoded.inst);
+}
 
-		break;
+// Table step that also writes a trace record. Every dispatch mode goes through here while tracing,
+// so each opcode gets its own record
+void run_single_opcode_traced(chip8_t& chip8, const config_t& config, const decode_table_t& table, trace_t& trace)
+{
+	const uint32_t PC = chip8.PC & 0xFFF;
+	const uint16_t opcode = (chip8.ram[PC] << 8) | (chip8.ram[(PC + 1) & 0xFFF]);
+	const decoded_t& decoded = table[opcode];
+
+	trace_record_t& record = begin_trace_record(trace, chip8, decoded.inst);
+	chip8.PC = PC + 2;
+	decoded.handler(chip8, config, decoded.inst);
+	finish_trace_record(record, chip8, decoded.inst);
+}
 
-	// 1NNN: Jump to address
-	case 0x1:
-		chip8.PC = chip8.inst.NNN;
-		break;
+// Execution backend state for one chip8_t. Not part of the emulated machine
+struct cpu_t
+{
+	const decode_table_t* table;	// Both specialised for config.quirks, picked once by init_cpu
+	interpreter_t run_switch;
+	block_cache_t blocks;
+#ifdef CHIP8_JIT
+	jit_t jit;
+#endif
+	uint64_t idle_cycles;	// Opcodes skip_idle_loop jumped over instead of running
+	trace_t trace;			// Runtime switchable, see trace.hpp
+#ifdef PROFILE_ON
+	profiler_t profile;
+#endif
+};
 
-	// 2NNN: Calls to Address (Pushes return to stack
-	case 0x2:
-		*chip8.stack_ptr++ = chip8.PC;
-		chip8.PC = chip8.inst.NNN;
-		break;
+// Drop everything worked out from the old RAM and timeline, after the chip8 was replaced
+// (a save state loaded, a rewind). The profile and trace keep going
+void flush_cpu(cpu_t& cpu)
+{
+	init_block_cache(cpu.blocks);
+#ifdef CHIP8_JIT
+	flush_jit(cpu.jit);
+#endif
+}
 
-	// 3XNN: if Vx == NN
-	case 0x3:
-		if (chip8.regs.V[chip8.inst.X] == chip8.inst.NN)
-			chip8.PC += 2;
-		break;
+void init_cpu(cpu_t& cpu, const config_t& config)
+{
+	cpu.table = &decode_table(config.quirks);
+	cpu.run_switch = switch_interpreter(config.quirks);
+#ifdef CHIP8_JIT
+	init_jit(cpu.jit);
+#endif
+	flush_cpu(cpu);
+	cpu.idle_cycles = 0;
+	cpu.trace.records.clear();
+	cpu.trace.count = 0;
+	cpu.trace.enabled = false;
+#ifdef PROFILE_ON
+	init_profiler(cpu.profile);
+#endif
+}
 
-	// 4XNN: if Vx != NN
-	case 0x4:
-		if (chip8.regs.V[chip8.inst.X] != chip8.inst.NN)
-			chip8.PC += 2;
-		break;
+// Run opcodes with the interpreter picked by --dispatch, at most budget (at least 1). Returns how many
+// ran: always 1 for the interpreters, up to a whole block for the block cache and the JIT
+uint32_t step_cpu(chip8_t& chip8, const config_t& config, cpu_t& cpu, const uint32_t budget)
+{
+#ifdef PROFILE_ON
+	const uint32_t start = chip8.PC;
+#endif
+	uint32_t ran = 1;
 
-	// 5XNN: if Vx == Vy
-	case 0x5:
-		if (chip8.regs.V[chip8.inst.X] == chip8.regs.V[chip8.inst.Y])
-			chip8.PC += 2;
-		break;
+	if (cpu.trace.enabled)
+	{
+		run_single_opcode_traced(chip8, config, *cpu.table, cpu.trace);
+		PROFILE_STEP(cpu.profile, chip8, start, ran);
+		return ran;
+	}
 
-	// 6XNN: Vx = NN
-	case 0x6:
-		chip8.regs.V[chip8.inst.X] = chip8.inst.NN;
+	switch (config.dispatch)
+	{
+	case DISPATCH_BLOCK:
+		ran = run_block(chip8, config, cpu.blocks, *cpu.table, budget);
 		break;
 
-	// 7XNN: Vx += NN
-	case 0x7:
-		chip8.regs.V[chip8.inst.X] += chip8.inst.NN;
-
+#ifdef CHIP8_JIT
+	case DISPATCH_JIT:
+		ran = run_jit_block(chip8, config, cpu.jit, *cpu.table, budget);
 		break;
+#endif
 
-	// 8XY0/1/2/3/4/5/6/7/E
-	case 0x8:
-		switch (chip8.inst.N)
-		{
-
-		// Vx = Vy
-		case 0x0:
-			chip8.regs.V[chip8.inst.X] = chip8.regs.V[chip8.inst.Y];
-			break;
-		// Vx |= Vy
-		case 0x1:
-			chip8.regs.V[chip8.inst.X] |= chip8.regs.V[chip8.inst.Y];
-			break;
-
-		// Vx &= Vy
-		case 0x2:
-			chip8.regs.V[chip8.inst.X] &= chip8.regs.V[chip8.inst.Y];
-			break;
-
-		// Vx ^= Vy
-		case 0x3:
-			chip8.regs.V[chip8.inst.X] ^= chip8.regs.V[chip8.inst.Y];
-			break;
+	case DISPATCH_TABLE:
+		run_single_opcode_table(chip8, config, *cpu.table);
+		break;
 
-		// Vx += Vy
-		case 0x4:
-			carry = ((uint16_t)(chip8.regs.V[chip8.inst.X] + chip8.regs.V[chip8.inst.Y]) > 255);
+	default:
+		cpu.run_switch(chip8, config);
+		break;
+	}
 
-			chip8.regs.V[chip8.inst.X] += chip8.regs.V[chip8.inst.Y];
-			chip8.regs.V[0xF] = carry;
-			break;
+	PROFILE_STEP(cpu.profile, chip8, start, ran);
 
-		// Vx -= Vy
-		case 0x5:
-			carry = chip8.regs.V[chip8.inst.X] > chip8.regs.V[chip8.inst.Y];
+	return ran;
+}
 
-			chip8.regs.V[chip8.inst.X] -= chip8.regs.V[chip8.inst.Y];
-			chip8.regs.V[0xF] = carry;
-			break;
 
-		// Vx >>= 1
-		case 0x6:
-			carry = (chip8.regs.V[chip8.inst.X] & 0x80) << 1;  // VX
-			chip8.regs.V[chip8.inst.X] >>= 1;                  // Use VX
-			chip8.regs.V[0xF] = carry;
-			break;
+const uint32_t IDLE_LOOP_MAX = 16;		// Longest idle loop looked for, in opcodes
 
-		// Vy -= Vx
-		case 0x7:
-			carry = chip8.regs.V[chip8.inst.Y] > chip8.regs.V[chip8.inst.X];
+// Follow the code from PC the way it would run this frame, with registers V, until it comes back to
+// PC. Only opcodes that read nothing but the delay timer, the keypad and V, and write nothing but V,
+// can be in the loop: FX07, FX0A, 6XNN, 8XY0, the skips and 1NNN. Returns the loop's length in
+// opcodes with V as one time round leaves it, or 0 if the code isn't such a loop
+uint32_t idle_loop_length(const chip8_t& chip8, std::array<uint8_t, 16>& V)
+{
+	const uint32_t start = chip8.PC & 0xFFF;
+	uint32_t PC = start;
 
-			chip8.regs.V[chip8.inst.Y] -= chip8.regs.V[chip8.inst.X];
-			chip8.regs.V[0xF] = carry;
-			break;
+	for (uint32_t length = 1; length <= IDLE_LOOP_MAX; length++)
+	{
+		const uint16_t opcode = (chip8.ram[PC] << 8) | chip8.ram[(PC + 1) & 0xFFF];
+		const uint8_t X = (opcode >> 8) & 0xF;
+		const uint8_t Y = (opcode >> 4) & 0xF;
+		const uint8_t NN = opcode & 0xFF;
+		bool skip = false;
 
-		// Vx <<= 1
+		switch (opcode >> 12)
+		{
+		case 0x1: PC = (opcode & 0xFFF) - 2; break;
+		case 0x3: skip = V[X] == NN; break;
+		case 0x4: skip = V[X] != NN; break;
+		case 0x5: if ((opcode & 0xF) != 0) return 0; skip = V[X] == V[Y]; break;
+		case 0x9: if ((opcode & 0xF) != 0) return 0; skip = V[X] != V[Y]; break;
+		case 0x6: V[X] = NN; break;
+		case 0x8: if ((opcode & 0xF) != 0) return 0; V[X] = V[Y]; break;
 		case 0xE:
-			carry = (chip8.regs.V[chip8.inst.X] & 0x80) >> 7;  // VX
-			chip8.regs.V[chip8.inst.X] <<= 1;                  // Use VX
-			chip8.regs.V[0xF] = carry;
+			if (NN == 0x9E) skip = (chip8.keypad >> (V[X] & 0xF)) & 1;
+			else if (NN == 0xA1) skip = !((chip8.keypad >> (V[X] & 0xF)) & 1);
+			else return 0;
 			break;
+		case 0xF:
+			if (NN == 0x07) V[X] = chip8.delay_timer;
+			else if (NN == 0x0A && chip8.keypad == 0) PC -= 2;
+			else if (NN == 0x0A) V[X] = std::countr_zero(chip8.keypad);
+			else return 0;
+			break;
+		default:
+			return 0;
 		}
 
+		PC = (PC + (skip ? 4 : 2)) & 0xFFF;
+		if (PC == start)
+			return length;
+	}
 
-	// 9XNN: if Vx != Vy
-	case 0x9:
-		if (chip8.regs.V[chip8.inst.X] != chip8.regs.V[chip8.inst.Y])
-			chip8.PC += 2;
-		break;
-
-	// ANNN: I = NNN
-	case 0xA:
-		chip8.regs.I = chip8.inst.NNN;
-		break;
-
-	// BXNN: PC = Vx += NN; (etc B220 = 0x220 + V0)
-	case 0xB:
-		// COSMAC VIP
-		chip8.PC = chip8.regs.V[0] + chip8.inst.NNN;
-		break;
-
-	// 0xCXNN: Sets register VX = rand() % 256 & NN (bitwise AND)
-	case 0xC:
-		chip8.regs.V[chip8.inst.X] = (rand() % 256) & chip8.inst.NN;
-		break;
-
-	/* DXYN:
-	  *  It will draw an N pixels tall sprite from the memory location that the I index register is holding to the screen,
-	  *  at the horizontal X coordinate in VX and the Y coordinate in VY. 
-	  *  All the pixels that are on in the sprite will flip the pixels on the screen that it is drawn to (from left to right, from most to least significant bit). 
-	  *  If any pixels on the screen were turned off by this, the VF flag register is set to 1. Otherwise, its set to 0.
-	*/
-	case 0xD:
-		
-		// Wrap around the screen if pixel goes out of bounds
-		X_coord = chip8.regs.V[chip8.inst.X] % config.screen_width;
-		Y_coord = chip8.regs.V[chip8.inst.Y] % config.screen_height;
-		orig_X = X_coord; // Original X value
-
-		chip8.regs.V[0xF] = 0;	// Set carry to 0
-
-		
-
-		// Read sprite from memory
-		// Loop over all N rows of the sprite
-		for (uint8_t i = 0; i < chip8.inst.N; i++) 
-		{
-			// Get next byte/row of sprite data
-			const uint8_t sprite_data = chip8.ram[chip8.regs.I + i];
-			X_coord = orig_X;   // Reset X for next row to draw
-
-			for (int8_t j = 7; j >= 0; j--) 
-			{
-				// If sprite pixel/bit is on and display pixel is on, set carry flag
-				bool* pixel = &chip8.display[Y_coord * config.screen_width + X_coord];
-				const bool sprite_bit = (sprite_data & (1 << j));
-
-				if (sprite_bit && *pixel) 
-				{
-					chip8.regs.V[0xF] = 1;
-				}
-
-				// XOR display pixel with sprite pixel/bit to set it on or off
-				*pixel ^= sprite_bit;
-
-				;
+	return 0;
+}
 
-				// Stop drawing this row if hit right edge of screen
-				if (++X_coord >= config.screen_width) break;
-			}
+// Idle loops spin without changing anything until a timer tick or a key press, and both only
+// happen between frames: waiting for the delay timer (FX07 / 3X00 / 1NNN), polling keys, FX0A with
+// no key held, a jump to itself. Called at the start of a frame, this finds out with
+// idle_loop_length whether PC is in one whose second time round repeats the first exactly, and
+// jumps over the whole iterations that fit in budget opcodes, leaving the machine as running them would.
+// Without live_input a loop of one opcode is left alone, as headless halts on it.
+// Returns the opcodes skipped, 0 if PC isn't in an idle loop
+uint32_t idle_loop_skip(chip8_t& chip8, const uint32_t budget, const bool live_input)
+{
+	std::array<uint8_t, 16> V = chip8.regs.V;
+	const uint32_t length = idle_loop_length(chip8, V);
+	if (length == 0 || length > budget || (length == 1 && !live_input))
+		return 0;
+
+	// The first time round may load registers (FX07), after that every time round has to be the same
+	std::array<uint8_t, 16> again = V;
+	if (idle_loop_length(chip8, again) != length || again != V)
+		return 0;
+
+	chip8.regs.V = V;
+	return budget / length * length;
+}
 
-			
+// idle_loop_skip for the interpreters, counted in cpu.idle_cycles. A trace wants every opcode
+uint32_t skip_idle_loop(chip8_t& chip8, const config_t& config, cpu_t& cpu, const uint32_t budget, const bool live_input)
+{
+	if (!config.idle_skip || cpu.trace.enabled)
+		return 0;
 
-			// Stop drawing entire sprite if hit bottom edge of screen
-			if (++Y_coord >= config.screen_height) break;
-		}
+	const uint32_t skipped = idle_loop_skip(chip8, budget, live_input);
 
-		chip8.draw = true;
+	cpu.idle_cycles += skipped;
+#ifdef PROFILE_ON
+	cpu.profile.idle_opcodes += skipped;
+#endif
 
-		break;
+	return skipped;
+}
 
-	case 0xE:
-		// EX9E: Skip next instruction if key in VX is pressed
-		if (chip8.inst.NN == 0x9E)
-		{
-			if (chip8.keypad[chip8.regs.V[chip8.inst.X]])
-				chip8.PC += 2;
-		}
+// The opcodes of one 60Hz frame, without its timer tick: anything sampling the timers as the frame
+// saw them (the buzzer) goes between this and update_timers.
+// Returns the number of opcodes run, counting the ones an idle loop skipped
+uint32_t run_frame_opcodes(chip8_t& chip8, const config_t& config, cpu_t& cpu)
+{
+	PROFILE_TIME(cpu.profile.cpu);
 
-		// EXA1: Skip next instruction if key in VX is NOT pressed
-		if (chip8.inst.NN == 0xA1)
-		{
-			if (!chip8.keypad[chip8.regs.V[chip8.inst.X]])
-				chip8.PC += 2;
-		}
-		break;
+	uint32_t cycles = skip_idle_loop(chip8, config, cpu, config.cycles_per_frame, true);
 
-	case 0xF:
-		switch (chip8.inst.NN)
-		{
-		// FX0A: VX = get_key(); Await until a keypress, and store in VX
-		case 0xA:
-			any_key_press = false;
-
-			for (auto& key : chip8.keypad)
-			{
-				if (chip8.keypad[key])
-				{
-					chip8.regs.V[chip8.inst.X] = key; // key (offset of keypad)
-					any_key_press = true;
-					break;
-				}
-			}
-
-			// if no keypad has been pressed: Key getting the current opcode and running this instruction
-			if (!any_key_press) chip8.PC -= 2; 
-			break;
+	while (cycles < config.cycles_per_frame)
+	{
+		cycles += step_cpu(chip8, config, cpu, config.cycles_per_frame - cycles);
+	}
 
-		// FX1E: I += VX; Add Vx to register I. For non-Amiga CHIP8, does not affect VF
-		case 0x1E:
-			chip8.regs.I += chip8.regs.V[chip8.inst.X];
-			break;
-		
-		// FX07: Vx = delay timer
-		case 0x07:
-			chip8.regs.V[chip8.inst.X] = chip8.delay_timer;
-			break;
-			
-		// FX15: delay timer = Vx
-		case 0x15:
-			chip8.delay_timer = chip8.regs.V[chip8.inst.X];
-			break;
+	return cycles;
+}
 
-		// FX18: sound timer = Vx
-		case 0x18:
-			chip8.sound_timer = chip8.regs.V[chip8.inst.X];
-			break;
+// Run one 60Hz frame: a batch of cycles_per_frame opcodes followed by a single timer tick.
+// Returns the number of opcodes run, counting the ones an idle loop skipped
+uint32_t run_frame(chip8_t& chip8, const config_t& config, cpu_t& cpu)
+{
+	const uint32_t cycles = run_frame_opcodes(chip8, config, cpu);
+	update_timers(chip8);
 
-		default:
-			break;
-		}
-		break;
-	
-	default:
-		break;
-	}
-}
+	return cycles;
+}
\ No newline at end of file
@@ -0,0 +1,292 @@
+#pragma once
+
+// Runtime for ROMs compiled ahead of time by chip8-aot (src/aot.cpp). chip8-aot turns every block
+// control_flow.hpp finds into a C++ function calling the opcode handlers with constant operands,
+// so each one inlines down to the few host instructions its opcode needs. run_aot runs those
+// functions in place of the interpreter, exactly as run_headless would: anything with no compiled
+// block (a BNNN target, code outside the ROM, blocks overwritten since) is interpreted one opcode at a time.
+//
+// A compiled program is one translation unit per ROM, with this header as its only include
+
+#include <stdio.h>
+#include <bitset>
+#include <string>
+#include <vector>
+
+#include "CHIP8.hpp"
+#include "headless.hpp"
+#include "batch.hpp"
+#include "thread_pool.hpp"
+
+
+struct aot_t;
+
+// Run opcodes entry to stop - 1 of a block (counted from its first opcode), leaving PC after the last.
+// Returns how many ran
+typedef uint32_t (*aot_block_t)(chip8_t& chip8, const config_t& config, aot_t& aot, uint32_t entry, uint32_t stop);
+
+struct aot_block_info_t
+{
+	uint16_t start;
+	uint8_t ops;
+	aot_block_t run;
+};
+
+// What chip8-aot writes out for a ROM
+struct aot_program_t
+{
+	const char* rom_name;
+	uint8_t quirks;					// The QUIRKS_ profile the handlers were specialised for
+	const uint8_t* rom;				// The ROM compiled, what the blocks still match until it gets written over
+	size_t rom_size;
+	const aot_block_info_t* blocks;
+	size_t block_count;
+};
+
+struct aot_entry_t
+{
+	aot_block_t run;				// nullptr: no compiled opcode starts here, interpret it
+	uint8_t index;					// Of the opcode in its block
+	uint8_t ops;					// In the whole block
+};
+
+struct aot_t
+{
+	const aot_program_t* program;
+	std::array<aot_entry_t, 4096> entries;	// By address: entering a block part way through runs the rest of it
+	std::bitset<4096> covered;				// Bytes some compiled block was made from
+	uint64_t compiled;						// Opcodes run by compiled blocks
+	uint64_t interpreted;
+	uint64_t invalidated;					// Blocks dropped for being written over
+};
+
+
+// The decoded form of an opcode as a constant, for the compiled blocks to pass to the handlers
+template <uint16_t OPCODE>
+constexpr instruction_t aot_inst = decode_instruction(OPCODE);
+
+
+void init_aot(aot_t& aot, const aot_program_t& program)
+{
+	aot.program = &program;
+	aot.entries.fill(aot_entry_t{ nullptr, 0, 0 });
+	aot.covered.reset();
+	aot.compiled = 0;
+	aot.interpreted = 0;
+	aot.invalidated = 0;
+
+	for (size_t block = 0; block < program.block_count; block++)
+	{
+		const aot_block_info_t& info = program.blocks[block];
+		for (uint32_t index = 0; index < info.ops; index++)
+		{
+			aot.entries[info.start + index * 2] = aot_entry_t{ info.run, (uint8_t)index, info.ops };
+			aot.covered[info.start + index * 2] = true;
+			aot.covered[info.start + index * 2 + 1] = true;
+		}
+	}
+}
+
+// After FX33/FX55 wrote [lo, hi]: drop every compiled block with a byte there that is no longer the
+// ROM's, so the code it was made from runs interpreted from now on
+void aot_stored(aot_t& aot, const chip8_t& chip8, const uint32_t lo, const uint32_t hi)
+{
+	const aot_program_t& program = *aot.program;
+
+	for (uint32_t written = lo; written <= hi; written++)
+	{
+		const uint32_t addr = written & 0xFFF;
+		if (!aot.covered[addr] || chip8.ram[addr] == program.rom[addr - 0x200])
+			continue;
+
+		// A block covering addr starts at most MAX_BLOCK_BYTES - 1 bytes before it
+		const uint32_t first = addr >= MAX_BLOCK_BYTES ? addr - MAX_BLOCK_BYTES + 1 : 0;
+		for (uint32_t start = first; start <= addr; start++)
+		{
+			const aot_entry_t block = aot.entries[start];
+			if (block.run == nullptr || block.index != 0 || start + block.ops * 2 <= addr)
+				continue;
+
+			for (uint32_t index = 0; index < block.ops; index++)
+			{
+				aot.entries[start + index * 2].run = nullptr;
+			}
+
+			aot.invalidated++;
+		}
+	}
+}
+
+// run_headless with the compiled blocks. Blocks are cut short at the end of a frame or of the cycle
+// budget, so timers tick and runs stop after the same opcode the interpreter would
+headless_result_t run_aot(chip8_t& chip8, const config_t& config, cpu_t& cpu, aot_t& aot)
+{
+	headless_result_t result{ 0 };
+	result.halt = HALT_NONE;
+
+	const auto start = std::chrono::steady_clock::now();
+	const uint64_t idle_start = cpu.idle_cycles;
+
+	uint32_t frame_cycles = 0;
+	bool frame_start = true;
+	while (result.cycles < config.max_cycles && result.halt == HALT_NONE)
+	{
+		const uint32_t PC = chip8.PC;
+		const uint32_t budget = (uint32_t)std::min<uint64_t>(config.cycles_per_frame - frame_cycles, config.max_cycles - result.cycles);
+		uint32_t ran = 0;
+
+		if (frame_start)
+		{
+			ran = skip_idle_loop(chip8, config, cpu, budget, false);
+			frame_start = false;
+		}
+
+		const aot_entry_t& entry = aot.entries[PC & 0xFFF];
+		if (ran == 0 && entry.run && PC < 4096)
+		{
+			ran = entry.run(chip8, config, aot, entry.index, std::min<uint32_t>(entry.ops, entry.index + budget));
+			aot.compiled += ran;
+
+			// Only the last opcode can be a jump to itself or FX0A waiting
+			if (chip8.PC == PC + (ran - 1) * 2)
+				result.halt = HALT_STUCK;
+		}
+		else if (ran == 0)
+		{
+			// Work out what FX33/FX55 will write before it moves I
+			const instruction_t& inst = (*cpu.table)[(chip8.ram[PC & 0xFFF] << 8) | chip8.ram[(PC + 1) & 0xFFF]].inst;
+			const uint32_t lo = chip8.regs.I & 0xFFF;
+
+			run_single_opcode_table(chip8, config, *cpu.table);
+			ran = 1;
+			aot.interpreted++;
+
+			if (writes_ram(inst))
+				aot_stored(aot, chip8, lo, lo + (inst.NN == 0x33 ? 2 : inst.X));
+
+			if (chip8.PC == PC)
+				result.halt = HALT_STUCK;
+		}
+
+		result.cycles += ran;
+		frame_cycles += ran;
+
+		if (chip8.status == QUIT)
+			result.halt = HALT_QUIT;
+
+		while (frame_cycles >= config.cycles_per_frame)
+		{
+			frame_cycles -= config.cycles_per_frame;
+			update_timers(chip8);
+			result.frames++;
+			frame_start = true;
+		}
+	}
+
+	const auto end = std::chrono::steady_clock::now();
+	result.seconds = std::chrono::duration<double>(end - start).count();
+	result.idle_cycles = cpu.idle_cycles - idle_start;
+
+	return result;
+}
+
+// One seed of a compiled program, with the compiled blocks or the interpreter (--interpret)
+void run_aot_job(const aot_program_t& program, batch_job_t& job, aot_t& aot, const config_t& base_config, const bool interpret)
+{
+	config_t config = base_config;
+	config.seed = job.seed;
+	config.max_cycles = job.cycles;
+
+	chip8_t* chip8 = new chip8_t;
+	job.loaded = init_chip8(*chip8, config, program.rom, program.rom_size);
+
+	if (job.loaded)
+	{
+		cpu_t* cpu = new cpu_t;
+		init_cpu(*cpu, config);
+		init_aot(aot, program);
+
+		job.result = interpret ? run_headless(*chip8, config, *cpu) : run_aot(*chip8, config, *cpu, aot);
+		job.display_hash = hash_display(*chip8);
+		job.final = *chip8;
+
+		delete cpu;
+	}
+
+	delete chip8;
+}
+
+// main of a compiled program: chip8-batch for its one ROM, printing the same lines.
+//
+//   PROGRAM [--seeds N] [--threads N] [--cycles N] [--ips N] [--no-idle-skip] [--interpret]
+int aot_main(const aot_program_t& program, int argc, char* argv[])
+{
+	config_t config{ 0 };
+	if (!init_config(config, argc, argv))	// Shared flags: --cycles, --ips/-cpf, --no-idle-skip
+	{
+		return -1;
+	}
+
+	config.rom_name = program.rom_name;
+	config.headless = true;
+	config.quirks = program.quirks;			// The blocks only do what this profile does
+	config.trace = nullptr;
+
+	uint32_t threads = 0;
+	uint32_t seeds = 1;
+	bool interpret = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+
+		if (arg == "--threads" && i + 1 < argc)
+			threads = std::stoi(argv[++i]);
+		else if (arg == "--seeds" && i + 1 < argc)
+			seeds = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--interpret")
+			interpret = true;
+	}
+
+	std::vector<batch_job_t> jobs(seeds);
+	std::vector<aot_t> aots(seeds);
+	for (uint32_t seed = 0; seed < seeds; seed++)
+	{
+		jobs[seed].rom = program.rom_name;
+		jobs[seed].seed = seed;
+		jobs[seed].cycles = config.max_cycles;
+	}
+
+	decode_table(config.quirks); // Build it once before the workers race for it
+
+	const auto start = std::chrono::steady_clock::now();
+
+	run_parallel(jobs.size(), threads, [&](const size_t index, const uint32_t worker)
+	{
+		run_aot_job(program, jobs[index], aots[index], config, interpret);
+	});
+
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	uint64_t total_cycles = 0;
+	uint64_t compiled = 0;
+	uint64_t invalidated = 0;
+	for (size_t index = 0; index < jobs.size(); index++)
+	{
+		print_job(jobs[index]);
+		total_cycles += jobs[index].loaded ? jobs[index].result.cycles : 0;
+		compiled += aots[index].compiled;
+		invalidated += aots[index].invalidated;
+	}
+
+	fprintf(stderr, "%zu jobs, %llu instructions in %.3fs (%.0f instructions per second)\n",
+		jobs.size(), (long long unsigned)total_cycles, seconds, seconds > 0 ? total_cycles / seconds : 0);
+
+	if (!interpret)
+	{
+		fprintf(stderr, "AOT: %zu blocks, %.1f%% of instructions ran compiled, %llu blocks dropped for being written over\n",
+			program.block_count, total_cycles ? 100.0 * compiled / total_cycles : 0, (long long unsigned)invalidated);
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,136 @@
+#pragma once
+
+// The buzzer: an sf::SoundStream that the emulation thread drives through an SPSC ring of events.
+// The CPU loop never waits on audio, and the audio thread never locks or allocates.
+// SFML pulls AUDIO_CHUNK samples at a time and keeps three chunks queued, so 256 samples at 48kHz
+// keep a buzzer edge under one 60Hz frame from reaching the speaker
+
+#include <stdint.h>
+#include <array>
+#include <SFML/Audio.hpp>
+
+#include "structs.hpp"
+#include "spsc_ring.hpp"
+
+
+const uint32_t AUDIO_SAMPLE_RATE = 48000;
+const uint32_t AUDIO_CHUNK = 256;
+const uint32_t AUDIO_TONE_HZ = 440;
+
+// What the emulation thread tells the audio thread. XO-CHIP pattern buffers and pitch would be
+// more kinds with their data alongside
+enum
+{
+	AUDIO_BUZZER_ON,
+	AUDIO_BUZZER_OFF
+};
+
+struct audio_event_t
+{
+	uint8_t kind;
+};
+
+struct beeper_t : sf::SoundStream
+{
+	spsc_ring_t<audio_event_t, 64> events;
+
+	// Audio thread only
+	std::array<sf::Int16, AUDIO_CHUNK> samples;
+	sf::Int16 amplitude;
+	uint32_t phase;			// Square wave position: + 2 * AUDIO_TONE_HZ per sample, a half period per AUDIO_SAMPLE_RATE
+	bool high;
+	bool on;
+	bool off_next;			// An off that came with its own on, so the beep gets at least this chunk
+
+	// Emulation thread only
+	bool sent_on;			// Buzzer state last sent
+
+	beeper_t()
+	{
+		initialize(1, AUDIO_SAMPLE_RATE);
+		setProcessingInterval(sf::milliseconds(2));		// Refill chunks as soon as they play, not every 10ms
+	}
+
+	// The stream's thread calls onGetData, so it has to stop before the members go
+	~beeper_t() { stop(); }
+
+	bool onGetData(Chunk& data) override
+	{
+		bool turned_on = false;
+		audio_event_t event;
+		while (spsc_pop(events, event))
+		{
+			if (event.kind == AUDIO_BUZZER_ON)
+			{
+				on = true;
+				off_next = false;
+				turned_on = true;
+			}
+			else if (turned_on)
+			{
+				off_next = true;
+			}
+			else
+			{
+				on = false;
+			}
+		}
+
+		for (sf::Int16& sample : samples)
+		{
+			if (!on)
+			{
+				sample = 0;
+				continue;
+			}
+
+			phase += 2 * AUDIO_TONE_HZ;
+			if (phase >= AUDIO_SAMPLE_RATE)
+			{
+				phase -= AUDIO_SAMPLE_RATE;
+				high = !high;
+			}
+			sample = high ? amplitude : -amplitude;
+		}
+
+		if (off_next)
+		{
+			on = false;
+			off_next = false;
+		}
+
+		data.samples = samples.data();
+		data.sampleCount = samples.size();
+		return true;
+	}
+
+	void onSeek(sf::Time) override {}
+};
+
+
+// Start the stream, silent until the buzzer goes on. --volume 0 leaves it stopped
+void init_beeper(beeper_t& beeper, const config_t& config)
+{
+	init_spsc_ring(beeper.events);
+	beeper.amplitude = (sf::Int16)(32767 * std::min<uint32_t>(config.volume, 100) / 100);
+	beeper.phase = 0;
+	beeper.high = false;
+	beeper.on = false;
+	beeper.off_next = false;
+	beeper.sent_on = false;
+
+	if (config.volume == 0)
+		return;
+
+	beeper.play();
+}
+
+// Emulation thread, once per emulated frame between its opcodes and its timer tick, so a sound timer
+// set to 1 still sounds for its frame and every frame of a catch-up burst is seen: send the buzzer's
+// edges. A full ring keeps the edge for the next frame rather than waiting
+void update_beeper(beeper_t& beeper, const chip8_t& chip8)
+{
+	const bool on = chip8.sound_timer > 0;
+	if (on != beeper.sent_on && spsc_push(beeper.events, { (uint8_t)(on ? AUDIO_BUZZER_ON : AUDIO_BUZZER_OFF) }))
+		beeper.sent_on = on;
+}
\ No newline at end of file
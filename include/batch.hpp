@@ -0,0 +1,70 @@
+#pragma once
+
+// What chip8-batch and the chip8-aot programs run and print: one ROM, seed and cycle budget each,
+// with the results as one line of text, so runs of either can be diffed against each other
+
+#include <stdio.h>
+#include <string>
+
+#include "CHIP8.hpp"
+#include "headless.hpp"
+
+
+struct batch_job_t
+{
+	std::string rom;
+	uint32_t seed;
+	uint64_t cycles;
+
+	// Results
+	bool loaded;
+	headless_result_t result;
+	uint64_t display_hash;
+	chip8_t final;
+};
+
+
+// FNV-1a over the display rows, the same image always gives the same hash
+uint64_t hash_display(const chip8_t& chip8)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (const uint64_t row : chip8.display)
+	{
+		for (uint32_t byte = 0; byte < 8; byte++)
+		{
+			hash ^= (row >> (56 - byte * 8)) & 0xFF;
+			hash *= 1099511628211ull;
+		}
+	}
+
+	return hash;
+}
+
+void print_job(const batch_job_t& job)
+{
+	if (!job.loaded)
+	{
+		printf("%s seed=%u error=load\n", job.rom.c_str(), job.seed);
+		return;
+	}
+
+	const char* halt_names[] = { "budget", "stuck", "quit", "replay-end" };
+	const chip8_t& chip8 = job.final;
+
+	printf("%s seed=%u cycles=%llu idle=%llu halt=%s fb=%016llx PC=0x%03X I=0x%03X V=",
+		job.rom.c_str(),
+		job.seed,
+		(long long unsigned)job.result.cycles,
+		(long long unsigned)job.result.idle_cycles,
+		halt_names[job.result.halt],
+		(long long unsigned)job.display_hash,
+		chip8.PC,
+		chip8.regs.I);
+
+	for (const uint8_t V : chip8.regs.V)
+	{
+		printf("%02X", V);
+	}
+
+	printf(" DT=%u ST=%u\n", chip8.delay_timer, chip8.sound_timer);
+}
\ No newline at end of file
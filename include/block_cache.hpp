@@ -0,0 +1,177 @@
+#pragma once
+
+// Basic block cache (--dispatch block).
+// Straight runs of opcodes starting at a PC are translated once into a list of predecoded
+// handlers, up to and including the first opcode that branches, skips or writes RAM.
+// The whole block then runs without going back through fetch/decode.
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "opcodes.hpp"
+
+
+const uint32_t MAX_BLOCK_OPS = 32;
+const uint32_t MAX_BLOCK_BYTES = MAX_BLOCK_OPS * 2;
+
+struct block_t
+{
+	uint16_t start;					// Address of the first opcode
+	uint16_t end;					// One past the last byte covered
+	bool writes_ram;				// Last op is FX33/FX55, invalidate what it wrote once it has run
+	std::vector<decoded_t> ops;
+};
+
+struct block_cache_t
+{
+	std::array<std::unique_ptr<block_t>, 4096> blocks;	// Keyed by start PC
+	std::array<uint8_t, 4096> coverage;					// Number of cached blocks covering each byte of RAM
+	uint64_t translated;
+	uint64_t invalidated;
+};
+
+
+void init_block_cache(block_cache_t& cache)
+{
+	for (auto& block : cache.blocks)
+	{
+		block.reset();
+	}
+
+	cache.coverage.fill(0);
+	cache.translated = 0;
+	cache.invalidated = 0;
+}
+
+// Opcodes that end a block: anything that can move PC somewhere other than the next opcode
+bool ends_block(const instruction_t& inst)
+{
+	switch ((inst.opcode >> 12) & 0xF)
+	{
+	case 0x0: return inst.NN == 0xEE;						// 00EE
+	case 0x1: case 0x2: case 0xB: return true;				// Jumps and calls
+	case 0x3: case 0x4: case 0x5: case 0x9: return true;	// Skips
+	case 0xE: return true;									// Key skips
+	case 0xF: return inst.NN == 0x0A;						// FX0A rewinds PC while waiting
+	}
+
+	return false;
+}
+
+// Opcodes that write RAM, which may be a block we have cached
+bool writes_ram(const instruction_t& inst)
+{
+	return ((inst.opcode >> 12) & 0xF) == 0xF && (inst.NN == 0x33 || inst.NN == 0x55);
+}
+
+const block_t& translate_block(block_cache_t& cache, const decode_table_t& table, const chip8_t& chip8, const uint16_t start)
+{
+	std::unique_ptr<block_t> block = std::make_unique<block_t>();
+	block->start = start;
+	block->writes_ram = false;
+
+	uint32_t PC = start;
+	while (block->ops.size() < MAX_BLOCK_OPS && (PC + 1 < chip8.ram.size() || block->ops.empty()))
+	{
+		const uint16_t opcode = (chip8.ram[PC] << 8) | (chip8.ram[(PC + 1) & 0xFFF]);
+		const decoded_t& decoded = table[opcode];
+
+		block->ops.push_back(decoded);
+		PC += 2;
+
+		if (writes_ram(decoded.inst))
+		{
+			block->writes_ram = true;
+			break;
+		}
+
+		if (ends_block(decoded.inst))
+			break;
+	}
+
+	block->end = std::min<uint32_t>(PC, chip8.ram.size());
+
+	for (uint32_t addr = block->start; addr < block->end; addr++)
+	{
+		cache.coverage[addr]++;
+	}
+
+	cache.translated++;
+	cache.blocks[start] = std::move(block);
+
+	return *cache.blocks[start];
+}
+
+// Drop every block covering any byte in [lo, hi]
+void invalidate_blocks(block_cache_t& cache, uint32_t lo, uint32_t hi)
+{
+	hi = std::min<uint32_t>(hi, cache.coverage.size() - 1);
+
+	bool covered = false;
+	for (uint32_t addr = lo; addr <= hi; addr++)
+	{
+		covered |= cache.coverage[addr] != 0;
+	}
+
+	if (!covered)
+		return;
+
+	// A block covering lo can start at most MAX_BLOCK_BYTES - 1 bytes before it
+	const uint32_t first = lo >= MAX_BLOCK_BYTES ? lo - MAX_BLOCK_BYTES + 1 : 0;
+	for (uint32_t start = first; start <= hi; start++)
+	{
+		std::unique_ptr<block_t>& block = cache.blocks[start];
+		if (block && block->start <= hi && block->end > lo)
+		{
+			for (uint32_t addr = block->start; addr < block->end; addr++)
+			{
+				cache.coverage[addr]--;
+			}
+
+			block.reset();
+			cache.invalidated++;
+		}
+	}
+}
+
+// Run the block at PC, translating it first if needed, stopping after budget opcodes (at least 1) so
+// frames and --cycles end on the same opcode as the other interpreters. Returns the number of opcodes run
+uint32_t run_block(chip8_t& chip8, const config_t& config, block_cache_t& cache, const decode_table_t& table, const uint32_t budget)
+{
+	const uint16_t start = chip8.PC & 0xFFF;
+	chip8.PC = start;
+	const block_t& block = cache.blocks[start] ? *cache.blocks[start] : translate_block(cache, table, chip8, start);
+
+	const size_t count = std::min<size_t>(block.ops.size(), budget);
+	const bool stores = block.writes_ram && count == block.ops.size();
+	const size_t straight = stores ? count - 1 : count;
+
+	for (size_t i = 0; i < straight; i++)
+	{
+		chip8.PC += 2;
+		block.ops[i].handler(chip8, config, block.ops[i].inst);
+	}
+
+	if (stores)
+	{
+		// Work out what FX33/FX55 will write before it moves I
+		const instruction_t& inst = block.ops[count - 1].inst;
+		const uint32_t lo = chip8.regs.I & 0xFFF;
+		const uint32_t hi = lo + (inst.NN == 0x33 ? 2 : inst.X);
+
+		chip8.PC += 2;
+		block.ops[count - 1].handler(chip8, config, inst);
+
+		// May free this block, nothing below can touch it. A ROM map can prove it never hits code
+		if (!config.code_fixed)
+		{
+			invalidate_blocks(cache, lo, hi);
+			if (hi > 0xFFF)
+				invalidate_blocks(cache, 0, hi & 0xFFF);	// Wrapped past the end of RAM
+		}
+	}
+
+	return count;
+}
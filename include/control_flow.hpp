@@ -0,0 +1,145 @@
+#pragma once
+
+// Static control flow recovery for a ROM image, for the tools that look at a ROM before it runs
+// (chip8-aot, chip8-disasm). Starting at 0x200 it follows every way the interpreter can go: 1NNN and 2NNN
+// targets, the opcode after a call (where 00EE comes back to), both ways out of a skip. BNNN and
+// 00EE go somewhere only known at run time, so the walk stops there.
+// Only opcodes wholly inside the ROM are followed: anything else is left to the interpreter
+
+#include <stdint.h>
+#include <bitset>
+#include <vector>
+
+#include "opcodes.hpp"
+#include "block_cache.hpp"
+
+
+// A straight run of reachable opcodes, entered at start only, falling through or branching at the end
+struct code_block_t
+{
+	uint16_t start;		// Address of the first opcode
+	uint16_t end;		// One past the last byte covered
+};
+
+struct control_flow_t
+{
+	uint16_t rom_start;					// The ROM's bytes are [rom_start, rom_end)
+	uint16_t rom_end;
+	std::bitset<4096> code;				// Opcodes reachable from the entry point, by address of their first byte
+	std::bitset<4096> leaders;			// Reachable opcodes some other way than falling through: block starts
+	std::vector<code_block_t> blocks;	// In address order
+	bool complete;						// Every way control can go was followed: no BNNN, nothing leaving the ROM
+};
+
+
+// Where control can go after the opcode at addr, at most two places. 00EE and BNNN go nowhere
+// known. FX0A also stays where it is while no key is held, which needs no block of its own
+uint32_t next_addresses(const instruction_t& inst, const uint32_t addr, uint16_t next[2])
+{
+	switch (opcode_kind(inst))
+	{
+	case OP_00EE: case OP_BNNN:
+		return 0;
+
+	case OP_1NNN:
+		next[0] = inst.NNN;
+		return 1;
+
+	case OP_2NNN:
+		next[0] = inst.NNN;
+		next[1] = (addr + 2) & 0xFFF;	// Where 00EE returns to
+		return 2;
+
+	case OP_3XNN: case OP_4XNN: case OP_5XY0: case OP_9XY0: case OP_EX9E: case OP_EXA1:
+		next[0] = (addr + 2) & 0xFFF;
+		next[1] = (addr + 4) & 0xFFF;
+		return 2;
+	}
+
+	next[0] = (addr + 2) & 0xFFF;
+	return 1;
+}
+
+// ram is the machine's whole 4096 bytes with the size bytes of ROM at 0x200, as init_chip8 leaves it
+void analyse_control_flow(control_flow_t& flow, const uint8_t* ram, const size_t size)
+{
+	flow.rom_start = 0x200;
+	flow.rom_end = (uint16_t)std::min<size_t>(0x200 + size, 4096);
+	flow.code.reset();
+	flow.leaders.reset();
+	flow.blocks.clear();
+
+	const auto in_rom = [&](const uint32_t addr) { return addr >= flow.rom_start && addr + 1 < flow.rom_end; };
+	flow.complete = in_rom(flow.rom_start);
+
+	std::vector<uint16_t> pending;
+	if (in_rom(flow.rom_start))
+	{
+		pending.push_back(flow.rom_start);
+		flow.leaders[flow.rom_start] = true;
+	}
+
+	while (!pending.empty())
+	{
+		const uint32_t addr = pending.back();
+		pending.pop_back();
+
+		if (flow.code[addr])
+			continue;
+
+		flow.code[addr] = true;
+
+		const instruction_t inst = decode_instruction((ram[addr] << 8) | ram[addr + 1]);
+		if (opcode_kind(inst) == OP_BNNN)
+			flow.complete = false;
+
+		uint16_t next[2];
+		const uint32_t count = next_addresses(inst, addr, next);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (!in_rom(next[i]))
+			{
+				flow.complete = false;
+				continue;
+			}
+
+			// Anything but plain fall through starts a block, as does the opcode after one that
+			// ends a block (a not taken skip, the return from a call) or writes RAM
+			if (next[i] != addr + 2 || ends_block(inst) || writes_ram(inst))
+				flow.leaders[next[i]] = true;
+
+			pending.push_back(next[i]);
+		}
+	}
+
+	// Blocks run from each leader to the next leader, an opcode that ends a block or writes RAM, or MAX_BLOCK_OPS
+	for (uint32_t start = flow.rom_start; start < flow.rom_end; start++)
+	{
+		if (!flow.leaders[start] || !flow.code[start])
+			continue;
+
+		uint32_t addr = start;
+		uint32_t ops = 0;
+		while (true)
+		{
+			const instruction_t inst = decode_instruction((ram[addr] << 8) | ram[addr + 1]);
+			addr += 2;
+			ops++;
+
+			if (ends_block(inst) || writes_ram(inst))
+				break;
+
+			if (ops == MAX_BLOCK_OPS)
+			{
+				if (in_rom(addr))
+					flow.leaders[addr] = true;	// The rest is a block of its own
+				break;
+			}
+
+			if (!in_rom(addr) || !flow.code[addr] || flow.leaders[addr])
+				break;
+		}
+
+		flow.blocks.push_back(code_block_t{ (uint16_t)start, (uint16_t)addr });
+	}
+}
\ No newline at end of file
@@ -0,0 +1,118 @@
+#pragma once
+
+// What crosses between the emulation thread and the render thread, without either ever waiting.
+//
+// Frames go through a triple buffer: the emulation thread fills its back slot and swaps it with the
+// shared middle slot, the render thread swaps its front slot with the middle one when that holds a
+// frame it hasn't taken yet. Frames the render thread was too slow for are replaced by newer ones, and
+// their dirty rectangles are carried into the next frame so skipping one never leaves stale pixels.
+//
+// Input goes the other way as atomics: the keypad as one 16-bit mask, and the hotkeys as requests
+// the emulation thread takes with exchange(false)
+
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <algorithm>
+
+#include "structs.hpp"
+
+
+struct frame_t
+{
+	display_t display;
+	bool hires;
+	dirty_rect_t dirty;		// Changed since the previous frame the render thread took
+};
+
+// Set in triple_buffer_t::middle when the emulation thread put a frame there since the last take
+const uint8_t FRAME_FRESH = 4;
+
+struct triple_buffer_t
+{
+	std::array<frame_t, 3> frames;
+	std::atomic<uint8_t> middle;	// Slot index | FRAME_FRESH
+	uint8_t back;					// Emulation thread's slot
+	uint8_t front;					// Render thread's slot
+	dirty_rect_t missed;			// Emulation thread: drawn since the last frame the render thread is known to have taken
+};
+
+// Render thread to emulation thread, set by user_input
+struct host_input_t
+{
+	std::atomic<uint16_t> keypad;	// Bit N set = CHIP-8 key N held
+	std::atomic<bool> running;		// Cleared when the window closes
+	std::atomic<bool> pause;		// Space
+	std::atomic<bool> quick_save;	// F5
+	std::atomic<bool> quick_load;	// F9
+	std::atomic<bool> rewinding;	// Backspace held
+	std::atomic<bool> profile_report;	// F8, PROFILE_ON builds write the profile so far
+	std::atomic<bool> toggle_trace;	// F7
+};
+
+
+void init_triple_buffer(triple_buffer_t& buffer)
+{
+	for (frame_t& frame : buffer.frames)
+	{
+		frame.display.fill(0);
+		frame.hires = false;
+		frame.dirty = { DISPLAY_WIDTH, DISPLAY_HEIGHT, 0, 0 };
+	}
+
+	buffer.back = 0;
+	buffer.middle.store(1);
+	buffer.front = 2;
+	buffer.missed = { DISPLAY_WIDTH, DISPLAY_HEIGHT, 0, 0 };
+}
+
+void init_host_input(host_input_t& input)
+{
+	input.keypad.store(0);
+	input.running.store(true);
+	input.pause.store(false);
+	input.quick_save.store(false);
+	input.quick_load.store(false);
+	input.rewinding.store(false);
+	input.profile_report.store(false);
+	input.toggle_trace.store(false);
+}
+
+// Copy the chip8's screen into a frame and start a new dirty rectangle
+void capture_frame(frame_t& frame, chip8_t& chip8)
+{
+	frame.display = chip8.display;
+	frame.hires = chip8.hires;
+	frame.dirty = chip8.dirty;
+	clear_dirty(chip8);
+}
+
+// Emulation thread: hand the chip8's screen over to the render thread
+void publish_frame(triple_buffer_t& buffer, chip8_t& chip8)
+{
+	frame_t& frame = buffer.frames[buffer.back];
+	capture_frame(frame, chip8);
+	const dirty_rect_t drawn = frame.dirty;
+	frame.dirty.x0 = std::min(frame.dirty.x0, buffer.missed.x0);
+	frame.dirty.y0 = std::min(frame.dirty.y0, buffer.missed.y0);
+	frame.dirty.x1 = std::max(frame.dirty.x1, buffer.missed.x1);
+	frame.dirty.y1 = std::max(frame.dirty.y1, buffer.missed.y1);
+
+	const uint8_t old = buffer.middle.exchange(buffer.back | FRAME_FRESH, std::memory_order_acq_rel);
+	buffer.back = old & 3;
+
+	// The previous frame still being fresh means the render thread hasn't taken anything since, so the
+	// next frame has to cover all this one does. Otherwise it took the previous frame and only what
+	// this one drew can be news to it
+	buffer.missed = old & FRAME_FRESH ? frame.dirty : drawn;
+}
+
+// Render thread: the latest frame, or nullptr if there is none since the last take
+const frame_t* take_frame(triple_buffer_t& buffer)
+{
+	if (!(buffer.middle.load(std::memory_order_relaxed) & FRAME_FRESH))
+		return nullptr;
+
+	buffer.front = buffer.middle.exchange(buffer.front, std::memory_order_acq_rel) & 3;
+	return &buffer.frames[buffer.front];
+}
\ No newline at end of file
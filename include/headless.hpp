@@ -0,0 +1,146 @@
+#pragma once
+
+// Headless runner: steps the core with no window and no frame pacing,
+// for batch validation of ROMs on machines without a display
+
+#include <chrono>
+
+#include "CHIP8.hpp"
+#include "replay.hpp"
+
+
+enum
+{
+	HALT_NONE,			// Still running when the cycle budget ran out
+	HALT_STUCK,			// PC did not move (jump to self, or FX0A waiting on a key with no input)
+	HALT_QUIT,
+	HALT_REPLAY_END		// Played every frame of an input recording
+};
+
+struct headless_result_t
+{
+	uint64_t cycles;	// Opcodes executed, including idle_cycles
+	uint64_t idle_cycles;	// Opcodes of idle loops skipped rather than run (skip_idle_loop)
+	uint64_t frames;	// Timer ticks
+	double   seconds;	// Host time spent
+	uint8_t  halt;
+};
+
+
+// Run as fast as possible until max_cycles or a halt condition.
+// Timers still tick once per cycles_per_frame opcodes so delay loops behave the same as windowed.
+// Delay timer waits are skipped at the start of each frame; with no input, waiting for a key is a halt
+headless_result_t run_headless(chip8_t& chip8, const config_t& config, cpu_t& cpu)
+{
+	headless_result_t result{ 0 };
+	result.halt = HALT_NONE;
+
+	const auto start = std::chrono::steady_clock::now();
+	const uint64_t idle_start = cpu.idle_cycles;
+	PROFILE_TIME(cpu.profile.cpu);
+
+	uint32_t frame_cycles = 0;
+	bool frame_start = true;
+	while (result.cycles < config.max_cycles && result.halt == HALT_NONE)
+	{
+		const uint32_t PC = chip8.PC;
+		const uint32_t budget = (uint32_t)std::min<uint64_t>(config.cycles_per_frame - frame_cycles, config.max_cycles - result.cycles);
+		uint32_t ran = 0;
+
+		if (frame_start)
+		{
+			ran = skip_idle_loop(chip8, config, cpu, budget, false);
+			frame_start = false;
+		}
+
+		if (ran == 0)
+		{
+			ran = step_cpu(chip8, config, cpu, budget);
+
+			// An opcode that leaves PC where it was can never get out on its own. Only the last of a
+			// block can branch, so that is the one to look at
+			if ((chip8.PC & 0xFFF) == ((PC + (ran - 1) * 2) & 0xFFF))
+				result.halt = HALT_STUCK;
+		}
+
+		result.cycles += ran;
+		frame_cycles += ran;
+
+		if (chip8.status == QUIT)
+			result.halt = HALT_QUIT;
+
+		while (frame_cycles >= config.cycles_per_frame)
+		{
+			frame_cycles -= config.cycles_per_frame;
+			update_timers(chip8);
+			result.frames++;
+			frame_start = true;
+		}
+	}
+
+	const auto end = std::chrono::steady_clock::now();
+	result.seconds = std::chrono::duration<double>(end - start).count();
+	result.idle_cycles = cpu.idle_cycles - idle_start;
+
+	return result;
+}
+
+// Same, with a backend of its own
+headless_result_t run_headless(chip8_t& chip8, const config_t& config)
+{
+	cpu_t* cpu = new cpu_t;
+	init_cpu(*cpu, config);
+
+	const headless_result_t result = run_headless(chip8, config, *cpu);
+
+	delete cpu;
+
+	return result;
+}
+
+// Play an input recording back frame by frame as fast as possible, the same way the window runs it.
+// Stops at the end of the recording, or at max_cycles
+headless_result_t run_replay(chip8_t& chip8, const config_t& config, cpu_t& cpu, input_log_t& log)
+{
+	headless_result_t result{ 0 };
+	result.halt = HALT_NONE;
+
+	const auto start = std::chrono::steady_clock::now();
+	const uint64_t idle_start = cpu.idle_cycles;
+
+	while (result.cycles < config.max_cycles && result.halt == HALT_NONE)
+	{
+		if (!replay_input(log, chip8))
+		{
+			result.halt = HALT_REPLAY_END;
+			break;
+		}
+
+
+		result.cycles += run_frame(chip8, config, cpu);
+		result.frames++;
+
+		if (chip8.status == QUIT)
+			result.halt = HALT_QUIT;
+	}
+
+	const auto end = std::chrono::steady_clock::now();
+	result.seconds = std::chrono::duration<double>(end - start).count();
+	result.idle_cycles = cpu.idle_cycles - idle_start;
+
+	return result;
+}
+
+void print_headless_result(const headless_result_t& result, const chip8_t& chip8)
+{
+	const char* halt_names[] = { "cycle budget reached", "stuck (PC not advancing)", "quit", "end of replay" };
+	const double ips = result.seconds > 0 ? result.cycles / result.seconds : 0;
+
+	printf("Stopped: %s at PC = 0x%X\n", halt_names[result.halt], chip8.PC);
+	printf("Instructions: %llu, Frames: %llu, Time: %.3fs\n",
+		(long long unsigned)result.cycles, (long long unsigned)result.frames, result.seconds);
+	if (result.idle_cycles)
+		printf("Idle loops: %llu of the instructions skipped rather than run (%.1f%%)\n",
+			(long long unsigned)result.idle_cycles, 100.0 * result.idle_cycles / result.cycles);
+	printf("Instructions per second: %.0f (%.2f ns per instruction)\n", ips, ips > 0 ? 1e9 / ips : 0);
+}
@@ -1,5 +1,43 @@
 #pragma once
 
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <string>
+#include <algorithm>
+
+#include "quirks.hpp"
+#include "mapped_file.hpp"
+
+// fopen, without tripping MSVC's deprecation error for it
+FILE* open_file(const char* path, const char* mode)
+{
+	FILE* file = nullptr;
+#ifdef _MSC_VER
+	fopen_s(&file, path, mode);
+#else
+	file = fopen(path, mode);
+#endif
+	return file;
+}
+
+// 16 letters/digits, upper-cased into keymap
+bool parse_keymap(const char* text, char* keymap)
+{
+	if (strlen(text) != 16)
+		return false;
+
+	for (uint32_t key = 0; key < 16; key++)
+	{
+		if (!isalnum((unsigned char)text[key]))
+			return false;
+		keymap[key] = (char)toupper((unsigned char)text[key]);
+	}
+	keymap[16] = '\0';
+
+	return true;
+}
 
 bool init_config(config_t& config, const unsigned argc, char* argv[])
 {
@@ -11,11 +49,30 @@ bool init_config(config_t& config, const unsigned argc, char* argv[])
 		.scale_factor = 20,
 		.fg_color = 0xFF0000FF, // white
 		.bg_color = 0x00000000, // black
+		.plane2_color = 0x00FF00FF,
+		.overlap_color = 0xFFFF00FF,
+		.cycles_per_frame = 12, // ~700 instructions per second
 #ifdef DEBUG_ON
-		.rom_name = "ROM/pong2.ch8"
+		.rom_name = "ROM/pong2.ch8",
 #endif
+		.headless = false,
+		.max_cycles = 10000000,
+		.dispatch = DISPATCH_TABLE,
+		.quirks = QUIRKS_VIP,
+		.seed = (uint32_t)time(NULL),
+		.rewind_mb = 4,
+		.trace_records = 1 << 20,
+		.rom_index = "ROM/index.txt",
+		.keymap = "X123QWEASDZC4RFV",	// The layout in user_interface.hpp
+		.volume = 25,
+		.idle_skip = true,
+		.use_rom_map = true,
 	};
 
+#ifdef DEBUG_ON
+	config.trace = "trace.c8tr";	// Debug builds trace from the start, read it with chip8-trace
+#endif
+
 	// Change config based off flags
 	for (size_t i = 1; i < argc; i++)
 	{
@@ -23,7 +80,24 @@ bool init_config(config_t& config, const unsigned argc, char* argv[])
 
 		if (arg == "--help" || arg == "-h" && i < argc)
 		{
-			printf("Usage: PROGAME --rom-name\n-h: help\n--rom-name/-rom: Load rom\n--scale-factor/-sf: scale factor * CHIP8 resolution (64x32 * scale_factor)\n");
+			printf("Usage: PROGAME --rom-name\n-h: help\n--rom-name/-rom: Load rom\n--scale-factor/-sf: scale factor * CHIP8 resolution (64x32 * scale_factor)\n"
+				"--ips: instructions per second (rounded to a multiple of 60)\n--cycles-per-frame/-cpf: instructions run per 60Hz frame\n"
+				"--headless: run without a window at full host speed\n--cycles: headless only, max instructions to run before stopping\n"
+				"--dispatch switch/table/block/jit: interpreter to run opcodes with (default table)\n"
+				"--jit-check: with --dispatch jit, check every compiled block against the interpreter\n"
+				"--quirks vip/chip48/schip/xochip: which machine's opcode behaviour to follow (default vip)\n"
+				"--keymap: keyboard keys for CHIP-8 keys 0-F (default X123QWEASDZC4RFV)\n"
+				"--rom-index: ROM library index giving quirks, speed and keymap per ROM (default ROM/index.txt)\n"
+				"--rom-map: ROM map written by chip8-disasm (default: the ROM's name + .c8map, when there is one)\n--no-rom-map: don't use one\n"
+				"--volume: buzzer volume 0-100 (default 25, 0 = silent)\n"
+				"--no-idle-skip: run idle loops (delay timer waits, FX0A) opcode by opcode instead of skipping to the next frame\n"
+				"--load-state: restore a save state after loading the rom\n--save-state: write a save state at the end of a headless run, or on F5\n"
+				"--rewind-mb: MB of rewind history to keep (hold backspace to rewind, 0 = off)\n"
+				"--seed: seed for CXNN random numbers (default: the time)\n"
+				"--record: write the keypad input to a file\n--replay: play back a --record file, with --headless runs it at full speed\n"
+				"--profile-report: builds with PROFILE_ON only, file for the profile written at exit or on F8 (default stdout)\n"
+				"--trace: trace every opcode and write the most recent to this file at exit (F7 toggles tracing)\n"
+				"--trace-records: opcodes the trace keeps (default 1048576)\n");
 			return false;
 		}
 
@@ -39,25 +113,178 @@ bool init_config(config_t& config, const unsigned argc, char* argv[])
 			i++; // Skip the next argument (the value of --rom-name)
 		}
 
-	}
-	
-	
-}
+		if ((arg == "--ips") && i + 1 < argc)
+		{
+			// Timers and the screen run at 60Hz, so the CPU runs in batches of ips / 60
+			config.cycles_per_frame = std::max(1, std::stoi(argv[i + 1]) / 60);
+			config.given |= GIVEN_SPEED;
+			i++;
+		}
 
-bool init_sfml(sfml_t& sfml, const config_t& config)
-{
-	uint16_t width = config.screen_width * config.scale_factor;
-	uint16_t height = config.screen_height * config.scale_factor;
+		if ((arg == "--cycles-per-frame" || arg == "-cpf") && i + 1 < argc)
+		{
+			config.cycles_per_frame = std::max(1, std::stoi(argv[i + 1]));
+			config.given |= GIVEN_SPEED;
+			i++;
+		}
 
-	sfml.window.create(sf::VideoMode(width, height), "CHIP-8");
+		if (arg == "--headless")
+		{
+			config.headless = true;
+		}
 
+		if ((arg == "--cycles") && i + 1 < argc)
+		{
+			config.max_cycles = std::stoull(argv[i + 1]);
+			i++;
+		}
 
+		if ((arg == "--load-state") && i + 1 < argc)
+		{
+			config.load_state = argv[i + 1];
+			i++;
+		}
+
+		if ((arg == "--save-state") && i + 1 < argc)
+		{
+			config.save_state = argv[i + 1];
+			i++;
+		}
+
+		if ((arg == "--rewind-mb") && i + 1 < argc)
+		{
+			config.rewind_mb = std::max(0, std::stoi(argv[i + 1]));
+			i++;
+		}
+
+		if ((arg == "--seed") && i + 1 < argc)
+		{
+			config.seed = (uint32_t)std::stoul(argv[i + 1]);
+			i++;
+		}
+
+		if ((arg == "--record") && i + 1 < argc)
+		{
+			config.record = argv[i + 1];
+			i++;
+		}
 
+		if ((arg == "--replay") && i + 1 < argc)
+		{
+			config.replay = argv[i + 1];
+			i++;
+		}
+
+		if ((arg == "--profile-report") && i + 1 < argc)
+		{
+			config.profile_report = argv[i + 1];
+			i++;
+		}
+
+		if ((arg == "--trace") && i + 1 < argc)
+		{
+			config.trace = argv[i + 1];
+			i++;
+		}
+
+		if ((arg == "--trace-records") && i + 1 < argc)
+		{
+			config.trace_records = std::max(1, std::stoi(argv[i + 1]));
+			i++;
+		}
+
+		if ((arg == "--quirks") && i + 1 < argc)
+		{
+			config.quirks = parse_quirks(argv[i + 1]);
+			if (config.quirks == QUIRKS_COUNT)
+			{
+				printf("Unknown --quirks %s, expected vip, chip48, schip or xochip\n", argv[i + 1]);
+				return false;
+			}
+			config.given |= GIVEN_QUIRKS;
+			i++;
+		}
+
+		if ((arg == "--keymap") && i + 1 < argc)
+		{
+			if (!parse_keymap(argv[i + 1], config.keymap))
+			{
+				printf("--keymap needs 16 letters or digits, the keys for CHIP-8 keys 0-F\n");
+				return false;
+			}
+			config.given |= GIVEN_KEYMAP;
+			i++;
+		}
+
+		if ((arg == "--rom-index") && i + 1 < argc)
+		{
+			config.rom_index = argv[i + 1];
+			i++;
+		}
+
+		if ((arg == "--rom-map") && i + 1 < argc)
+		{
+			config.rom_map = argv[i + 1];
+			i++;
+		}
+
+		if (arg == "--no-rom-map")
+		{
+			config.use_rom_map = false;
+		}
+
+		if (arg == "--no-idle-skip")
+		{
+			config.idle_skip = false;
+		}
+
+		if ((arg == "--volume") && i + 1 < argc)
+		{
+			config.volume = std::min(100, std::max(0, std::stoi(argv[i + 1])));
+			i++;
+		}
+
+		if ((arg == "--dispatch") && i + 1 < argc)
+		{
+			const std::string value = argv[i + 1];
+			if (value == "switch")
+				config.dispatch = DISPATCH_SWITCH;
+			else if (value == "table")
+				config.dispatch = DISPATCH_TABLE;
+			else if (value == "block")
+				config.dispatch = DISPATCH_BLOCK;
+#ifdef CHIP8_JIT
+			else if (value == "jit")
+				config.dispatch = DISPATCH_JIT;
+#endif
+			else
+			{
+				printf("Unknown --dispatch %s, expected switch, table, block or jit (x86-64 builds only)\n", value.c_str());
+				return false;
+			}
+			i++;
+		}
+
+		if (arg == "--jit-check")
+		{
+			config.jit_check = true;
+		}
+
+	}
+	
 	return true;
 }
 
+// Spread the seed out, xorshift32 must never hold 0
+void seed_rng(chip8_t& chip8, const uint32_t seed)
+{
+	chip8.rng = seed * 2654435761u + 0x9E3779B9;
+	if (chip8.rng == 0)
+		chip8.rng = 1;
+}
 
-bool init_chip8(chip8_t& chip8, config_t config)
+// Power on with the size bytes of rom loaded at 0x200. config.rom_name is only for the messages
+bool init_chip8(chip8_t& chip8, const config_t& config, const uint8_t* rom, const size_t size)
 {
 	const uint32_t entry_point = 0x200; // CHIP8 Roms will be loaded to 0x200
 	const uint8_t font[] =
@@ -82,63 +309,75 @@ bool init_chip8(chip8_t& chip8, config_t config)
 
 
 	// Load font
+	chip8.ram.fill(0);
 	memcpy(&chip8.ram[0], font, sizeof(font));
 
 	// Load ROM into memory
 
 	// Clear all registers
-	for (size_t i = 0; i < 0xF; i++)
-	{
-		chip8.regs.V[i] = 0;
-	}
-
+	chip8.regs.V.fill(0);
 	chip8.regs.I = 0;
 
-	const char* rom_name = config.rom_name;
-
+	chip8.keypad = 0;
+	chip8.delay_timer = 0;
+	chip8.sound_timer = 0;
 
-	// Open ROM file
-	FILE* rom = nullptr;
-	errno_t err = fopen_s(&rom, rom_name, "rb");
-	if (err != 0) {
-		printf("Rom file %s is invalid or does not exist\n", rom_name);
-		return false;
-	}
+	seed_rng(chip8, config.seed);
 
-	// Get/check rom size
-	fseek(rom, 0, SEEK_END);
-	const size_t rom_size = ftell(rom);
+	// Check rom size
 	const size_t max_size = sizeof(chip8.ram) - entry_point;
-	rewind(rom);
 
-	if (rom_size > max_size) {
+	if (size > max_size) {
 		printf("Rom file %s is too big! Rom size: %llu, Max size allowed: %llu\n",
-			rom_name, (long long unsigned)rom_size, (long long unsigned)max_size);
+			config.rom_name, (long long unsigned)size, (long long unsigned)max_size);
 		return false;
 	}
 
 	// Load ROM
-	if (fread(&chip8.ram[entry_point], rom_size, 1, rom) != 1) {
-		printf("Could not read Rom file %s into CHIP8 memory\n",
-			rom_name);
-		return false;
-	}
-	// Close ROM
-	fclose(rom);
+	if (size > 0)
+		memcpy(&chip8.ram[entry_point], rom, size);
 
 
 
-	// Clear Display buffer
-	memset(&chip8.display[0], false, chip8.display.size());
+	// Clear Display buffer, start in lores drawing to the first plane
+	chip8.display.fill(0);
+	chip8.hires = false;
+	chip8.planes = 1;
 
 	// Set Program Counter to correct location at start
 	chip8.PC = entry_point;		// location of where programs expect PC to be at 
 
 	// Set up stack ptr
-	chip8.stack_ptr = &chip8.stack[0];
+	chip8.stack.fill(0);
+	chip8.stack_ptr = 0;
 
 	chip8.status = RUNNING;
+	clear_dirty(chip8);
+	mark_all_dirty(chip8);
 
 	return true;
 
+}
+
+bool init_chip8(chip8_t& chip8, config_t config)
+{
+	const char* rom_name = config.rom_name;
+
+
+	if (rom_name == nullptr) {
+		printf("No rom given, use --rom-name\n");
+		return false;
+	}
+
+	// Map the ROM file, the copy into RAM is the only read
+	mapped_file_t rom;
+	if (!map_file(rom_name, rom)) {
+		printf("Rom file %s is invalid or does not exist\n", rom_name);
+		return false;
+	}
+
+	const bool loaded = init_chip8(chip8, config, rom.data, rom.size);
+	unmap_file(rom);
+
+	return loaded;
 }
\ No newline at end of file
@@ -0,0 +1,915 @@
+#pragma once
+
+// x86-64 JIT (--dispatch jit). Takes the same blocks as the block cache (block_cache.hpp) and
+// compiles each one to machine code in an executable arena, run with a single call. The V
+// registers and I a block uses live in host registers for the whole block; the ALU opcodes,
+// ANNN, FX1E, the timers, CXNN, the skips and 1NNN are compiled inline, and everything else
+// (DXYN and the other display opcodes, calls, FX0A, FX65...) becomes a call to its handler in
+// opcodes.hpp with the registers written back around it.
+//
+// A block's last FX33/FX55 runs through its handler after the code returns, so what it writes can
+// drop the blocks compiled from those bytes first, as run_block does. --jit-check runs every
+// block a second time on the decode table and reports any difference in the chip8_t after it.
+//
+// Only built for x86-64 (CHIP8_JIT, structs.hpp), elsewhere --dispatch jit is refused
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "opcodes.hpp"
+#include "block_cache.hpp"
+
+#ifdef CHIP8_JIT
+
+const size_t JIT_ARENA_BYTES = 1 << 20;
+
+// What the arena is mapped with, released with the jit_t
+struct jit_arena_deleter_t
+{
+	void operator()(uint8_t* code) const
+	{
+#ifdef _WIN32
+		VirtualFree(code, 0, MEM_RELEASE);
+#else
+		munmap(code, JIT_ARENA_BYTES);
+#endif
+	}
+};
+
+// Compiled code runs with chip8 and config, and leaves PC where the block's handlers would
+typedef void (*jit_code_t)(chip8_t* chip8, const config_t* config);
+
+struct jit_block_t
+{
+	jit_code_t code;				// nullptr: not compiled
+	uint16_t end;					// One past the last byte covered
+	uint8_t ops;					// Including the FX33/FX55 that runs after the code
+	bool writes_ram;
+};
+
+struct jit_t
+{
+	std::unique_ptr<uint8_t, jit_arena_deleter_t> arena;	// Mapped on first use, writable only while compiling
+	size_t used;
+	std::array<jit_block_t, 4096> blocks;	// Keyed by start PC
+	std::array<uint8_t, 4096> coverage;		// Number of compiled blocks covering each byte of RAM
+	uint64_t compiled;
+	uint64_t invalidated;
+	uint64_t flushes;						// Times the arena filled up and everything was thrown away
+	uint64_t checked;						// --jit-check: blocks run twice and compared
+	uint64_t mismatches;
+};
+
+
+// Drop every compiled block, the arena is reused from the start
+void flush_jit(jit_t& jit)
+{
+	jit.used = 0;
+	jit.blocks.fill(jit_block_t{ nullptr, 0, 0, false });
+	jit.coverage.fill(0);
+}
+
+void init_jit(jit_t& jit)
+{
+	jit.arena.reset();
+	flush_jit(jit);
+	jit.compiled = 0;
+	jit.invalidated = 0;
+	jit.flushes = 0;
+	jit.checked = 0;
+	jit.mismatches = 0;
+}
+
+bool map_jit_arena(jit_t& jit)
+{
+#ifdef _WIN32
+	void* code = VirtualAlloc(nullptr, JIT_ARENA_BYTES, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	void* code = mmap(nullptr, JIT_ARENA_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED)
+		code = nullptr;
+#endif
+
+	if (code == nullptr)
+	{
+		printf("Could not map %zu bytes for the JIT\n", JIT_ARENA_BYTES);
+		return false;
+	}
+
+	jit.arena.reset((uint8_t*)code);
+	return true;
+}
+
+// The arena is either writable or executable, never both
+bool protect_jit_arena(jit_t& jit, const bool executable)
+{
+#ifdef _WIN32
+	DWORD old;
+	return VirtualProtect(jit.arena.get(), JIT_ARENA_BYTES, executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &old) != 0;
+#else
+	return mprotect(jit.arena.get(), JIT_ARENA_BYTES, executable ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+
+// x86-64 registers, by encoding
+enum
+{
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Condition codes for setcc/cmovcc
+enum
+{
+	CC_AE = 0x3,
+	CC_E = 0x4,
+	CC_NE = 0x5
+};
+
+// ALU opcodes in the "op r/m32, r32" form, and their /digit in "op r/m32, imm32" (0x81)
+struct jit_alu_t
+{
+	uint8_t op;
+	uint8_t digit;
+};
+
+const jit_alu_t ALU_ADD = { 0x01, 0 };
+const jit_alu_t ALU_OR = { 0x09, 1 };
+const jit_alu_t ALU_AND = { 0x21, 4 };
+const jit_alu_t ALU_SUB = { 0x29, 5 };
+const jit_alu_t ALU_XOR = { 0x31, 6 };
+const jit_alu_t ALU_CMP = { 0x39, 7 };
+
+// RBX holds the chip8_t, RAX and RCX are scratch, and these hold the block's V registers and I,
+// the ones that don't need saving first
+const uint8_t JIT_POOL[] = { RDX, RSI, RDI, R8, R9, R10, R11, RBP, R12, R13, R14, R15 };
+
+const uint8_t JIT_CONFIG_SLOT = 32;	// Above the Win64 shadow space
+
+#ifdef _WIN32
+const uint8_t JIT_ARGS[] = { RCX, RDX, R8 };
+const uint8_t JIT_CALLEE_SAVED[] = { RBX, RBP, RSI, RDI, R12, R13, R14, R15 };
+#else
+const uint8_t JIT_ARGS[] = { RDI, RSI, RDX };
+const uint8_t JIT_CALLEE_SAVED[] = { RBX, RBP, R12, R13, R14, R15 };
+#endif
+
+const uint32_t JIT_I = 16;				// Index of I after V0-VF in the register maps
+const uint32_t JIT_OFFSET_V = offsetof(chip8_t, regs) + offsetof(registers_t, V);
+const uint32_t JIT_OFFSET_I = offsetof(chip8_t, regs) + offsetof(registers_t, I);
+
+
+// Machine code for one block, written into a buffer and copied into the arena when done
+struct jit_emitter_t
+{
+	std::vector<uint8_t> code;
+	int8_t host[17];					// Host register of V0-VF and I, -1 when not kept in one
+	bool written[17];					// Written somewhere in the block, stored back around handler calls
+};
+
+void emit_u8(jit_emitter_t& e, const uint8_t byte)
+{
+	e.code.push_back(byte);
+}
+
+void emit_u32(jit_emitter_t& e, const uint32_t value)
+{
+	for (uint32_t byte = 0; byte < 4; byte++)
+	{
+		e.code.push_back((value >> (byte * 8)) & 0xFF);
+	}
+}
+
+void emit_u64(jit_emitter_t& e, const uint64_t value)
+{
+	emit_u32(e, (uint32_t)value);
+	emit_u32(e, (uint32_t)(value >> 32));
+}
+
+// REX prefix when one is needed. byte_regs: reg and rm are 8 bit registers, where 4-7 mean SPL-DIL only with a REX
+void emit_rex(jit_emitter_t& e, const bool w, const uint8_t reg, const uint8_t rm, const bool byte_regs = false)
+{
+	const uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+	if (rex != 0x40 || (byte_regs && (reg >= 4 || rm >= 4)))
+		emit_u8(e, rex);
+}
+
+// ModRM for [RBX + disp32]
+void emit_rbx_operand(jit_emitter_t& e, const uint8_t reg, const uint32_t disp)
+{
+	emit_u8(e, 0x80 | ((reg & 7) << 3) | RBX);
+	emit_u32(e, disp);
+}
+
+void emit_alu(jit_emitter_t& e, const jit_alu_t alu, const uint8_t dst, const uint8_t src)
+{
+	emit_rex(e, false, src, dst);
+	emit_u8(e, alu.op);
+	emit_u8(e, 0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void emit_alu_imm(jit_emitter_t& e, const jit_alu_t alu, const uint8_t dst, const uint32_t imm)
+{
+	emit_rex(e, false, 0, dst);
+	emit_u8(e, 0x81);
+	emit_u8(e, 0xC0 | (alu.digit << 3) | (dst & 7));
+	emit_u32(e, imm);
+}
+
+void emit_mov(jit_emitter_t& e, const uint8_t dst, const uint8_t src)
+{
+	if (dst != src)
+	{
+		emit_rex(e, false, src, dst);
+		emit_u8(e, 0x89);
+		emit_u8(e, 0xC0 | ((src & 7) << 3) | (dst & 7));
+	}
+}
+
+void emit_mov_imm(jit_emitter_t& e, const uint8_t dst, const uint32_t imm)
+{
+	emit_rex(e, false, 0, dst);
+	emit_u8(e, 0xB8 + (dst & 7));
+	emit_u32(e, imm);
+}
+
+void emit_mov64_imm(jit_emitter_t& e, const uint8_t dst, const uint64_t imm)
+{
+	emit_rex(e, true, 0, dst);
+	emit_u8(e, 0xB8 + (dst & 7));
+	emit_u64(e, imm);
+}
+
+// shl (digit 4) or shr (digit 5) by a constant
+void emit_shift(jit_emitter_t& e, const uint8_t digit, const uint8_t dst, const uint8_t count)
+{
+	emit_rex(e, false, 0, dst);
+	emit_u8(e, 0xC1);
+	emit_u8(e, 0xC0 | (digit << 3) | (dst & 7));
+	emit_u8(e, count);
+}
+
+// dst = cc ? 1 : 0, from the flags of the last compare. dst is RAX or RCX
+void emit_setcc(jit_emitter_t& e, const uint8_t cc, const uint8_t dst)
+{
+	emit_u8(e, 0x0F);
+	emit_u8(e, 0x90 | cc);
+	emit_u8(e, 0xC0 | dst);
+	emit_u8(e, 0x0F);
+	emit_u8(e, 0xB6);
+	emit_u8(e, 0xC0 | (dst << 3) | dst);
+}
+
+void emit_cmov(jit_emitter_t& e, const uint8_t cc, const uint8_t dst, const uint8_t src)
+{
+	emit_rex(e, false, dst, src);
+	emit_u8(e, 0x0F);
+	emit_u8(e, 0x40 | cc);
+	emit_u8(e, 0xC0 | ((dst & 7) << 3) | (src & 7));
+}
+
+// Byte, word and dword loads and stores at [RBX + disp], loads zero extended to 32 bits
+void emit_load8(jit_emitter_t& e, const uint8_t dst, const uint32_t disp)
+{
+	emit_rex(e, false, dst, 0);
+	emit_u8(e, 0x0F);
+	emit_u8(e, 0xB6);
+	emit_rbx_operand(e, dst, disp);
+}
+
+void emit_store8(jit_emitter_t& e, const uint32_t disp, const uint8_t src)
+{
+	emit_rex(e, false, src, 0, true);
+	emit_u8(e, 0x88);
+	emit_rbx_operand(e, src, disp);
+}
+
+void emit_load16(jit_emitter_t& e, const uint8_t dst, const uint32_t disp)
+{
+	emit_rex(e, false, dst, 0);
+	emit_u8(e, 0x0F);
+	emit_u8(e, 0xB7);
+	emit_rbx_operand(e, dst, disp);
+}
+
+void emit_store16(jit_emitter_t& e, const uint32_t disp, const uint8_t src)
+{
+	emit_u8(e, 0x66);
+	emit_rex(e, false, src, 0);
+	emit_u8(e, 0x89);
+	emit_rbx_operand(e, src, disp);
+}
+
+void emit_load32(jit_emitter_t& e, const uint8_t dst, const uint32_t disp)
+{
+	emit_rex(e, false, dst, 0);
+	emit_u8(e, 0x8B);
+	emit_rbx_operand(e, dst, disp);
+}
+
+void emit_store32(jit_emitter_t& e, const uint32_t disp, const uint8_t src)
+{
+	emit_rex(e, false, src, 0);
+	emit_u8(e, 0x89);
+	emit_rbx_operand(e, src, disp);
+}
+
+void emit_store32_imm(jit_emitter_t& e, const uint32_t disp, const uint32_t imm)
+{
+	emit_u8(e, 0xC7);
+	emit_rbx_operand(e, 0, disp);
+	emit_u32(e, imm);
+}
+
+// mov [RSP + disp8], r64 and back
+void emit_stack_store(jit_emitter_t& e, const uint8_t disp, const uint8_t src)
+{
+	emit_rex(e, true, src, RSP);
+	emit_u8(e, 0x89);
+	emit_u8(e, 0x44 | ((src & 7) << 3));
+	emit_u8(e, 0x24);
+	emit_u8(e, disp);
+}
+
+void emit_stack_load(jit_emitter_t& e, const uint8_t dst, const uint8_t disp)
+{
+	emit_rex(e, true, dst, RSP);
+	emit_u8(e, 0x8B);
+	emit_u8(e, 0x44 | ((dst & 7) << 3));
+	emit_u8(e, 0x24);
+	emit_u8(e, disp);
+}
+
+void emit_push(jit_emitter_t& e, const uint8_t reg)
+{
+	emit_rex(e, false, 0, reg);
+	emit_u8(e, 0x50 + (reg & 7));
+}
+
+void emit_pop(jit_emitter_t& e, const uint8_t reg)
+{
+	emit_rex(e, false, 0, reg);
+	emit_u8(e, 0x58 + (reg & 7));
+}
+
+
+// Where register index (V0-VF, JIT_I) lives in the chip8_t
+inline uint32_t jit_offset(const uint32_t index)
+{
+	return index == JIT_I ? JIT_OFFSET_I : JIT_OFFSET_V + index;
+}
+
+void emit_load_registers(jit_emitter_t& e)
+{
+	for (uint32_t index = 0; index <= JIT_I; index++)
+	{
+		if (e.host[index] < 0)
+			continue;
+
+		if (index == JIT_I)
+			emit_load16(e, e.host[index], jit_offset(index));
+		else
+			emit_load8(e, e.host[index], jit_offset(index));
+	}
+}
+
+void emit_store_registers(jit_emitter_t& e)
+{
+	for (uint32_t index = 0; index <= JIT_I; index++)
+	{
+		if (e.host[index] < 0 || !e.written[index])
+			continue;
+
+		if (index == JIT_I)
+			emit_store16(e, jit_offset(index), e.host[index]);
+		else
+			emit_store8(e, jit_offset(index), e.host[index]);
+	}
+}
+
+// The registers an opcode compiled inline reads or writes, as bits of V0-VF and JIT_I.
+// 0 for opcodes that go through their handler
+template <typename Q>
+uint32_t jit_registers(const instruction_t& inst, bool& writes_vf)
+{
+	const uint32_t X = 1 << inst.X;
+	const uint32_t Y = 1 << inst.Y;
+	const uint32_t F = 1 << 0xF;
+	writes_vf = false;
+
+	switch (opcode_kind(inst))
+	{
+	case OP_6XNN: case OP_7XNN: case OP_CXNN: case OP_3XNN: case OP_4XNN:
+	case OP_FX07: case OP_FX15: case OP_FX18:
+		return X;
+
+	case OP_5XY0: case OP_9XY0: case OP_8XY0:
+		return X | Y;
+
+	case OP_8XY1: case OP_8XY2: case OP_8XY3:
+		writes_vf = Q::logic_resets_vf;
+		return X | Y | (Q::logic_resets_vf ? F : 0);
+
+	case OP_8XY4: case OP_8XY5: case OP_8XY6: case OP_8XY7: case OP_8XYE:
+		writes_vf = true;
+		return X | Y | F;
+
+	case OP_ANNN:
+		return 1 << JIT_I;
+
+	case OP_FX1E:
+		return X | (1 << JIT_I);
+
+	case OP_1NNN:
+		return 1u << 31;		// Nothing, but compiled inline
+	}
+
+	return 0;
+}
+
+// Call the handler of inst with the registers in memory, PC already past it
+void emit_handler_call(jit_emitter_t& e, const decoded_t& decoded, const uint32_t next_PC)
+{
+	emit_store_registers(e);
+	emit_store32_imm(e, offsetof(chip8_t, PC), next_PC);
+
+	emit_rex(e, true, RBX, JIT_ARGS[0]);		// mov arg0, rbx
+	emit_u8(e, 0x89);
+	emit_u8(e, 0xC0 | (RBX << 3) | (JIT_ARGS[0] & 7));
+	emit_stack_load(e, JIT_ARGS[1], JIT_CONFIG_SLOT);
+	emit_mov64_imm(e, JIT_ARGS[2], (uint64_t)&decoded.inst);
+	emit_mov64_imm(e, RAX, (uint64_t)decoded.handler);
+	emit_u8(e, 0xFF);						// call rax
+	emit_u8(e, 0xD0);
+
+	emit_load_registers(e);
+}
+
+// One opcode, inline. Returns false for the ones that need their handler
+template <typename Q>
+bool emit_inline(jit_emitter_t& e, const instruction_t& inst, const uint32_t PC)
+{
+	const uint8_t X = inst.X < 16 && e.host[inst.X] >= 0 ? e.host[inst.X] : RAX;
+	const uint8_t Y = inst.Y < 16 && e.host[inst.Y] >= 0 ? e.host[inst.Y] : RAX;
+	const uint8_t F = e.host[0xF] >= 0 ? e.host[0xF] : RAX;
+	const uint8_t I = e.host[JIT_I] >= 0 ? e.host[JIT_I] : RAX;
+
+	switch (opcode_kind(inst))
+	{
+	case OP_6XNN:
+		emit_mov_imm(e, X, inst.NN);
+		return true;
+
+	case OP_7XNN:
+		emit_alu_imm(e, ALU_ADD, X, inst.NN);
+		emit_alu_imm(e, ALU_AND, X, 0xFF);
+		return true;
+
+	case OP_8XY0:
+		emit_mov(e, X, Y);
+		return true;
+
+	case OP_8XY1: case OP_8XY2: case OP_8XY3:
+	{
+		const uint8_t kind = opcode_kind(inst);
+		emit_alu(e, kind == OP_8XY1 ? ALU_OR : kind == OP_8XY2 ? ALU_AND : ALU_XOR, X, Y);
+		if constexpr (Q::logic_resets_vf)
+			emit_mov_imm(e, F, 0);
+		return true;
+	}
+
+	case OP_8XY4:	// The flag is worked out before and written after the result, as the handlers do
+		emit_mov(e, RAX, X);
+		emit_alu(e, ALU_ADD, RAX, Y);
+		emit_mov(e, RCX, RAX);
+		emit_shift(e, 5, RCX, 8);
+		emit_alu_imm(e, ALU_AND, RAX, 0xFF);
+		emit_mov(e, X, RAX);
+		emit_mov(e, F, RCX);
+		return true;
+
+	case OP_8XY5: case OP_8XY7:
+	{
+		const bool reverse = opcode_kind(inst) == OP_8XY7;
+		emit_mov(e, RAX, reverse ? Y : X);
+		emit_alu(e, ALU_SUB, RAX, reverse ? X : Y);
+		emit_setcc(e, CC_AE, RCX);
+		emit_alu_imm(e, ALU_AND, RAX, 0xFF);
+		emit_mov(e, X, RAX);
+		emit_mov(e, F, RCX);
+		return true;
+	}
+
+	case OP_8XY6: case OP_8XYE:
+	{
+		const bool left = opcode_kind(inst) == OP_8XYE;
+		emit_mov(e, RAX, Q::shift_uses_vy ? Y : X);
+		emit_mov(e, RCX, RAX);
+		if (left)
+		{
+			emit_shift(e, 5, RCX, 7);
+			emit_shift(e, 4, RAX, 1);
+			emit_alu_imm(e, ALU_AND, RAX, 0xFF);
+		}
+		else
+		{
+			emit_alu_imm(e, ALU_AND, RCX, 1);
+			emit_shift(e, 5, RAX, 1);
+		}
+		emit_mov(e, X, RAX);
+		emit_mov(e, F, RCX);
+		return true;
+	}
+
+	case OP_ANNN:
+		emit_mov_imm(e, I, inst.NNN);
+		return true;
+
+	case OP_FX1E:
+		emit_alu(e, ALU_ADD, I, X);
+		emit_alu_imm(e, ALU_AND, I, 0xFFFF);
+		return true;
+
+	case OP_FX07:
+		emit_load8(e, X, offsetof(chip8_t, delay_timer));
+		return true;
+
+	case OP_FX15:
+		emit_store8(e, offsetof(chip8_t, delay_timer), X);
+		return true;
+
+	case OP_FX18:
+		emit_store8(e, offsetof(chip8_t, sound_timer), X);
+		return true;
+
+	case OP_CXNN:	// next_random: xorshift32 on chip8.rng
+		emit_load32(e, RAX, offsetof(chip8_t, rng));
+		emit_mov(e, RCX, RAX); emit_shift(e, 4, RCX, 13); emit_alu(e, ALU_XOR, RAX, RCX);
+		emit_mov(e, RCX, RAX); emit_shift(e, 5, RCX, 17); emit_alu(e, ALU_XOR, RAX, RCX);
+		emit_mov(e, RCX, RAX); emit_shift(e, 4, RCX, 5); emit_alu(e, ALU_XOR, RAX, RCX);
+		emit_store32(e, offsetof(chip8_t, rng), RAX);
+		emit_shift(e, 5, RAX, 24);
+		emit_alu_imm(e, ALU_AND, RAX, inst.NN);
+		emit_mov(e, X, RAX);
+		return true;
+
+	case OP_3XNN: case OP_4XNN: case OP_5XY0: case OP_9XY0:
+	{
+		const uint8_t kind = opcode_kind(inst);
+		if (kind == OP_3XNN || kind == OP_4XNN)
+			emit_alu_imm(e, ALU_CMP, X, inst.NN);
+		else
+			emit_alu(e, ALU_CMP, X, Y);
+
+		emit_mov_imm(e, RAX, PC + 2);
+		emit_mov_imm(e, RCX, PC + 4);
+		emit_cmov(e, kind == OP_3XNN || kind == OP_5XY0 ? CC_E : CC_NE, RAX, RCX);
+		emit_store32(e, offsetof(chip8_t, PC), RAX);
+		return true;
+	}
+
+	case OP_1NNN:
+		emit_store32_imm(e, offsetof(chip8_t, PC), inst.NNN);
+		return true;
+	}
+
+	return false;
+}
+
+// Give the registers the inline opcodes use host registers, in order of first use. Opcodes
+// needing one when the pool has run out go through their handler instead
+template <typename Q>
+void allocate_registers(jit_emitter_t& e, const std::vector<const decoded_t*>& ops, std::vector<bool>& inline_ops)
+{
+	memset(e.host, -1, sizeof(e.host));
+	memset(e.written, 0, sizeof(e.written));
+
+	uint32_t pool = 0;
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		bool writes_vf = false;
+		const uint32_t registers = jit_registers<Q>(ops[i]->inst, writes_vf);
+		const uint32_t used = registers & ((1 << 17) - 1);
+		inline_ops[i] = registers != 0;
+
+		uint32_t needed = 0;
+		for (uint32_t index = 0; index <= JIT_I; index++)
+		{
+			needed += ((used >> index) & 1) && e.host[index] < 0;
+		}
+
+		if (!inline_ops[i] || pool + needed > sizeof(JIT_POOL))
+		{
+			inline_ops[i] = false;
+			continue;
+		}
+
+		for (uint32_t index = 0; index <= JIT_I; index++)
+		{
+			if (((used >> index) & 1) && e.host[index] < 0)
+				e.host[index] = JIT_POOL[pool++];
+		}
+
+		// What the opcode writes: VX (or I), and VF for the ones with a flag
+		const uint8_t kind = opcode_kind(ops[i]->inst);
+		if (kind == OP_ANNN || kind == OP_FX1E)
+			e.written[JIT_I] = true;
+		else if (kind != OP_3XNN && kind != OP_4XNN && kind != OP_5XY0 && kind != OP_9XY0 &&
+			kind != OP_FX15 && kind != OP_FX18 && kind != OP_1NNN)
+			e.written[ops[i]->inst.X] = true;
+
+		if (writes_vf)
+			e.written[0xF] = true;
+	}
+}
+
+// The code for ops, the block at start less any FX33/FX55 at the end
+template <typename Q>
+void emit_block(jit_emitter_t& e, const std::vector<const decoded_t*>& ops, const uint32_t start)
+{
+	std::vector<bool> inline_ops(ops.size());
+	allocate_registers<Q>(e, ops, inline_ops);
+
+	// Save RBX and the callee saved registers the block was given, and keep the stack 16 aligned for calls
+	std::vector<uint8_t> saved;
+	for (const uint8_t reg : JIT_CALLEE_SAVED)
+	{
+		if (reg == RBX || std::find(e.host, e.host + 17, reg) != e.host + 17)
+			saved.push_back(reg);
+	}
+
+	const uint8_t frame = saved.size() % 2 ? 48 : 40;
+	for (const uint8_t reg : saved)
+	{
+		emit_push(e, reg);
+	}
+	emit_rex(e, true, 0, RSP);		// sub rsp, frame
+	emit_u8(e, 0x83);
+	emit_u8(e, 0xEC);
+	emit_u8(e, frame);
+
+	emit_stack_store(e, JIT_CONFIG_SLOT, JIT_ARGS[1]);
+	emit_rex(e, true, JIT_ARGS[0], RBX);	// mov rbx, arg0
+	emit_u8(e, 0x89);
+	emit_u8(e, 0xC0 | ((JIT_ARGS[0] & 7) << 3) | RBX);
+
+	emit_load_registers(e);
+
+	bool moved_PC = false;
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		const uint32_t PC = start + (uint32_t)i * 2;
+		const decoded_t& decoded = *ops[i];
+
+		if (decoded.handler == op_unknown)
+			continue;
+
+		if (!inline_ops[i] || !emit_inline<Q>(e, decoded.inst, PC))
+			emit_handler_call(e, decoded, PC + 2);
+
+		moved_PC = ends_block(decoded.inst);
+	}
+
+	if (!moved_PC)
+		emit_store32_imm(e, offsetof(chip8_t, PC), start + (uint32_t)ops.size() * 2);
+
+	emit_store_registers(e);
+
+	emit_rex(e, true, 0, RSP);		// add rsp, frame
+	emit_u8(e, 0x83);
+	emit_u8(e, 0xC4);
+	emit_u8(e, frame);
+	for (size_t reg = saved.size(); reg-- > 0;)
+	{
+		emit_pop(e, saved[reg]);
+	}
+	emit_u8(e, 0xC3);				// ret
+}
+
+// The block at start as run_block would translate it, compiled into the arena
+template <typename Q>
+const jit_block_t* compile_block(jit_t& jit, const decode_table_t& table, const chip8_t& chip8, const uint16_t start)
+{
+	if (!jit.arena && !map_jit_arena(jit))
+		return nullptr;
+
+	std::vector<const decoded_t*> ops;	// Into the decode table, which outlives the code calling its handlers
+	jit_block_t block{ nullptr, 0, 0, false };
+
+	uint32_t PC = start;
+	while (ops.size() < MAX_BLOCK_OPS && (PC + 1 < chip8.ram.size() || ops.empty()))
+	{
+		const uint16_t opcode = (chip8.ram[PC] << 8) | (chip8.ram[(PC + 1) & 0xFFF]);
+		const decoded_t& decoded = table[opcode];
+
+		ops.push_back(&decoded);
+		PC += 2;
+
+		if (writes_ram(decoded.inst))
+		{
+			block.writes_ram = true;
+			break;
+		}
+
+		if (ends_block(decoded.inst))
+			break;
+	}
+
+	block.end = (uint16_t)std::min<uint32_t>(PC, chip8.ram.size());
+	block.ops = (uint8_t)ops.size();
+
+	if (block.writes_ram)
+		ops.pop_back();
+
+	jit_emitter_t e;
+	emit_block<Q>(e, ops, start);
+
+	if (jit.used + e.code.size() > JIT_ARENA_BYTES)
+	{
+		flush_jit(jit);
+		jit.flushes++;
+	}
+
+	if (!protect_jit_arena(jit, false))
+		return nullptr;
+
+	uint8_t* code = jit.arena.get() + jit.used;
+	memcpy(code, e.code.data(), e.code.size());
+	jit.used += (e.code.size() + 15) & ~(size_t)15;
+
+	if (!protect_jit_arena(jit, true))
+		return nullptr;
+
+	block.code = (jit_code_t)code;
+	for (uint32_t addr = start; addr < block.end; addr++)
+	{
+		jit.coverage[addr]++;
+	}
+
+	jit.compiled++;
+	jit.blocks[start] = block;
+
+	return &jit.blocks[start];
+}
+
+// Drop every block covering any byte in [lo, hi]. Their code stays in the arena until it is flushed
+void invalidate_jit(jit_t& jit, uint32_t lo, uint32_t hi)
+{
+	hi = std::min<uint32_t>(hi, jit.coverage.size() - 1);
+
+	bool covered = false;
+	for (uint32_t addr = lo; addr <= hi; addr++)
+	{
+		covered |= jit.coverage[addr] != 0;
+	}
+
+	if (!covered)
+		return;
+
+	const uint32_t first = lo >= MAX_BLOCK_BYTES ? lo - MAX_BLOCK_BYTES + 1 : 0;
+	for (uint32_t start = first; start <= hi; start++)
+	{
+		jit_block_t& block = jit.blocks[start];
+		if (block.code && start <= hi && block.end > lo)
+		{
+			for (uint32_t addr = start; addr < block.end; addr++)
+			{
+				jit.coverage[addr]--;
+			}
+
+			block.code = nullptr;
+			jit.invalidated++;
+		}
+	}
+}
+
+// The first part of the machine two chip8_t differ in, nullptr if they are the same
+const char* jit_difference(const chip8_t& a, const chip8_t& b)
+{
+	if (a.PC != b.PC) return "PC";
+	if (a.regs.V != b.regs.V) return "V";
+	if (a.regs.I != b.regs.I) return "I";
+	if (a.stack_ptr != b.stack_ptr || a.stack != b.stack) return "stack";
+	if (a.delay_timer != b.delay_timer || a.sound_timer != b.sound_timer) return "timers";
+	if (a.rng != b.rng) return "rng";
+	if (a.ram != b.ram) return "RAM";
+	if (a.display != b.display) return "display";
+	if (a.hires != b.hires || a.planes != b.planes || a.status != b.status || a.draw != b.draw) return "state";
+	return nullptr;
+}
+
+// One opcode through the decode table, as run_single_opcode_table
+inline void jit_interpret(chip8_t& chip8, const config_t& config, const decode_table_t& table)
+{
+	const decoded_t& decoded = table[(chip8.ram[chip8.PC & 0xFFF] << 8) | chip8.ram[(chip8.PC + 1) & 0xFFF]];
+	chip8.PC += 2;
+	decoded.handler(chip8, config, decoded.inst);
+}
+
+// run_block with the compiled code, stopping after budget opcodes (at least 1). Returns the number of opcodes run
+uint32_t run_jit_block(chip8_t& chip8, const config_t& config, jit_t& jit, const decode_table_t& table, const uint32_t budget)
+{
+	const uint16_t start = chip8.PC & 0xFFF;
+	chip8.PC = start;
+
+	const jit_block_t* block = jit.blocks[start].code ? &jit.blocks[start] :
+		with_quirks(config.quirks, [&]<typename Q>() { return compile_block<Q>(jit, table, chip8, start); });
+
+	if (block == nullptr)
+	{
+		jit_interpret(chip8, config, table);	// No arena to compile into
+		return 1;
+	}
+
+	// The frame or --cycles ends partway through: the interpreter runs what is left of it. Only a
+	// block's last opcode can store, and that is never one of these
+	if (block->ops > budget)
+	{
+		for (uint32_t i = 0; i < budget; i++)
+		{
+			jit_interpret(chip8, config, table);
+		}
+		return budget;
+	}
+
+	const uint32_t count = block->ops;
+	const bool stores = block->writes_ram;
+	std::unique_ptr<chip8_t> reference = config.jit_check ? std::make_unique<chip8_t>(chip8) : nullptr;
+
+	block->code(&chip8, &config);
+
+	if (stores)
+	{
+		// Work out what FX33/FX55 will write before it moves I
+		const decoded_t& decoded = table[(chip8.ram[chip8.PC] << 8) | chip8.ram[(chip8.PC + 1) & 0xFFF]];
+		const uint32_t lo = chip8.regs.I & 0xFFF;
+		const uint32_t hi = lo + (decoded.inst.NN == 0x33 ? 2 : decoded.inst.X);
+
+		chip8.PC += 2;
+		decoded.handler(chip8, config, decoded.inst);
+
+		// May drop this block, nothing below can touch it
+		if (!config.code_fixed)
+		{
+			invalidate_jit(jit, lo, hi);
+			if (hi > 0xFFF)
+				invalidate_jit(jit, 0, hi & 0xFFF);
+		}
+	}
+
+	if (reference)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			jit_interpret(*reference, config, table);
+		}
+
+		jit.checked++;
+		const char* difference = jit_difference(chip8, *reference);
+		if (difference)
+		{
+			if (jit.mismatches++ < 16)
+			{
+				printf("JIT mismatch: block at 0x%03X (%u opcodes) leaves %s different from the interpreter. Opcodes:", start, count, difference);
+				for (uint32_t addr = start; addr < start + count * 2; addr += 2)
+				{
+					printf(" %02X%02X", reference->ram[addr & 0xFFF], reference->ram[(addr + 1) & 0xFFF]);
+				}
+				printf("\n");
+			}
+
+			chip8 = *reference;		// Carry on from the interpreter's result
+		}
+	}
+
+	return count;
+}
+
+void print_jit_stats(const jit_t& jit)
+{
+	printf("JIT: %llu blocks compiled, %llu dropped for being written over, %zu KB of code, %llu arena flushes\n",
+		(long long unsigned)jit.compiled, (long long unsigned)jit.invalidated, jit.used >> 10, (long long unsigned)jit.flushes);
+	if (jit.checked)
+		printf("JIT check: %llu blocks compared with the interpreter, %llu mismatches\n",
+			(long long unsigned)jit.checked, (long long unsigned)jit.mismatches);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+
+// libchip8: many CHIP-8 machines behind a C ABI, for stepping environments from a training loop.
+// One chip8_envs_t holds count machines running the same ROM and is stepped from one thread; for
+// more cores, make one per thread, they share nothing.
+//
+// Nothing allocates after chip8_create: step runs the machines in place, observe writes the screens
+// straight into the caller's buffer and chip8_ram points into the machine itself.
+//
+//   chip8_envs_t* envs = chip8_create("ROM/pong2.ch8", 256, NULL);
+//   chip8_step(envs, actions, 4);		// actions[256], bit N = CHIP-8 key N held
+//   chip8_observe(envs, pixels);		// pixels[256 * CHIP8_OBSERVATION_SIZE]
+//   chip8_destroy(envs);
+
+#include <stdint.h>
+
+#if defined(CHIP8_SHARED) && defined(_WIN32)
+#ifdef CHIP8_BUILD
+#define CHIP8_API __declspec(dllexport)
+#else
+#define CHIP8_API __declspec(dllimport)
+#endif
+#elif defined(CHIP8_SHARED)
+#define CHIP8_API __attribute__((visibility("default")))
+#else
+#define CHIP8_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// An observation is the 64x32 screen, a byte a pixel, row by row. Bit 0 is the first bitplane and
+// bit 1 the second (XO-CHIP only), so pixels are 0 or 1 anywhere else. The 128x64 SUPER-CHIP/XO-CHIP
+// screen comes out halved, a pixel being on when any of its 2x2 block is
+#define CHIP8_OBSERVATION_WIDTH 64
+#define CHIP8_OBSERVATION_HEIGHT 32
+#define CHIP8_OBSERVATION_SIZE (CHIP8_OBSERVATION_WIDTH * CHIP8_OBSERVATION_HEIGHT)
+
+#define CHIP8_RAM_SIZE 4096
+
+typedef struct chip8_envs chip8_envs_t;
+
+typedef struct chip8_options
+{
+	const char* quirks;		// "vip", "chip48", "schip" or "xochip", NULL for vip
+	uint32_t ips;			// Instructions per second, 0 for the default 720 (12 a frame)
+	uint32_t seed;			// Env N starts with CXNN seeded from seed + N
+	int idle_skip;			// Nonzero: jump over idle loops rather than run them, same results
+} chip8_options_t;
+
+// The options chip8_create uses when given NULL
+CHIP8_API void chip8_default_options(chip8_options_t* options);
+
+// count machines with rom loaded, or NULL when the ROM or the options are no good
+CHIP8_API chip8_envs_t* chip8_create(const char* rom, uint32_t count, const chip8_options_t* options);
+CHIP8_API void chip8_destroy(chip8_envs_t* envs);
+
+// Put env back to the machine it was right after loading the ROM, with CXNN seeded from seed
+CHIP8_API void chip8_reset(chip8_envs_t* envs, uint32_t env, uint32_t seed);
+
+// Hold the keys actions[N] for env N (bit K = key K, NULL for none) and run every env frames 60Hz
+// frames, timers included
+CHIP8_API void chip8_step(chip8_envs_t* envs, const uint16_t* actions, uint32_t frames);
+
+// Every env's screen into pixels, count * CHIP8_OBSERVATION_SIZE bytes, env 0 first
+CHIP8_API void chip8_observe(const chip8_envs_t* envs, uint8_t* pixels);
+
+// env's CHIP8_RAM_SIZE bytes of RAM, for reading scores and lives out of. Valid until chip8_destroy
+CHIP8_API const uint8_t* chip8_ram(const chip8_envs_t* envs, uint32_t env);
+
+#ifdef __cplusplus
+}
+#endif
\ No newline at end of file
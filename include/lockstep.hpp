@@ -0,0 +1,616 @@
+#pragma once
+
+// Lockstep engine: LOCKSTEP_LANES machines running the same ROM (different seeds, different inputs)
+// one opcode at a time, all of them together. V, I and PC live here as lane arrays, V[register][lane],
+// so lanes sitting on the same opcode at the same PC are one group, and the ALU, skip and jump opcodes
+// of a group run as byte vectors across it (AVX2 when the compiler targets it, SSE2 otherwise) with
+// the lanes outside the group masked off. Every other opcode runs lane by lane through the decode
+// table on the lane's own chip8_t, which keeps RAM, stack, timers, keypad and screen.
+//
+// Every lane runs exactly one opcode per step, so all of them see the same cycle count and timer ticks,
+// and each lane ends up exactly where run_headless would have left it on its own. A lane whose idle loop
+// is skipped at a frame start sits out the steps it jumped over, as the opcodes run_headless skips.
+// Lanes only stay together while they take the same branches: random numbers and different input
+// split them up
+
+#include <stdint.h>
+#include <array>
+#include <bit>
+#include <bitset>
+#include <chrono>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#endif
+
+#include "CHIP8.hpp"
+#include "headless.hpp"
+
+
+const uint32_t LOCKSTEP_LANES = 32;
+typedef uint32_t lane_mask_t;		// Bit N = lane N
+static_assert(LOCKSTEP_LANES == 32, "lane_mask_t and lanes_equal are 32 lanes wide");
+
+// Below this many lanes a group on average, a lane by itself runs faster than in lockstep
+const uint32_t LOCKSTEP_MIN_GROUP = 4;
+
+
+// Byte vectors over the lanes: simd_t holds SIMD_BYTES lanes of one register, and masks are 0xFF per
+// lane that is on. Plain bytes when there is no SIMD to be had
+#if defined(__AVX2__)
+
+typedef __m256i simd_t;
+const uint32_t SIMD_BYTES = 32;
+
+inline simd_t simd_load(const uint8_t* p) { return _mm256_load_si256((const simd_t*)p); }
+inline void simd_store(uint8_t* p, const simd_t v) { _mm256_store_si256((simd_t*)p, v); }
+inline simd_t simd_splat(const uint8_t b) { return _mm256_set1_epi8((char)b); }
+inline simd_t simd_add(const simd_t a, const simd_t b) { return _mm256_add_epi8(a, b); }
+inline simd_t simd_sub(const simd_t a, const simd_t b) { return _mm256_sub_epi8(a, b); }
+inline simd_t simd_and(const simd_t a, const simd_t b) { return _mm256_and_si256(a, b); }
+inline simd_t simd_or(const simd_t a, const simd_t b) { return _mm256_or_si256(a, b); }
+inline simd_t simd_xor(const simd_t a, const simd_t b) { return _mm256_xor_si256(a, b); }
+inline simd_t simd_andnot(const simd_t a, const simd_t b) { return _mm256_andnot_si256(a, b); }
+inline simd_t simd_eq(const simd_t a, const simd_t b) { return _mm256_cmpeq_epi8(a, b); }
+inline simd_t simd_ge(const simd_t a, const simd_t b) { return _mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a); }
+inline simd_t simd_shr1(const simd_t v) { return simd_and(_mm256_srli_epi16(v, 1), simd_splat(0x7F)); }
+inline simd_t simd_shr7(const simd_t v) { return simd_and(_mm256_srli_epi16(v, 7), simd_splat(0x01)); }
+inline simd_t simd_select(const simd_t mask, const simd_t a, const simd_t b) { return _mm256_blendv_epi8(b, a, mask); }
+
+// Lanes whose value is value
+inline lane_mask_t lanes_equal(const uint16_t* values, const uint16_t value)
+{
+	const __m256i v = _mm256_set1_epi16((short)value);
+	const __m256i lo = _mm256_cmpeq_epi16(_mm256_load_si256((const __m256i*)values), v);
+	const __m256i hi = _mm256_cmpeq_epi16(_mm256_load_si256((const __m256i*)(values + 16)), v);
+	return (lane_mask_t)_mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8));
+}
+
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+typedef __m128i simd_t;
+const uint32_t SIMD_BYTES = 16;
+
+inline simd_t simd_load(const uint8_t* p) { return _mm_load_si128((const simd_t*)p); }
+inline void simd_store(uint8_t* p, const simd_t v) { _mm_store_si128((simd_t*)p, v); }
+inline simd_t simd_splat(const uint8_t b) { return _mm_set1_epi8((char)b); }
+inline simd_t simd_add(const simd_t a, const simd_t b) { return _mm_add_epi8(a, b); }
+inline simd_t simd_sub(const simd_t a, const simd_t b) { return _mm_sub_epi8(a, b); }
+inline simd_t simd_and(const simd_t a, const simd_t b) { return _mm_and_si128(a, b); }
+inline simd_t simd_or(const simd_t a, const simd_t b) { return _mm_or_si128(a, b); }
+inline simd_t simd_xor(const simd_t a, const simd_t b) { return _mm_xor_si128(a, b); }
+inline simd_t simd_andnot(const simd_t a, const simd_t b) { return _mm_andnot_si128(a, b); }
+inline simd_t simd_eq(const simd_t a, const simd_t b) { return _mm_cmpeq_epi8(a, b); }
+inline simd_t simd_ge(const simd_t a, const simd_t b) { return _mm_cmpeq_epi8(_mm_max_epu8(a, b), a); }
+inline simd_t simd_shr1(const simd_t v) { return simd_and(_mm_srli_epi16(v, 1), simd_splat(0x7F)); }
+inline simd_t simd_shr7(const simd_t v) { return simd_and(_mm_srli_epi16(v, 7), simd_splat(0x01)); }
+inline simd_t simd_select(const simd_t mask, const simd_t a, const simd_t b) { return simd_or(simd_and(mask, a), simd_andnot(mask, b)); }
+
+inline lane_mask_t lanes_equal(const uint16_t* values, const uint16_t value)
+{
+	const __m128i v = _mm_set1_epi16((short)value);
+	lane_mask_t equal = 0;
+	for (uint32_t i = 0; i < LOCKSTEP_LANES; i += 16)
+	{
+		const __m128i lo = _mm_cmpeq_epi16(_mm_load_si128((const __m128i*)(values + i)), v);
+		const __m128i hi = _mm_cmpeq_epi16(_mm_load_si128((const __m128i*)(values + i + 8)), v);
+		equal |= (lane_mask_t)_mm_movemask_epi8(_mm_packs_epi16(lo, hi)) << i;
+	}
+	return equal;
+}
+
+#else
+
+typedef uint8_t simd_t;
+const uint32_t SIMD_BYTES = 1;
+
+inline simd_t simd_load(const uint8_t* p) { return *p; }
+inline void simd_store(uint8_t* p, const simd_t v) { *p = v; }
+inline simd_t simd_splat(const uint8_t b) { return b; }
+inline simd_t simd_add(const simd_t a, const simd_t b) { return a + b; }
+inline simd_t simd_sub(const simd_t a, const simd_t b) { return a - b; }
+inline simd_t simd_and(const simd_t a, const simd_t b) { return a & b; }
+inline simd_t simd_or(const simd_t a, const simd_t b) { return a | b; }
+inline simd_t simd_xor(const simd_t a, const simd_t b) { return a ^ b; }
+inline simd_t simd_andnot(const simd_t a, const simd_t b) { return ~a & b; }
+inline simd_t simd_eq(const simd_t a, const simd_t b) { return a == b ? 0xFF : 0; }
+inline simd_t simd_ge(const simd_t a, const simd_t b) { return a >= b ? 0xFF : 0; }
+inline simd_t simd_shr1(const simd_t v) { return v >> 1; }
+inline simd_t simd_shr7(const simd_t v) { return v >> 7; }
+inline simd_t simd_select(const simd_t mask, const simd_t a, const simd_t b) { return (mask & a) | (~mask & b); }
+
+inline lane_mask_t lanes_equal(const uint16_t* values, const uint16_t value)
+{
+	lane_mask_t equal = 0;
+	for (uint32_t lane = 0; lane < LOCKSTEP_LANES; lane++)
+	{
+		equal |= (lane_mask_t)(values[lane] == value) << lane;
+	}
+	return equal;
+}
+
+#endif
+
+
+struct lockstep_t
+{
+	alignas(32) std::array<std::array<uint8_t, LOCKSTEP_LANES>, 16> V;	// V[register][lane]
+	alignas(32) std::array<uint16_t, LOCKSTEP_LANES> I;
+	alignas(32) std::array<uint16_t, LOCKSTEP_LANES> PC;
+	alignas(32) std::array<uint8_t, LOCKSTEP_LANES> group;	// 0xFF for the lanes of the group running now
+	alignas(32) std::array<uint8_t, LOCKSTEP_LANES> skip;	// Skip opcodes: 2 for the lanes that skip
+
+	std::array<chip8_t*, LOCKSTEP_LANES> lanes;		// Everything else of each lane's machine, owned by the caller
+	std::bitset<4096> written;		// RAM some lane has stored to. Everywhere else all lanes still hold the same bytes
+	std::array<headless_result_t, LOCKSTEP_LANES> results;
+	uint32_t count;
+	lane_mask_t live;			// Lanes that haven't halted
+	lane_mask_t idle;			// Live lanes sitting out the idle loop skipped at this frame's start
+	std::array<uint32_t, LOCKSTEP_LANES> wake;	// Opcode of the frame each idle lane comes back in at
+
+	uint64_t groups;			// Groups stepped, each one opcode on up to LOCKSTEP_LANES lanes
+	uint64_t vector_opcodes;	// Lane opcodes run as part of a vector, and one lane at a time
+	uint64_t scalar_opcodes;
+};
+
+
+// Take over count machines, each already set up by init_chip8 with the same ROM
+void init_lockstep(lockstep_t& ls, chip8_t* const* lanes, const uint32_t count)
+{
+	ls.count = std::min(count, LOCKSTEP_LANES);
+	ls.live = ls.count == LOCKSTEP_LANES ? ~0u : (1u << ls.count) - 1;
+	ls.idle = 0;
+	ls.groups = 0;
+	ls.vector_opcodes = 0;
+	ls.scalar_opcodes = 0;
+	ls.written.reset();
+
+	for (uint32_t lane = 0; lane < LOCKSTEP_LANES; lane++)
+	{
+		if (lane < ls.count && lanes[lane]->ram != lanes[0]->ram)
+			ls.written.set();
+
+		// Unused lanes stay zeroed and are never in a group
+		ls.lanes[lane] = lane < ls.count ? lanes[lane] : nullptr;
+		ls.results[lane] = headless_result_t{ 0 };
+		ls.results[lane].halt = HALT_NONE;
+		ls.wake[lane] = 0;
+		ls.I[lane] = lane < ls.count ? lanes[lane]->regs.I : 0;
+		ls.PC[lane] = lane < ls.count ? (uint16_t)lanes[lane]->PC : 0;
+		for (uint32_t reg = 0; reg < 16; reg++)
+		{
+			ls.V[reg][lane] = lane < ls.count ? lanes[lane]->regs.V[reg] : 0;
+		}
+	}
+}
+
+// Write the lane arrays back into the lanes' chip8_t
+void store_lockstep(lockstep_t& ls)
+{
+	for (uint32_t lane = 0; lane < ls.count; lane++)
+	{
+		chip8_t& chip8 = *ls.lanes[lane];
+		chip8.regs.I = ls.I[lane];
+		chip8.PC = ls.PC[lane];
+		for (uint32_t reg = 0; reg < 16; reg++)
+		{
+			chip8.regs.V[reg] = ls.V[reg][lane];
+		}
+	}
+}
+
+
+// VX = op(VX, VY) for the lanes in the group, and VF = the flag op sets when FLAG. Like the handlers,
+// the flag is written after the result so with X = F the flag wins
+template <bool FLAG, typename F>
+inline void lockstep_alu(lockstep_t& ls, const instruction_t& inst, const F& op)
+{
+	for (uint32_t i = 0; i < LOCKSTEP_LANES; i += SIMD_BYTES)
+	{
+		const simd_t mask = simd_load(&ls.group[i]);
+		const simd_t x = simd_load(&ls.V[inst.X][i]);
+		const simd_t y = simd_load(&ls.V[inst.Y][i]);
+		simd_t flag = simd_splat(0);
+
+		simd_store(&ls.V[inst.X][i], simd_select(mask, op(x, y, flag), x));
+
+		if constexpr (FLAG)
+			simd_store(&ls.V[0xF][i], simd_select(mask, flag, simd_load(&ls.V[0xF][i])));
+	}
+}
+
+// ls.skip = 2 for the lanes where the skip opcode's condition holds
+template <typename F>
+inline void lockstep_condition(lockstep_t& ls, const instruction_t& inst, const F& condition)
+{
+	for (uint32_t i = 0; i < LOCKSTEP_LANES; i += SIMD_BYTES)
+	{
+		const simd_t x = simd_load(&ls.V[inst.X][i]);
+		const simd_t y = simd_load(&ls.V[inst.Y][i]);
+		simd_store(&ls.skip[i], simd_and(condition(x, y), simd_splat(2)));
+	}
+}
+
+// Run the group's opcode across it, PC is left to the caller. False for the opcodes that need
+// more of the machine and so run lane by lane through their handlers
+template <typename Q>
+bool run_lockstep_vector(lockstep_t& ls, const instruction_t& inst, const uint8_t kind, const lane_mask_t group)
+{
+	const simd_t one = simd_splat(1);
+	const simd_t NN = simd_splat(inst.NN);
+	const simd_t vf_reset = simd_splat(0);
+
+	switch (kind)
+	{
+	case OP_6XNN: lockstep_alu<false>(ls, inst, [&](simd_t x, simd_t y, simd_t& f) { return NN; }); break;
+	case OP_7XNN: lockstep_alu<false>(ls, inst, [&](simd_t x, simd_t y, simd_t& f) { return simd_add(x, NN); }); break;
+	case OP_8XY0: lockstep_alu<false>(ls, inst, [&](simd_t x, simd_t y, simd_t& f) { return y; }); break;
+
+	case OP_8XY1: lockstep_alu<Q::logic_resets_vf>(ls, inst, [&](simd_t x, simd_t y, simd_t& f) { f = vf_reset; return simd_or(x, y); }); break;
+	case OP_8XY2: lockstep_alu<Q::logic_resets_vf>(ls, inst, [&](simd_t x, simd_t y, simd_t& f) { f = vf_reset; return simd_and(x, y); }); break;
+	case OP_8XY3: lockstep_alu<Q::logic_resets_vf>(ls, inst, [&](simd_t x, simd_t y, simd_t& f) { f = vf_reset; return simd_xor(x, y); }); break;
+
+	// No carry out of x + y exactly when the wrapped sum is still >= x
+	case OP_8XY4: lockstep_alu<true>(ls, inst, [&](simd_t x, simd_t y, simd_t& f) { const simd_t sum = simd_add(x, y); f = simd_andnot(simd_ge(sum, x), one); return sum; }); break;
+	case OP_8XY5: lockstep_alu<true>(ls, inst, [&](simd_t x, simd_t y, simd_t& f) { f = simd_and(simd_ge(x, y), one); return simd_sub(x, y); }); break;
+	case OP_8XY7: lockstep_alu<true>(ls, inst, [&](simd_t x, simd_t y, simd_t& f) { f = simd_and(simd_ge(y, x), one); return simd_sub(y, x); }); break;
+
+	case OP_8XY6:
+		lockstep_alu<true>(ls, inst, [&](simd_t x, simd_t y, simd_t& f) { const simd_t v = Q::shift_uses_vy ? y : x; f = simd_and(v, one); return simd_shr1(v); });
+		break;
+
+	case OP_8XYE:
+		lockstep_alu<true>(ls, inst, [&](simd_t x, simd_t y, simd_t& f) { const simd_t v = Q::shift_uses_vy ? y : x; f = simd_shr7(v); return simd_add(v, v); });
+		break;
+
+	case OP_3XNN: lockstep_condition(ls, inst, [&](simd_t x, simd_t y) { return simd_eq(x, NN); }); break;
+	case OP_4XNN: lockstep_condition(ls, inst, [&](simd_t x, simd_t y) { return simd_andnot(simd_eq(x, NN), simd_splat(0xFF)); }); break;
+	case OP_5XY0: lockstep_condition(ls, inst, [&](simd_t x, simd_t y) { return simd_eq(x, y); }); break;
+	case OP_9XY0: lockstep_condition(ls, inst, [&](simd_t x, simd_t y) { return simd_andnot(simd_eq(x, y), simd_splat(0xFF)); }); break;
+
+	case OP_1NNN:
+		break;
+
+	// I is 16 bits a lane, plain loops the compiler vectorises do
+	case OP_ANNN:
+		for (uint32_t lane = 0; lane < LOCKSTEP_LANES; lane++)
+		{
+			ls.I[lane] = ls.group[lane] ? inst.NNN : ls.I[lane];
+		}
+		break;
+
+	case OP_FX1E:
+		for (uint32_t lane = 0; lane < LOCKSTEP_LANES; lane++)
+		{
+			ls.I[lane] += ls.group[lane] & ls.V[inst.X][lane];
+		}
+		break;
+
+	// The timers and keypad stay in the lanes' machines, these gather and scatter them lane by lane
+	case OP_FX07:
+		for (lane_mask_t lanes = group; lanes; lanes &= lanes - 1)
+		{
+			const uint32_t lane = std::countr_zero(lanes);
+			ls.V[inst.X][lane] = ls.lanes[lane]->delay_timer;
+		}
+		break;
+
+	case OP_FX15:
+		for (lane_mask_t lanes = group; lanes; lanes &= lanes - 1)
+		{
+			const uint32_t lane = std::countr_zero(lanes);
+			ls.lanes[lane]->delay_timer = ls.V[inst.X][lane];
+		}
+		break;
+
+	case OP_FX18:
+		for (lane_mask_t lanes = group; lanes; lanes &= lanes - 1)
+		{
+			const uint32_t lane = std::countr_zero(lanes);
+			ls.lanes[lane]->sound_timer = ls.V[inst.X][lane];
+		}
+		break;
+
+	case OP_EX9E:
+	case OP_EXA1:
+		for (lane_mask_t lanes = group; lanes; lanes &= lanes - 1)
+		{
+			const uint32_t lane = std::countr_zero(lanes);
+			const bool held = (ls.lanes[lane]->keypad >> (ls.V[inst.X][lane] & 0xF)) & 1;
+			ls.skip[lane] = held == (kind == OP_EX9E) ? 2 : 0;
+		}
+		break;
+
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+// Bit N of the index to 0xFF in byte N, to spread a lane mask over lockstep_t::group
+const std::array<uint64_t, 256> LANE_BYTES = []()
+{
+	std::array<uint64_t, 256> bytes{};
+	for (uint32_t bits = 0; bits < 256; bits++)
+	{
+		for (uint32_t bit = 0; bit < 8; bit++)
+		{
+			bytes[bits] |= (uint64_t)(((bits >> bit) & 1) * 0xFF) << (bit * 8);
+		}
+	}
+	return bytes;
+}();
+
+// The group's opcode on one lane, on its own chip8_t. Apart from FX55/FX65 no handler touches
+// any V but V0, VX, VY and VF, so only those go across and back
+void run_lockstep_lane(lockstep_t& ls, const config_t& config, const decoded_t& decoded, const uint8_t kind, const uint32_t lane)
+{
+	const instruction_t& inst = decoded.inst;
+	const bool all = kind == OP_FX55 || kind == OP_FX65;
+
+	chip8_t& chip8 = *ls.lanes[lane];
+	chip8.regs.I = ls.I[lane];
+	chip8.PC = (ls.PC[lane] & 0xFFF) + 2;
+	if (all)
+	{
+		for (uint32_t reg = 0; reg < 16; reg++)
+		{
+			chip8.regs.V[reg] = ls.V[reg][lane];
+		}
+	}
+	else
+	{
+		chip8.regs.V[0] = ls.V[0][lane];
+		chip8.regs.V[inst.X] = ls.V[inst.X][lane];
+		chip8.regs.V[inst.Y] = ls.V[inst.Y][lane];
+		chip8.regs.V[0xF] = ls.V[0xF][lane];
+	}
+
+	if (kind == OP_FX33 || kind == OP_FX55)
+	{
+		const uint32_t bytes = kind == OP_FX33 ? 3 : inst.X + 1;
+		for (uint32_t i = 0; i < bytes; i++)
+		{
+			ls.written[(chip8.regs.I + i) & 0xFFF] = true;
+		}
+	}
+
+	decoded.handler(chip8, config, inst);
+
+	ls.I[lane] = chip8.regs.I;
+	ls.PC[lane] = (uint16_t)chip8.PC;
+	if (all)
+	{
+		for (uint32_t reg = 0; reg < 16; reg++)
+		{
+			ls.V[reg][lane] = chip8.regs.V[reg];
+		}
+	}
+	else
+	{
+		ls.V[0][lane] = chip8.regs.V[0];
+		ls.V[inst.X][lane] = chip8.regs.V[inst.X];
+		ls.V[inst.Y][lane] = chip8.regs.V[inst.Y];
+		ls.V[0xF][lane] = chip8.regs.V[0xF];
+	}
+}
+
+inline uint16_t lane_opcode(const lockstep_t& ls, const uint32_t lane, const uint16_t PC)
+{
+	const std::array<uint8_t, 4096>& ram = ls.lanes[lane]->ram;
+	return (ram[PC & 0xFFF] << 8) | ram[(PC + 1) & 0xFFF];
+}
+
+// One opcode on every live lane, a group at a time: the first lane left picks the PC and opcode, and
+// every lane left with the same ones joins its group. Returns the lanes that halted
+template <typename Q>
+lane_mask_t step_lockstep(lockstep_t& ls, const config_t& config, const decode_table_t& table)
+{
+	lane_mask_t halted = 0;
+	lane_mask_t remaining = ls.live & ~ls.idle;
+
+	while (remaining)
+	{
+		const uint32_t leader = std::countr_zero(remaining);
+		const uint16_t PC = ls.PC[leader];
+		const uint16_t opcode = lane_opcode(ls, leader, PC);
+
+		// Same PC but other code only happens where lanes stored different things
+		lane_mask_t group = lanes_equal(ls.PC.data(), PC) & remaining;
+		if (ls.written[PC & 0xFFF] || ls.written[(PC + 1) & 0xFFF])
+		{
+			for (lane_mask_t lanes = group; lanes; lanes &= lanes - 1)
+			{
+				const uint32_t lane = std::countr_zero(lanes);
+				if (lane_opcode(ls, lane, PC) != opcode)
+					group &= ~(1u << lane);
+			}
+		}
+		remaining &= ~group;
+		ls.groups++;
+
+		const decoded_t& decoded = table[opcode];
+		const uint8_t kind = opcode_kind(decoded.inst);
+
+		for (uint32_t byte = 0; byte < LOCKSTEP_LANES / 8; byte++)
+		{
+			const uint64_t bytes = LANE_BYTES[(group >> (byte * 8)) & 0xFF];
+			memcpy(&ls.group[byte * 8], &bytes, 8);
+		}
+
+		if (run_lockstep_vector<Q>(ls, decoded.inst, kind, group))
+		{
+			// Branch free so it vectorises as well
+			const bool skip = kind == OP_3XNN || kind == OP_4XNN || kind == OP_5XY0 || kind == OP_9XY0 || kind == OP_EX9E || kind == OP_EXA1;
+			const uint16_t next = kind == OP_1NNN ? decoded.inst.NNN : (PC & 0xFFF) + 2;
+			for (uint32_t lane = 0; lane < LOCKSTEP_LANES; lane++)
+			{
+				const uint16_t to = next + (ls.skip[lane] & -(int)skip);
+				ls.PC[lane] = ls.group[lane] ? to : ls.PC[lane];
+			}
+
+			ls.vector_opcodes += std::popcount(group);
+			if (kind == OP_1NNN && decoded.inst.NNN == PC)
+				halted |= group;
+			continue;
+		}
+
+		for (lane_mask_t lanes = group; lanes; lanes &= lanes - 1)
+		{
+			const uint32_t lane = std::countr_zero(lanes);
+			run_lockstep_lane(ls, config, decoded, kind, lane);
+
+			if (ls.PC[lane] == PC || ls.lanes[lane]->status == QUIT)
+				halted |= 1u << lane;
+		}
+
+		ls.scalar_opcodes += std::popcount(group);
+	}
+
+	return halted;
+}
+
+// The frame start of run_headless on every live lane: a lane in an idle loop jumps over the whole
+// iterations that fit in budget opcodes, then sits out that many steps
+void skip_idle_lanes(lockstep_t& ls, const uint32_t budget)
+{
+	for (lane_mask_t lanes = ls.live; lanes; lanes &= lanes - 1)
+	{
+		const uint32_t lane = std::countr_zero(lanes);
+		chip8_t& chip8 = *ls.lanes[lane];
+		chip8.PC = ls.PC[lane];
+		for (uint32_t reg = 0; reg < 16; reg++)
+		{
+			chip8.regs.V[reg] = ls.V[reg][lane];
+		}
+
+		const uint32_t skipped = idle_loop_skip(chip8, budget, false);
+		if (skipped == 0)
+			continue;
+
+		for (uint32_t reg = 0; reg < 16; reg++)
+		{
+			ls.V[reg][lane] = chip8.regs.V[reg];
+		}
+		ls.results[lane].idle_cycles += skipped;
+		ls.idle |= 1u << lane;
+		ls.wake[lane] = skipped;
+	}
+}
+
+// run_headless for every lane at once: each runs until config.max_cycles or a halt, and its result
+// goes in ls.results. Once the lanes have split up into groups smaller than LOCKSTEP_MIN_GROUP on
+// average over a frame, the ones left finish that way one by one, from the frame boundary so their
+// timers stay in step
+template <typename Q>
+void run_lockstep(lockstep_t& ls, const config_t& config)
+{
+	const decode_table_t& table = quirk_decode_table<Q>();
+	const auto start = std::chrono::steady_clock::now();
+
+	uint64_t cycles = 0;
+	uint64_t frames = 0;
+	uint32_t frame_cycles = 0;
+	uint64_t frame_groups = 0;
+	uint64_t frame_opcodes = 0;
+	while (cycles < config.max_cycles && ls.live)
+	{
+		if (frame_cycles == 0 && config.idle_skip)
+			skip_idle_lanes(ls, (uint32_t)std::min<uint64_t>(config.cycles_per_frame, config.max_cycles - cycles));
+
+		const lane_mask_t stepping = ls.live;
+		lane_mask_t halted = 0;
+		uint32_t ran = 1;
+		if (ls.live & ~ls.idle)
+			halted = step_lockstep<Q>(ls, config, table);
+		else
+		{
+			// Every lane is idle: on to the first one back
+			ran = config.cycles_per_frame;
+			for (lane_mask_t lanes = ls.idle; lanes; lanes &= lanes - 1)
+			{
+				ran = std::min(ran, ls.wake[std::countr_zero(lanes)] - frame_cycles);
+			}
+		}
+		cycles += ran;
+		frame_cycles += ran;
+
+		for (lane_mask_t lanes = ls.idle; lanes; lanes &= lanes - 1)
+		{
+			const uint32_t lane = std::countr_zero(lanes);
+			if (ls.wake[lane] <= frame_cycles)
+				ls.idle &= ~(1u << lane);
+		}
+
+		for (lane_mask_t lanes = halted; lanes; lanes &= lanes - 1)
+		{
+			const uint32_t lane = std::countr_zero(lanes);
+			ls.results[lane].cycles = cycles;
+			ls.results[lane].frames = frames;
+			ls.results[lane].halt = ls.lanes[lane]->status == QUIT ? HALT_QUIT : HALT_STUCK;
+		}
+		ls.live &= ~halted;
+
+		if (frame_cycles < config.cycles_per_frame)
+			continue;
+
+		frame_cycles = 0;
+		frames++;
+		for (lane_mask_t lanes = stepping; lanes; lanes &= lanes - 1)
+		{
+			update_timers(*ls.lanes[std::countr_zero(lanes)]);
+		}
+
+		for (lane_mask_t lanes = halted; lanes; lanes &= lanes - 1)
+		{
+			ls.results[std::countr_zero(lanes)].frames = frames;
+		}
+
+		const uint64_t opcodes = ls.vector_opcodes + ls.scalar_opcodes;
+		if (opcodes - frame_opcodes < LOCKSTEP_MIN_GROUP * (ls.groups - frame_groups))
+			break;
+
+		frame_groups = ls.groups;
+		frame_opcodes = opcodes;
+	}
+
+	for (lane_mask_t lanes = ls.live; lanes; lanes &= lanes - 1)
+	{
+		ls.results[std::countr_zero(lanes)].frames = frames;
+	}
+
+	store_lockstep(ls);
+
+	for (uint32_t lane = 0; lane < ls.count; lane++)
+	{
+		headless_result_t& result = ls.results[lane];
+		if (!((ls.live >> lane) & 1))
+			continue;
+
+		result.cycles = cycles;
+		if (cycles == config.max_cycles)
+			continue;
+
+		config_t rest = config;
+		rest.max_cycles -= cycles;
+		const headless_result_t scalar = run_headless(*ls.lanes[lane], rest);
+		result.cycles += scalar.cycles;
+		result.idle_cycles += scalar.idle_cycles;
+		result.frames += scalar.frames;
+		result.halt = scalar.halt;
+		ls.scalar_opcodes += scalar.cycles;
+	}
+
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	for (uint32_t lane = 0; lane < ls.count; lane++)
+	{
+		ls.results[lane].seconds = seconds;
+	}
+}
+
+// For a --quirks profile
+void run_lockstep(lockstep_t& ls, const config_t& config)
+{
+	with_quirks(config.quirks, [&]<typename Q>() { run_lockstep<Q>(ls, config); });
+}
\ No newline at end of file
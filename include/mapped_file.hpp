@@ -0,0 +1,114 @@
+#pragma once
+
+// Read-only mapping of a whole file: mmap on POSIX, a file mapping on Windows.
+// ROMs and the ROM library cache are read through this, so loading them is page faults rather than
+// stdio copies. An empty file maps to no data and still succeeds
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+struct mapped_file_t
+{
+	const uint8_t* data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+
+
+bool map_file(const char* path, mapped_file_t& file)
+{
+	file.data = nullptr;
+	file.size = 0;
+
+#ifdef _WIN32
+	file.mapping = nullptr;
+	file.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file.file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file.file, &size))
+	{
+		CloseHandle(file.file);
+		return false;
+	}
+	file.size = (size_t)size.QuadPart;
+
+	if (file.size > 0)
+	{
+		file.mapping = CreateFileMappingA(file.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		file.data = file.mapping ? (const uint8_t*)MapViewOfFile(file.mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (file.data == nullptr)
+		{
+			if (file.mapping)
+				CloseHandle(file.mapping);
+			CloseHandle(file.file);
+			return false;
+		}
+	}
+#else
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+	{
+		close(fd);
+		return false;
+	}
+	file.size = (size_t)info.st_size;
+
+	if (file.size > 0)
+	{
+		void* data = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			close(fd);
+			return false;
+		}
+		file.data = (const uint8_t*)data;
+	}
+
+	// The mapping keeps the file alive on its own
+	close(fd);
+#endif
+
+	return true;
+}
+
+void unmap_file(mapped_file_t& file)
+{
+#ifdef _WIN32
+	if (file.data)
+		UnmapViewOfFile(file.data);
+	if (file.mapping)
+		CloseHandle(file.mapping);
+	CloseHandle(file.file);
+#else
+	if (file.data)
+		munmap((void*)file.data, file.size);
+#endif
+
+	file.data = nullptr;
+	file.size = 0;
+}
\ No newline at end of file
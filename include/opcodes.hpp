@@ -0,0 +1,734 @@
+#pragma once
+
+// Opcode handlers shared by every interpreter in CHIP8.hpp:
+// the switch interpreter (run_single_opcode), the decode table (run_single_opcode_table) and the block cache.
+// Each handler gets the already decoded instruction, PC already points at the next opcode.
+// Handlers for behaviours that differ between CHIP-8 implementations are templated on a quirk profile (quirks.hpp)
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <memory>
+
+#include "structs.hpp"
+#include "quirks.hpp"
+
+
+typedef void (*opcode_handler_t)(chip8_t& chip8, const config_t& config, const instruction_t& inst);
+
+
+// Unknown/unimplemented opcodes do nothing
+inline void op_unknown(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+}
+
+// 00E0: Clear Screen (the selected planes)
+inline void op_00E0(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+	{
+		if ((chip8.planes >> plane) & 1)
+			memset(display_row(chip8, plane, 0), 0, DISPLAY_HEIGHT * DISPLAY_WORDS * sizeof(uint64_t));
+	}
+
+	mark_all_dirty(chip8);
+}
+
+// 00EE: Return from call. With nothing to return to it stays on the opcode, which headless reports as stuck
+inline void op_00EE(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	if (chip8.stack_ptr == 0)
+	{
+		chip8.PC -= 2;
+		return;
+	}
+
+	chip8.PC = chip8.stack[--chip8.stack_ptr];
+}
+
+// Planes that draws, clears and scroll act on: only XO-CHIP can select any but the first
+template <typename Q>
+inline uint8_t selected_planes(const chip8_t& chip8)
+{
+	return Q::bitplanes ? chip8.planes : 1;
+}
+
+// Move every row of the selected planes down (rows > 0) or up by whole rows, clearing the ones uncovered.
+// Rows are contiguous, so it is one memmove per plane
+template <typename Q, typename G>
+inline void scroll_rows(chip8_t& chip8, const int32_t rows)
+{
+	const uint32_t count = std::min<uint32_t>(std::abs(rows), G::height);
+	const size_t row_bytes = DISPLAY_WORDS * sizeof(uint64_t);
+
+	for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+	{
+		if (!((selected_planes<Q>(chip8) >> plane) & 1))
+			continue;
+
+		if (rows > 0)
+		{
+			memmove(display_row(chip8, plane, count), display_row(chip8, plane, 0), (G::height - count) * row_bytes);
+			memset(display_row(chip8, plane, 0), 0, count * row_bytes);
+		}
+		else
+		{
+			memmove(display_row(chip8, plane, 0), display_row(chip8, plane, count), (G::height - count) * row_bytes);
+			memset(display_row(chip8, plane, G::height - count), 0, count * row_bytes);
+		}
+	}
+
+	mark_all_dirty(chip8);
+}
+
+// Move every row of the selected planes 4 pixels right or left, carrying bits across the row's words
+template <typename Q, typename G, bool right>
+inline void scroll_columns(chip8_t& chip8)
+{
+	for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+	{
+		if (!((selected_planes<Q>(chip8) >> plane) & 1))
+			continue;
+
+		for (uint32_t Y = 0; Y < G::height; Y++)
+		{
+			uint64_t* row = display_row(chip8, plane, Y);
+
+			if constexpr (right)
+			{
+				for (uint32_t word = G::words - 1; word > 0; word--)
+				{
+					row[word] = (row[word] >> 4) | (row[word - 1] << 60);
+				}
+				row[0] >>= 4;
+			}
+			else
+			{
+				for (uint32_t word = 0; word + 1 < G::words; word++)
+				{
+					row[word] = (row[word] << 4) | (row[word + 1] >> 60);
+				}
+				row[G::words - 1] <<= 4;
+			}
+		}
+	}
+
+	mark_all_dirty(chip8);
+}
+
+// 00CN: Scroll down N rows (SUPER-CHIP). Lores scrolls by lores rows
+template <typename Q>
+inline void op_00CN(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	if (chip8.hires)
+		scroll_rows<Q, hires_t>(chip8, inst.N);
+	else
+		scroll_rows<Q, lores_t>(chip8, inst.N);
+}
+
+// 00DN: Scroll up N rows (XO-CHIP)
+template <typename Q>
+inline void op_00DN(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	if (chip8.hires)
+		scroll_rows<Q, hires_t>(chip8, -(int32_t)inst.N);
+	else
+		scroll_rows<Q, lores_t>(chip8, -(int32_t)inst.N);
+}
+
+// 00FB: Scroll right 4 pixels (SUPER-CHIP)
+template <typename Q>
+inline void op_00FB(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	if (chip8.hires)
+		scroll_columns<Q, hires_t, true>(chip8);
+	else
+		scroll_columns<Q, lores_t, true>(chip8);
+}
+
+// 00FC: Scroll left 4 pixels (SUPER-CHIP)
+template <typename Q>
+inline void op_00FC(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	if (chip8.hires)
+		scroll_columns<Q, hires_t, false>(chip8);
+	else
+		scroll_columns<Q, lores_t, false>(chip8);
+}
+
+// 00FE/00FF: Switch to lores/hires (SUPER-CHIP). Both clear every plane, which keeps the part of the
+// display lores doesn't use clear
+inline void set_display_mode(chip8_t& chip8, const bool hires)
+{
+	chip8.hires = hires;
+	chip8.display.fill(0);
+	mark_all_dirty(chip8);
+}
+
+inline void op_00FE(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	set_display_mode(chip8, false);
+}
+
+inline void op_00FF(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	set_display_mode(chip8, true);
+}
+
+// 1NNN: Jump to address
+inline void op_1NNN(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.PC = inst.NNN;
+}
+
+// 2NNN: Calls to Address (Pushes return to stack
+inline void op_2NNN(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	// A 13th nested call stays on the opcode, as 00EE does with an empty stack
+	if (chip8.stack_ptr >= chip8.stack.size())
+	{
+		chip8.PC -= 2;
+		return;
+	}
+
+	chip8.stack[chip8.stack_ptr++] = chip8.PC;
+	chip8.PC = inst.NNN;
+}
+
+// 3XNN: if Vx == NN
+inline void op_3XNN(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	if (chip8.regs.V[inst.X] == inst.NN)
+		chip8.PC += 2;
+}
+
+// 4XNN: if Vx != NN
+inline void op_4XNN(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	if (chip8.regs.V[inst.X] != inst.NN)
+		chip8.PC += 2;
+}
+
+// 5XY0: if Vx == Vy
+inline void op_5XY0(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	if (chip8.regs.V[inst.X] == chip8.regs.V[inst.Y])
+		chip8.PC += 2;
+}
+
+// 6XNN: Vx = NN
+inline void op_6XNN(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.regs.V[inst.X] = inst.NN;
+}
+
+// 7XNN: Vx += NN
+inline void op_7XNN(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.regs.V[inst.X] += inst.NN;
+}
+
+// 8XY0: Vx = Vy
+inline void op_8XY0(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.regs.V[inst.X] = chip8.regs.V[inst.Y];
+}
+
+// 8XY1: Vx |= Vy
+template <typename Q>
+inline void op_8XY1(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.regs.V[inst.X] |= chip8.regs.V[inst.Y];
+
+	if constexpr (Q::logic_resets_vf)
+		chip8.regs.V[0xF] = 0;
+}
+
+// 8XY2: Vx &= Vy
+template <typename Q>
+inline void op_8XY2(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.regs.V[inst.X] &= chip8.regs.V[inst.Y];
+
+	if constexpr (Q::logic_resets_vf)
+		chip8.regs.V[0xF] = 0;
+}
+
+// 8XY3: Vx ^= Vy
+template <typename Q>
+inline void op_8XY3(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.regs.V[inst.X] ^= chip8.regs.V[inst.Y];
+
+	if constexpr (Q::logic_resets_vf)
+		chip8.regs.V[0xF] = 0;
+}
+
+// 8XY4: Vx += Vy. The flags below are all written after the result, so with X = F the flag wins
+inline void op_8XY4(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	const bool carry = ((uint16_t)(chip8.regs.V[inst.X] + chip8.regs.V[inst.Y]) > 255);
+
+	chip8.regs.V[inst.X] += chip8.regs.V[inst.Y];
+	chip8.regs.V[0xF] = carry;
+}
+
+// 8XY5: Vx -= Vy, VF = 1 when there was no borrow
+inline void op_8XY5(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	const bool carry = chip8.regs.V[inst.X] >= chip8.regs.V[inst.Y];
+
+	chip8.regs.V[inst.X] -= chip8.regs.V[inst.Y];
+	chip8.regs.V[0xF] = carry;
+}
+
+// 8XY6: Vx = Vy >> 1 (VIP) or Vx >>= 1, VF = the bit shifted out
+template <typename Q>
+inline void op_8XY6(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	const uint8_t value = Q::shift_uses_vy ? chip8.regs.V[inst.Y] : chip8.regs.V[inst.X];
+
+	chip8.regs.V[inst.X] = value >> 1;
+	chip8.regs.V[0xF] = value & 1;
+}
+
+// 8XY7: Vx = Vy - Vx, VF = 1 when there was no borrow
+inline void op_8XY7(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	const bool carry = chip8.regs.V[inst.Y] >= chip8.regs.V[inst.X];
+
+	chip8.regs.V[inst.X] = chip8.regs.V[inst.Y] - chip8.regs.V[inst.X];
+	chip8.regs.V[0xF] = carry;
+}
+
+// 8XYE: Vx = Vy << 1 (VIP) or Vx <<= 1, VF = the bit shifted out
+template <typename Q>
+inline void op_8XYE(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	const uint8_t value = Q::shift_uses_vy ? chip8.regs.V[inst.Y] : chip8.regs.V[inst.X];
+
+	chip8.regs.V[inst.X] = value << 1;
+	chip8.regs.V[0xF] = value >> 7;
+}
+
+// 9XY0: if Vx != Vy
+inline void op_9XY0(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	if (chip8.regs.V[inst.X] != chip8.regs.V[inst.Y])
+		chip8.PC += 2;
+}
+
+// ANNN: I = NNN
+inline void op_ANNN(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.regs.I = inst.NNN;
+}
+
+// BNNN: PC = V0 + NNN (VIP), or BXNN: PC = VX + XNN (CHIP-48/SUPER-CHIP)
+template <typename Q>
+inline void op_BNNN(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.PC = (Q::jump_uses_vx ? chip8.regs.V[inst.X] : chip8.regs.V[0]) + inst.NNN;
+}
+
+// xorshift32 on the chip8's own state: no shared global like rand(), so VMs on different
+// threads don't interfere and a seed fully determines the results
+inline uint8_t next_random(chip8_t& chip8)
+{
+	uint32_t x = chip8.rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	chip8.rng = x;
+
+	return x >> 24;
+}
+
+// CXNN: Sets register VX = random byte & NN (bitwise AND)
+inline void op_CXNN(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.regs.V[inst.X] = next_random(chip8) & inst.NN;
+}
+
+// XOR one sprite row (BITS wide, MSB first) into a display row at pixel X, returning the pixels it turned off.
+// Pixels past the right edge spill into the next word, and past the last word are clipped or wrap to the first
+template <typename Q, typename G, uint32_t BITS>
+inline uint64_t draw_sprite_row(uint64_t* row, const uint32_t sprite, const uint32_t X)
+{
+	const uint64_t aligned = (uint64_t)sprite << (64 - BITS);
+	const uint32_t word = X / 64;
+	const uint32_t shift = X % 64;
+
+	uint64_t collision = row[word] & (aligned >> shift);
+	row[word] ^= aligned >> shift;
+
+	if (shift != 0)
+	{
+		const uint64_t spill = aligned << (64 - shift);
+
+		if (word + 1 < G::words)
+		{
+			collision |= row[word + 1] & spill;
+			row[word + 1] ^= spill;
+		}
+		else if constexpr (Q::sprites_wrap)
+		{
+			collision |= row[0] & spill;
+			row[0] ^= spill;
+		}
+	}
+
+	return collision;
+}
+
+// Draw a BITS wide sprite of height rows in mode G
+template <typename Q, typename G, uint32_t BITS>
+inline void draw_sprite(chip8_t& chip8, const instruction_t& inst, const uint32_t height)
+{
+	// Wrap the starting position around the screen
+	const uint32_t X_coord = chip8.regs.V[inst.X] % G::width;
+	const uint32_t Y_coord = chip8.regs.V[inst.Y] % G::height;
+
+	// Rows past the bottom come back at the top, or are clipped
+	const uint32_t rows = Q::sprites_wrap ? height : std::min<uint32_t>(height, G::height - Y_coord);
+
+	uint64_t collision = 0;
+
+	// Each selected plane takes the next sprite's worth of bytes from I on
+	uint16_t addr = chip8.regs.I;
+	for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+	{
+		if (!((selected_planes<Q>(chip8) >> plane) & 1))
+			continue;
+
+		for (uint32_t i = 0; i < rows; i++)
+		{
+			const uint32_t sprite = BITS == 16
+				? (chip8.ram[(addr + i * 2) & 0xFFF] << 8) | chip8.ram[(addr + i * 2 + 1) & 0xFFF]
+				: chip8.ram[(addr + i) & 0xFFF];
+			const uint32_t Y = Q::sprites_wrap ? (Y_coord + i) % G::height : Y_coord + i;
+
+			collision |= draw_sprite_row<Q, G, BITS>(display_row(chip8, plane, Y), sprite, X_coord);
+		}
+
+		addr += height * BITS / 8;
+	}
+
+	chip8.regs.V[0xF] = collision != 0;	// Any pixel turned off
+
+	if (rows > 0)
+	{
+		const bool wraps_x = Q::sprites_wrap && X_coord + BITS > G::width;
+		const bool wraps_y = Q::sprites_wrap && Y_coord + rows > G::height;
+		mark_dirty(chip8, wraps_x ? 0 : X_coord, wraps_y ? 0 : Y_coord,
+			wraps_x ? G::width - 1 : std::min<uint32_t>(X_coord + BITS - 1, G::width - 1),
+			wraps_y ? G::height - 1 : Y_coord + rows - 1);
+	}
+}
+
+/* DXYN:
+  *  It will draw an N pixels tall sprite from the memory location that the I index register is holding to the screen,
+  *  at the horizontal X coordinate in VX and the Y coordinate in VY.
+  *  All the pixels that are "on" in the sprite will flip the pixels on the screen that it is drawn to (from left to right, from most to least significant bit).
+  *  If any pixels on the screen were turned "off" by this, the VF flag register is set to 1. Otherwise, it's set to 0.
+  *  DXY0 is a 16x16 sprite of two bytes per row where there is a hires mode.
+  *  The mode's geometry and the sprite width are template arguments of draw_sprite, so they are picked once per sprite
+*/
+template <typename Q>
+inline void op_DXYN(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	if constexpr (Q::hires)
+	{
+		if (chip8.hires)
+		{
+			if (inst.N == 0)
+				draw_sprite<Q, hires_t, 16>(chip8, inst, 16);
+			else
+				draw_sprite<Q, hires_t, 8>(chip8, inst, inst.N);
+			return;
+		}
+
+		if (inst.N == 0)
+		{
+			draw_sprite<Q, lores_t, 16>(chip8, inst, 16);
+			return;
+		}
+	}
+
+	draw_sprite<Q, lores_t, 8>(chip8, inst, inst.N);
+}
+
+// EX9E: Skip next instruction if key in VX is pressed
+inline void op_EX9E(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	if ((chip8.keypad >> (chip8.regs.V[inst.X] & 0xF)) & 1)
+		chip8.PC += 2;
+}
+
+// EXA1: Skip next instruction if key in VX is NOT pressed
+inline void op_EXA1(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	if (!((chip8.keypad >> (chip8.regs.V[inst.X] & 0xF)) & 1))
+		chip8.PC += 2;
+}
+
+// FX07: Vx = delay timer
+inline void op_FX07(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.regs.V[inst.X] = chip8.delay_timer;
+}
+
+// FX0A: VX = get_key(); Await until a keypress, and store in VX
+inline void op_FX0A(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	if (chip8.keypad)
+	{
+		chip8.regs.V[inst.X] = std::countr_zero(chip8.keypad); // Lowest key held
+		return;
+	}
+
+	// if no keypad has been pressed: Key getting the current opcode and running this instruction
+	chip8.PC -= 2;
+}
+
+// FX15: delay timer = Vx
+inline void op_FX15(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.delay_timer = chip8.regs.V[inst.X];
+}
+
+// FX18: sound timer = Vx
+inline void op_FX18(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.sound_timer = chip8.regs.V[inst.X];
+}
+
+// FX1E: I += VX; Add Vx to register I. For non-Amiga CHIP8, does not affect VF
+inline void op_FX1E(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.regs.I += chip8.regs.V[inst.X];
+}
+
+// FX29: I = address of the font sprite for the hex digit in VX (fonts are loaded at 0x000, 5 bytes each)
+inline void op_FX29(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.regs.I = (chip8.regs.V[inst.X] & 0xF) * 5;
+}
+
+// FX33: Store the BCD of VX at I, I+1, I+2 (hundreds, tens, ones)
+inline void op_FX33(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	const uint8_t value = chip8.regs.V[inst.X];
+
+	chip8.ram[(chip8.regs.I + 0) & 0xFFF] = value / 100;
+	chip8.ram[(chip8.regs.I + 1) & 0xFFF] = (value / 10) % 10;
+	chip8.ram[(chip8.regs.I + 2) & 0xFFF] = value % 10;
+}
+
+// How far FX55/FX65 leave I moved
+template <typename Q>
+inline void advance_I(chip8_t& chip8, const instruction_t& inst)
+{
+	if constexpr (Q::memory == MEMORY_I_PLUS_X_PLUS_1)
+		chip8.regs.I += inst.X + 1;
+	else if constexpr (Q::memory == MEMORY_I_PLUS_X)
+		chip8.regs.I += inst.X;
+}
+
+// FX55: Store V0 to VX in memory starting at I
+template <typename Q>
+inline void op_FX55(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	for (uint8_t i = 0; i <= inst.X; i++)
+	{
+		chip8.ram[(chip8.regs.I + i) & 0xFFF] = chip8.regs.V[i];
+	}
+
+	advance_I<Q>(chip8, inst);
+}
+
+// FX65: Load V0 to VX from memory starting at I
+template <typename Q>
+inline void op_FX65(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	for (uint8_t i = 0; i <= inst.X; i++)
+	{
+		chip8.regs.V[i] = chip8.ram[(chip8.regs.I + i) & 0xFFF];
+	}
+
+	advance_I<Q>(chip8, inst);
+}
+
+// FN01: Select the planes DXYN, 00E0 and scrolling act on, N is a bit mask (XO-CHIP)
+inline void op_FN01(chip8_t& chip8, const config_t& config, const instruction_t& inst)
+{
+	chip8.planes = inst.X & ((1 << DISPLAY_PLANES) - 1);
+}
+
+
+// Decode table: every 16-bit opcode is decoded once up front into its handler and fields,
+// so a step is one fetch, one table load and one indirect call
+struct decoded_t
+{
+	opcode_handler_t handler;
+	instruction_t inst;
+};
+
+typedef std::array<decoded_t, 0x10000> decode_table_t;
+
+constexpr instruction_t decode_instruction(const uint16_t opcode)
+{
+	instruction_t inst;
+	inst.opcode = opcode;
+	inst.NNN = opcode & 0xFFF;
+	inst.NN  = opcode & 0xFF;
+	inst.N   = opcode & 0xF;
+	inst.X   = (opcode >> 8) & 0xF;
+	inst.Y   = (opcode >> 4) & 0xF;
+	return inst;
+}
+
+// Every opcode the interpreters know, for the decoder, the profiler and the tools
+enum
+{
+	OP_UNKNOWN,
+	OP_00E0, OP_00EE, OP_00CN, OP_00DN, OP_00FB, OP_00FC,
+	OP_00FE, OP_00FF, OP_1NNN, OP_2NNN, OP_3XNN, OP_4XNN,
+	OP_5XY0, OP_6XNN, OP_7XNN, OP_8XY0, OP_8XY1, OP_8XY2,
+	OP_8XY3, OP_8XY4, OP_8XY5, OP_8XY6, OP_8XY7, OP_8XYE,
+	OP_9XY0, OP_ANNN, OP_BNNN, OP_CXNN, OP_DXYN, OP_EX9E,
+	OP_EXA1, OP_FX07, OP_FX0A, OP_FX15, OP_FX18, OP_FX1E,
+	OP_FX29, OP_FX33, OP_FX55, OP_FX65, OP_FN01,
+	OP_KIND_COUNT
+};
+
+const char* const OPCODE_NAMES[OP_KIND_COUNT] =
+{
+	"unknown",
+	"00E0", "00EE", "00CN", "00DN", "00FB", "00FC", "00FE", "00FF", "1NNN",
+	"2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN", "8XY0", "8XY1", "8XY2",
+	"8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE", "9XY0", "ANNN", "BNNN",
+	"CXNN", "DXYN", "EX9E", "EXA1", "FX07", "FX0A", "FX15", "FX18", "FX1E",
+	"FX29", "FX33", "FX55", "FX65", "FN01",
+};
+
+// Same grouping as the switch in run_single_opcode
+uint8_t opcode_kind(const instruction_t& inst)
+{
+	switch ((inst.opcode >> 12) & 0xF)
+	{
+	case 0x0:
+		if (inst.NN == 0xE0) return OP_00E0;
+		if (inst.NN == 0xEE) return OP_00EE;
+		if ((inst.NN & 0xF0) == 0xC0) return OP_00CN;
+		if ((inst.NN & 0xF0) == 0xD0) return OP_00DN;
+		if (inst.NN == 0xFB) return OP_00FB;
+		if (inst.NN == 0xFC) return OP_00FC;
+		if (inst.NN == 0xFE) return OP_00FE;
+		if (inst.NN == 0xFF) return OP_00FF;
+		return OP_UNKNOWN;
+
+	case 0x1: return OP_1NNN;
+	case 0x2: return OP_2NNN;
+	case 0x3: return OP_3XNN;
+	case 0x4: return OP_4XNN;
+	case 0x5: return OP_5XY0;
+	case 0x6: return OP_6XNN;
+	case 0x7: return OP_7XNN;
+
+	case 0x8:
+		switch (inst.N)
+		{
+		case 0x0: return OP_8XY0;
+		case 0x1: return OP_8XY1;
+		case 0x2: return OP_8XY2;
+		case 0x3: return OP_8XY3;
+		case 0x4: return OP_8XY4;
+		case 0x5: return OP_8XY5;
+		case 0x6: return OP_8XY6;
+		case 0x7: return OP_8XY7;
+		case 0xE: return OP_8XYE;
+		}
+		return OP_UNKNOWN;
+
+	case 0x9: return OP_9XY0;
+	case 0xA: return OP_ANNN;
+	case 0xB: return OP_BNNN;
+	case 0xC: return OP_CXNN;
+	case 0xD: return OP_DXYN;
+
+	case 0xE:
+		if (inst.NN == 0x9E) return OP_EX9E;
+		if (inst.NN == 0xA1) return OP_EXA1;
+		return OP_UNKNOWN;
+
+	case 0xF:
+		switch (inst.NN)
+		{
+		case 0x0A: return OP_FX0A;
+		case 0x1E: return OP_FX1E;
+		case 0x07: return OP_FX07;
+		case 0x15: return OP_FX15;
+		case 0x18: return OP_FX18;
+		case 0x29: return OP_FX29;
+		case 0x33: return OP_FX33;
+		case 0x55: return OP_FX55;
+		case 0x65: return OP_FX65;
+		case 0x01: return OP_FN01;
+		}
+		return OP_UNKNOWN;
+	}
+
+	return OP_UNKNOWN;
+}
+
+// The handler for each kind, specialised for profile Q. Kinds the profile's machine doesn't have do nothing
+template <typename Q>
+opcode_handler_t decode_handler(const instruction_t& inst)
+{
+	static const opcode_handler_t handlers[OP_KIND_COUNT] =
+	{
+		op_unknown, op_00E0, op_00EE,
+		Q::hires ? op_00CN<Q> : op_unknown,
+		Q::bitplanes ? op_00DN<Q> : op_unknown,
+		Q::hires ? op_00FB<Q> : op_unknown,
+		Q::hires ? op_00FC<Q> : op_unknown,
+		Q::hires ? op_00FE : op_unknown,
+		Q::hires ? op_00FF : op_unknown,
+		op_1NNN, op_2NNN, op_3XNN, op_4XNN, op_5XY0, op_6XNN,
+		op_7XNN, op_8XY0, op_8XY1<Q>, op_8XY2<Q>, op_8XY3<Q>, op_8XY4,
+		op_8XY5, op_8XY6<Q>, op_8XY7, op_8XYE<Q>, op_9XY0, op_ANNN,
+		op_BNNN<Q>, op_CXNN, op_DXYN<Q>, op_EX9E, op_EXA1, op_FX07,
+		op_FX0A, op_FX15, op_FX18, op_FX1E, op_FX29, op_FX33,
+		op_FX55<Q>, op_FX65<Q>,
+		Q::bitplanes ? op_FN01 : op_unknown,
+	};
+
+	return handlers[opcode_kind(inst)];
+}
+
+// One table per profile, built on first use (thread safe) and shared by every chip8_t
+template <typename Q>
+const decode_table_t& quirk_decode_table()
+{
+	static const std::unique_ptr<decode_table_t> table = []()
+	{
+		std::unique_ptr<decode_table_t> t = std::make_unique<decode_table_t>();
+		for (uint32_t opcode = 0; opcode < t->size(); opcode++)
+		{
+			(*t)[opcode].inst = decode_instruction(opcode);
+			(*t)[opcode].handler = decode_handler<Q>((*t)[opcode].inst);
+		}
+		return t;
+	}();
+
+	return *table;
+}
+
+// The table for a --quirks profile
+const decode_table_t& decode_table(const uint8_t quirks)
+{
+	return with_quirks(quirks, []<typename Q>() -> const decode_table_t& { return quirk_decode_table<Q>(); });
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+// Execution profiler, built in only when PROFILE_ON is defined.
+// Counts opcodes per class and per PC (one counter for each byte of chip8_t::ram), the backward
+// jumps that close loops, and the host time spent stepping the CPU, presenting and polling input.
+// The report lists where a ROM spends its time: the hottest loops first, then single addresses.
+// Without PROFILE_ON the PROFILE_ macros expand to nothing and cpu_t carries no profiler
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef PROFILE_ON
+
+#include <stdio.h>
+#include <stdint.h>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "structs.hpp"
+#include "init.hpp"
+#include "opcodes.hpp"
+
+
+// Opcode classes are the kinds the decoder uses (OP_ in opcodes.hpp), so they always match the interpreter.
+// Opcode to kind, built on first use
+const std::array<uint8_t, 0x10000>& profile_class_table()
+{
+	static const std::unique_ptr<std::array<uint8_t, 0x10000>> table = []()
+	{
+		std::unique_ptr<std::array<uint8_t, 0x10000>> t = std::make_unique<std::array<uint8_t, 0x10000>>();
+		for (uint32_t opcode = 0; opcode < t->size(); opcode++)
+		{
+			(*t)[opcode] = opcode_kind(decode_instruction(opcode));
+		}
+		return t;
+	}();
+
+	return *table;
+}
+
+
+struct profile_timer_t
+{
+	uint64_t ns;
+	uint64_t calls;
+};
+
+struct profiler_t
+{
+	std::array<uint64_t, OP_KIND_COUNT> classes;
+	std::array<uint64_t, 4096> pc_hits;			// Opcodes run at each address
+	std::array<uint64_t, 4096> back_jumps;		// Times the jump at each address went backwards (a loop closing)
+	std::array<uint16_t, 4096> back_target;		// Where it went
+	uint64_t opcodes;
+	uint64_t idle_opcodes;						// Skipped in idle loops, not in opcodes
+
+	profile_timer_t cpu;
+	profile_timer_t screen;
+	profile_timer_t input;
+};
+
+// Adds the time until the end of the enclosing scope to a timer
+struct profile_scope_t
+{
+	profile_timer_t& timer;
+	const std::chrono::steady_clock::time_point start;
+
+	profile_scope_t(profile_timer_t& timer) : timer(timer), start(std::chrono::steady_clock::now()) {}
+
+	~profile_scope_t()
+	{
+		timer.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		timer.calls++;
+	}
+};
+
+
+void init_profiler(profiler_t& profiler)
+{
+	profiler.classes.fill(0);
+	profiler.pc_hits.fill(0);
+	profiler.back_jumps.fill(0);
+	profiler.back_target.fill(0);
+	profiler.opcodes = 0;
+	profiler.idle_opcodes = 0;
+	profiler.cpu = {};
+	profiler.screen = {};
+	profiler.input = {};
+}
+
+// Count a step of ran opcodes that started at start. Blocks are straight-line code, so opcode i
+// of the step was at start + 2i and only the last one can have jumped
+void profile_step(profiler_t& profiler, const chip8_t& chip8, const uint32_t start, const uint32_t ran)
+{
+	const std::array<uint8_t, 0x10000>& classes = profile_class_table();
+
+	uint32_t PC = start & 0xFFF;
+	for (uint32_t i = 0; i < ran; i++)
+	{
+		PC = (start + i * 2) & 0xFFF;
+		profiler.pc_hits[PC]++;
+		profiler.classes[classes[(chip8.ram[PC] << 8) | chip8.ram[(PC + 1) & 0xFFF]]]++;
+	}
+	profiler.opcodes += ran;
+
+	// Only jumps and key waits make loops, a return to a lower address does not
+	const uint8_t kind = classes[(chip8.ram[PC] << 8) | chip8.ram[(PC + 1) & 0xFFF]];
+	if ((chip8.PC & 0xFFF) <= PC && (kind == OP_1NNN || kind == OP_BNNN || kind == OP_FX0A))
+	{
+		profiler.back_jumps[PC]++;
+		profiler.back_target[PC] = chip8.PC & 0xFFF;
+	}
+}
+
+
+void print_profile_timer(FILE* out, const char* name, const profile_timer_t& timer)
+{
+	fprintf(out, "  %-8s %10.1f ms %10llu calls %10.2f us per call\n", name, timer.ns / 1e6,
+		(long long unsigned)timer.calls, timer.calls ? timer.ns / 1e3 / timer.calls : 0);
+}
+
+void write_profile_report(FILE* out, const profiler_t& profiler, const chip8_t& chip8)
+{
+	const std::array<uint8_t, 0x10000>& classes = profile_class_table();
+	const double total = profiler.opcodes ? (double)profiler.opcodes : 1;
+
+	fprintf(out, "Profile: %llu opcodes, %llu more skipped in idle loops\n", (long long unsigned)profiler.opcodes,
+		(long long unsigned)profiler.idle_opcodes);
+	print_profile_timer(out, "cpu", profiler.cpu);
+	print_profile_timer(out, "screen", profiler.screen);
+	print_profile_timer(out, "input", profiler.input);
+
+	// Loops: a backward jump from source to target runs everything in [target, source]
+	struct loop_t { uint32_t target, source; uint64_t iterations, opcodes; };
+	std::vector<loop_t> loops;
+	for (uint32_t source = 0; source < 4096; source++)
+	{
+		if (profiler.back_jumps[source] == 0)
+			continue;
+
+		loop_t loop = { profiler.back_target[source], source, profiler.back_jumps[source], 0 };
+		for (uint32_t PC = loop.target; PC <= loop.source; PC++)
+		{
+			loop.opcodes += profiler.pc_hits[PC];
+		}
+		loops.push_back(loop);
+	}
+
+	std::sort(loops.begin(), loops.end(), [](const loop_t& a, const loop_t& b) { return a.opcodes > b.opcodes; });
+
+	fprintf(out, "\nHottest loops:\n  %-13s %12s %14s %7s\n", "range", "iterations", "opcodes", "share");
+	for (size_t i = 0; i < loops.size() && i < 10; i++)
+	{
+		fprintf(out, "  0x%03X-0x%03X %12llu %14llu %6.2f%%\n", loops[i].target, loops[i].source,
+			(long long unsigned)loops[i].iterations, (long long unsigned)loops[i].opcodes, loops[i].opcodes * 100 / total);
+	}
+
+	std::vector<uint32_t> order(4096);
+	for (uint32_t PC = 0; PC < 4096; PC++)
+	{
+		order[PC] = PC;
+	}
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return profiler.pc_hits[a] > profiler.pc_hits[b]; });
+
+	fprintf(out, "\nHottest addresses:\n  %-6s %-6s %-7s %14s %7s\n", "PC", "opcode", "class", "count", "share");
+	for (uint32_t i = 0; i < 20 && profiler.pc_hits[order[i]] > 0; i++)
+	{
+		const uint32_t PC = order[i];
+		const uint16_t opcode = (chip8.ram[PC] << 8) | chip8.ram[(PC + 1) & 0xFFF];
+		fprintf(out, "  0x%03X  %04X   %-7s %14llu %6.2f%%\n", PC, opcode, OPCODE_NAMES[classes[opcode]],
+			(long long unsigned)profiler.pc_hits[PC], profiler.pc_hits[PC] * 100 / total);
+	}
+
+	std::vector<uint32_t> class_order(OP_KIND_COUNT);
+	for (uint32_t i = 0; i < OP_KIND_COUNT; i++)
+	{
+		class_order[i] = i;
+	}
+	std::sort(class_order.begin(), class_order.end(), [&](uint32_t a, uint32_t b) { return profiler.classes[a] > profiler.classes[b]; });
+
+	fprintf(out, "\nOpcode classes:\n");
+	for (const uint32_t i : class_order)
+	{
+		if (profiler.classes[i] == 0)
+			break;
+
+		fprintf(out, "  %-7s %14llu %6.2f%%\n", OPCODE_NAMES[i],
+			(long long unsigned)profiler.classes[i], profiler.classes[i] * 100 / total);
+	}
+}
+
+// To config.profile_report, or stdout if that is not set
+void write_profile(const config_t& config, const profiler_t& profiler, const chip8_t& chip8)
+{
+	FILE* out = config.profile_report ? open_file(config.profile_report, "w") : stdout;
+	if (out == nullptr)
+	{
+		printf("Could not open %s for writing\n", config.profile_report);
+		return;
+	}
+
+	write_profile_report(out, profiler, chip8);
+
+	if (out != stdout)
+		fclose(out);
+}
+
+#define PROFILE_STEP(profiler, chip8, start, ran) profile_step(profiler, chip8, start, ran)
+#define PROFILE_TIME(timer) profile_scope_t PROFILE_CONCAT(profile_scope_, __LINE__)(timer)
+
+#else
+
+#define PROFILE_STEP(profiler, chip8, start, ran)
+#define PROFILE_TIME(timer)
+
+#endif
\ No newline at end of file
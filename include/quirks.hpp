@@ -0,0 +1,98 @@
+#pragma once
+
+// Quirk profiles (--quirks): the behaviours CHIP-8 implementations disagree on (see ROM/5-quirks.ch8).
+// Each profile is a type of compile-time constants that the opcode handlers are templated on, so every
+// profile gets its own specialised handlers and decode table with no quirk checks left at run time
+
+#include <stdint.h>
+#include <string.h>
+
+
+enum
+{
+	QUIRKS_VIP,			// COSMAC VIP, the original interpreter
+	QUIRKS_CHIP48,		// CHIP-48 on the HP-48
+	QUIRKS_SCHIP,		// SUPER-CHIP 1.1
+	QUIRKS_XOCHIP,		// XO-CHIP
+	QUIRKS_COUNT
+};
+
+// How far FX55/FX65 move I
+enum
+{
+	MEMORY_I_PLUS_X_PLUS_1,		// I += X + 1
+	MEMORY_I_PLUS_X,			// I += X (CHIP-48's off by one)
+	MEMORY_I_UNCHANGED
+};
+
+struct quirks_vip_t
+{
+	static constexpr bool shift_uses_vy = true;			// 8XY6/8XYE: VX = VY shifted, rather than VX shifted in place
+	static constexpr bool logic_resets_vf = true;		// 8XY1/8XY2/8XY3 clear VF
+	static constexpr uint8_t memory = MEMORY_I_PLUS_X_PLUS_1;
+	static constexpr bool jump_uses_vx = false;			// BNNN jumps to NNN + VX (X = top nibble of NNN), rather than + V0
+	static constexpr bool sprites_wrap = false;			// DXYN wraps pixels past the edge around, rather than clipping
+	static constexpr bool hires = false;				// 00FE/00FF 128x64 mode, DXY0 16x16 sprites, 00CN/00FB/00FC scrolling
+	static constexpr bool bitplanes = false;			// FN01 plane select and 00DN scroll up
+};
+
+struct quirks_chip48_t
+{
+	static constexpr bool shift_uses_vy = false;
+	static constexpr bool logic_resets_vf = false;
+	static constexpr uint8_t memory = MEMORY_I_PLUS_X;
+	static constexpr bool jump_uses_vx = true;
+	static constexpr bool sprites_wrap = false;
+	static constexpr bool hires = false;
+	static constexpr bool bitplanes = false;
+};
+
+struct quirks_schip_t
+{
+	static constexpr bool shift_uses_vy = false;
+	static constexpr bool logic_resets_vf = false;
+	static constexpr uint8_t memory = MEMORY_I_UNCHANGED;
+	static constexpr bool jump_uses_vx = true;
+	static constexpr bool sprites_wrap = false;
+	static constexpr bool hires = true;
+	static constexpr bool bitplanes = false;
+};
+
+struct quirks_xochip_t
+{
+	static constexpr bool shift_uses_vy = true;
+	static constexpr bool logic_resets_vf = false;
+	static constexpr uint8_t memory = MEMORY_I_PLUS_X_PLUS_1;
+	static constexpr bool jump_uses_vx = false;
+	static constexpr bool sprites_wrap = true;
+	static constexpr bool hires = true;
+	static constexpr bool bitplanes = true;
+};
+
+const char* const QUIRKS_NAMES[QUIRKS_COUNT] = { "vip", "chip48", "schip", "xochip" };
+
+// --quirks value to a QUIRKS_ profile, QUIRKS_COUNT if it isn't one
+uint8_t parse_quirks(const char* name)
+{
+	for (uint8_t quirks = 0; quirks < QUIRKS_COUNT; quirks++)
+	{
+		if (strcmp(name, QUIRKS_NAMES[quirks]) == 0)
+			return quirks;
+	}
+
+	return QUIRKS_COUNT;
+}
+
+// Call f.template operator()<profile type>() for a runtime profile. This is the one place a
+// profile number turns into a type, everything after it is specialised
+template <typename F>
+decltype(auto) with_quirks(const uint8_t quirks, F&& f)
+{
+	switch (quirks)
+	{
+	case QUIRKS_CHIP48: return f.template operator()<quirks_chip48_t>();
+	case QUIRKS_SCHIP:  return f.template operator()<quirks_schip_t>();
+	case QUIRKS_XOCHIP: return f.template operator()<quirks_xochip_t>();
+	default:            return f.template operator()<quirks_vip_t>();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,232 @@
+#pragma once
+
+// Input recording and replay (--record / --replay).
+// The keypad is the only input a running chip8 gets from outside (CXNN draws from chip8_t::rng,
+// which --seed fixes), so the keypad at the start of each frame where it changed is enough to play
+// a run back exactly, in the window or --headless at full speed.
+//
+// Layout (little endian):
+//   "C8IN" | u16 version | u64 hash of the ROM image | u32 seed | u32 cycles_per_frame | u8 dispatch | u8 quirks
+//   u32 frames | u32 save state size | save state (what --load-state started the run from, or nothing)
+//   events until the end of the file: [varint frames since the last event][u16 keypad]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+#include "structs.hpp"
+#include "snapshot.hpp"
+#include "quirks.hpp"
+
+
+const uint16_t INPUT_LOG_VERSION = 2;
+
+struct input_event_t
+{
+	uint32_t frame;				// Frame the keypad changed at
+	uint16_t keypad;			// Bit N = key N
+};
+
+struct input_log_t
+{
+	uint64_t rom_hash;			// hash_ram_image of the RAM after init_chip8
+	uint32_t seed;
+	uint32_t cycles_per_frame;
+	uint8_t dispatch;			// Played back with the same interpreter it was recorded with
+	uint8_t quirks;
+	uint32_t frames;			// Length of the run
+	std::vector<uint8_t> start_state;
+	std::vector<input_event_t> events;
+
+	// Position while recording or playing
+	uint32_t frame;
+	size_t next;
+	uint16_t keypad;
+};
+
+
+void init_input_log(input_log_t& log, const config_t& config, const ram_image_t& base, const std::vector<uint8_t>& start_state)
+{
+	log.rom_hash = hash_ram_image(base);
+	log.seed = config.seed;
+	log.cycles_per_frame = config.cycles_per_frame;
+	log.dispatch = config.dispatch;
+	log.quirks = config.quirks;
+	log.frames = 0;
+	log.start_state = start_state;
+	log.events.clear();
+
+	log.frame = 0;
+	log.next = 0;
+	log.keypad = 0;
+}
+
+// Recording: call before every frame runs
+void record_input(input_log_t& log, const chip8_t& chip8)
+{
+	const uint16_t keypad = chip8.keypad;
+	if (keypad != log.keypad)
+	{
+		log.events.push_back({ log.frame, keypad });
+		log.keypad = keypad;
+	}
+
+	log.frame++;
+	log.frames = log.frame;
+}
+
+// Playback: call before every frame runs. Sets the keypad for this frame, whatever the host keys are.
+// Returns false once every recorded frame has been played
+bool replay_input(input_log_t& log, chip8_t& chip8)
+{
+	if (log.frame >= log.frames)
+		return false;
+
+	while (log.next < log.events.size() && log.events[log.next].frame <= log.frame)
+	{
+		log.keypad = log.events[log.next].keypad;
+		log.next++;
+	}
+
+	chip8.keypad = log.keypad;
+	log.frame++;
+
+	return true;
+}
+
+// The run has to start from the same place it was recorded from
+bool check_input_log(const input_log_t& log, const ram_image_t& base)
+{
+	if (log.rom_hash != hash_ram_image(base))
+	{
+		printf("Replay was recorded with a different ROM\n");
+		return false;
+	}
+
+	return true;
+}
+
+// Make config match the recording, before init_chip8 seeds the rng
+void apply_input_log(const input_log_t& log, config_t& config)
+{
+	config.seed = log.seed;
+	config.cycles_per_frame = log.cycles_per_frame;
+	config.dispatch = log.dispatch;
+	config.quirks = log.quirks;
+
+#ifndef CHIP8_JIT
+	if (config.dispatch == DISPATCH_JIT)
+		config.dispatch = DISPATCH_BLOCK;	// Runs the same blocks, so the same timing
+#endif
+}
+
+
+void put_varint(std::vector<uint8_t>& out, uint32_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	out.push_back(value);
+}
+
+uint32_t get_varint(state_reader_t& in)
+{
+	uint32_t value = 0;
+	for (uint32_t shift = 0; shift < 35 && in.ok; shift += 7)
+	{
+		const uint8_t byte = get_u8(in);
+		value |= (uint32_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			break;
+	}
+
+	return value;
+}
+
+bool write_input_log(const char* path, const input_log_t& log)
+{
+	std::vector<uint8_t> out;
+	out.insert(out.end(), { 'C', '8', 'I', 'N' });
+	put_u16(out, INPUT_LOG_VERSION);
+	put_u64(out, log.rom_hash);
+	put_u32(out, log.seed);
+	put_u32(out, log.cycles_per_frame);
+	put_u8(out, log.dispatch);
+	put_u8(out, log.quirks);
+	put_u32(out, log.frames);
+	put_u32(out, log.start_state.size());
+	out.insert(out.end(), log.start_state.begin(), log.start_state.end());
+
+	uint32_t frame = 0;
+	for (const input_event_t& event : log.events)
+	{
+		put_varint(out, event.frame - frame);
+		put_u16(out, event.keypad);
+		frame = event.frame;
+	}
+
+	// Same file handling as a save state
+	return write_state_file(path, out);
+}
+
+bool read_input_log(const char* path, input_log_t& log)
+{
+	std::vector<uint8_t> data;
+	if (!read_state_file(path, data))
+		return false;
+
+	state_reader_t in = { data.data(), data.size(), 0, true };
+
+	if (data.size() < 4 || data[0] != 'C' || data[1] != '8' || data[2] != 'I' || data[3] != 'N')
+	{
+		printf("%s is not a CHIP8 input recording\n", path);
+		return false;
+	}
+	in.pos = 4;
+
+	const uint16_t version = get_u16(in);
+	if (version != INPUT_LOG_VERSION)
+	{
+		printf("Input recording version %u is not supported (expected %u)\n", version, INPUT_LOG_VERSION);
+		return false;
+	}
+
+	log.rom_hash = get_u64(in);
+	log.seed = get_u32(in);
+	log.cycles_per_frame = get_u32(in);
+	log.dispatch = get_u8(in);
+	log.quirks = get_u8(in);
+	log.frames = get_u32(in);
+
+	const uint32_t state_size = get_u32(in);
+	if (!in.ok || in.pos + state_size > in.size)
+	{
+		printf("Input recording %s is truncated or corrupt\n", path);
+		return false;
+	}
+	log.start_state.assign(data.begin() + in.pos, data.begin() + in.pos + state_size);
+	in.pos += state_size;
+
+	log.events.clear();
+	uint32_t frame = 0;
+	while (in.ok && in.pos < in.size)
+	{
+		frame += get_varint(in);
+		const uint16_t keypad = get_u16(in);
+		log.events.push_back({ frame, keypad });
+	}
+
+	if (!in.ok || log.cycles_per_frame == 0 || log.dispatch > DISPATCH_JIT || log.quirks >= QUIRKS_COUNT)
+	{
+		printf("Input recording %s is truncated or corrupt\n", path);
+		return false;
+	}
+
+	log.frame = 0;
+	log.next = 0;
+	log.keypad = 0;
+
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,247 @@
+#pragma once
+
+// Rewind history: a bounded ring of per-frame undo records.
+// After every frame, record_frame compares the chip8 against its state at the previous frame and
+// stores only the old values of what changed: RAM bytes, display words, and the registers/timers/stack
+// (small enough to always keep). rewind_frame pops the newest record and puts those values back.
+// When the ring is full the oldest frames are dropped.
+//
+// Record layout, written in ring order:
+//   u32 length | u16 ram count | count x [u16 addr, u8 old]
+//   | u8 display group mask | per set group: u32 word mask | words x u64 old | small state | u32 length
+// The display words are split into groups of 32 so a frame that changed nothing there costs one byte
+// The length at both ends lets records be dropped from the front and popped from the back
+
+#include <stdint.h>
+#include <array>
+#include <bit>
+#include <vector>
+
+#include "structs.hpp"
+
+
+struct rewind_t
+{
+	std::vector<uint8_t> ring;
+	size_t head;			// Offset of the oldest record
+	size_t used;			// Bytes in use from head
+	uint32_t frames;		// Records in the ring
+	chip8_t last;			// State when the newest record was taken
+};
+
+// Bytes for the fields record_frame always stores
+const size_t REWIND_SMALL_STATE_SIZE = 2 + 2 + 16 + 1 + 1 + 1 + 12 * 2 + 4 + 1 + 1;
+
+const uint32_t REWIND_DISPLAY_GROUPS = (uint32_t)std::tuple_size<display_t>::value / 32;
+static_assert(REWIND_DISPLAY_GROUPS <= 8, "the group mask is one byte");
+
+
+void reset_rewind(rewind_t& rewind, const chip8_t& chip8)
+{
+	rewind.head = 0;
+	rewind.used = 0;
+	rewind.frames = 0;
+	rewind.last = chip8;
+}
+
+void init_rewind(rewind_t& rewind, const size_t capacity, const chip8_t& chip8)
+{
+	rewind.ring.assign(capacity, 0);
+	reset_rewind(rewind, chip8);
+}
+
+void ring_put(rewind_t& rewind, size_t& pos, const uint64_t value, const uint32_t bytes)
+{
+	for (uint32_t i = 0; i < bytes; i++)
+	{
+		rewind.ring[pos] = (value >> (i * 8)) & 0xFF;
+		pos = (pos + 1) % rewind.ring.size();
+	}
+}
+
+uint64_t ring_get(const rewind_t& rewind, size_t& pos, const uint32_t bytes)
+{
+	uint64_t value = 0;
+	for (uint32_t i = 0; i < bytes; i++)
+	{
+		value |= (uint64_t)rewind.ring[pos] << (i * 8);
+		pos = (pos + 1) % rewind.ring.size();
+	}
+
+	return value;
+}
+
+void drop_oldest_frame(rewind_t& rewind)
+{
+	size_t pos = rewind.head;
+	const uint32_t length = ring_get(rewind, pos, 4);
+
+	rewind.head = (rewind.head + length) % rewind.ring.size();
+	rewind.used -= length;
+	rewind.frames--;
+}
+
+// Call once per frame, after it has run
+void record_frame(rewind_t& rewind, const chip8_t& chip8)
+{
+	if (rewind.ring.empty())
+		return;
+
+	chip8_t& last = rewind.last;
+
+	uint32_t ram_changes = 0;
+	for (uint32_t addr = 0; addr < chip8.ram.size(); addr++)
+	{
+		ram_changes += chip8.ram[addr] != last.ram[addr];
+	}
+
+	std::array<uint32_t, REWIND_DISPLAY_GROUPS> word_masks = {};
+	uint8_t group_mask = 0;
+	size_t display_bytes = 1;
+	for (uint32_t group = 0; group < REWIND_DISPLAY_GROUPS; group++)
+	{
+		for (uint32_t i = 0; i < 32; i++)
+		{
+			word_masks[group] |= (uint32_t)(chip8.display[group * 32 + i] != last.display[group * 32 + i]) << i;
+		}
+
+		if (word_masks[group])
+		{
+			group_mask |= 1 << group;
+			display_bytes += 4 + std::popcount(word_masks[group]) * 8;
+		}
+	}
+
+	const size_t length = 4 + 2 + ram_changes * 3 + display_bytes + REWIND_SMALL_STATE_SIZE + 4;
+	if (length > rewind.ring.size())
+	{
+		// Can't ever fit, so history before this frame is unusable
+		reset_rewind(rewind, chip8);
+		return;
+	}
+
+	while (rewind.ring.size() - rewind.used < length)
+	{
+		drop_oldest_frame(rewind);
+	}
+
+	size_t pos = (rewind.head + rewind.used) % rewind.ring.size();
+	ring_put(rewind, pos, length, 4);
+
+	ring_put(rewind, pos, ram_changes, 2);
+	for (uint32_t addr = 0; addr < chip8.ram.size(); addr++)
+	{
+		if (chip8.ram[addr] != last.ram[addr])
+		{
+			ring_put(rewind, pos, addr, 2);
+			ring_put(rewind, pos, last.ram[addr], 1);
+		}
+	}
+
+	ring_put(rewind, pos, group_mask, 1);
+	for (uint32_t group = 0; group < REWIND_DISPLAY_GROUPS; group++)
+	{
+		if (!word_masks[group])
+			continue;
+
+		ring_put(rewind, pos, word_masks[group], 4);
+		for (uint32_t i = 0; i < 32; i++)
+		{
+			if ((word_masks[group] >> i) & 1)
+				ring_put(rewind, pos, last.display[group * 32 + i], 8);
+		}
+	}
+
+	ring_put(rewind, pos, last.PC, 2);
+	ring_put(rewind, pos, last.regs.I, 2);
+	for (const uint8_t V : last.regs.V)
+	{
+		ring_put(rewind, pos, V, 1);
+	}
+	ring_put(rewind, pos, last.delay_timer, 1);
+	ring_put(rewind, pos, last.sound_timer, 1);
+	ring_put(rewind, pos, last.stack_ptr, 1);
+	for (const uint16_t entry : last.stack)
+	{
+		ring_put(rewind, pos, entry, 2);
+	}
+	ring_put(rewind, pos, last.rng, 4);
+	ring_put(rewind, pos, last.hires, 1);
+	ring_put(rewind, pos, last.planes, 1);
+
+	ring_put(rewind, pos, length, 4);
+
+	rewind.used += length;
+	rewind.frames++;
+	last = chip8;
+}
+
+// Step chip8 back one recorded frame. Returns false when there is no history left.
+// ram_changed tells the caller to drop anything it derived from RAM (the block cache)
+bool rewind_frame(rewind_t& rewind, chip8_t& chip8, bool& ram_changed)
+{
+	ram_changed = false;
+	if (rewind.frames == 0)
+		return false;
+
+	chip8_t& last = rewind.last;
+
+	size_t end = (rewind.head + rewind.used) % rewind.ring.size();
+	size_t pos = (end + rewind.ring.size() - 4) % rewind.ring.size();
+	const uint32_t length = ring_get(rewind, pos, 4);
+
+	const size_t start = (end + rewind.ring.size() - length) % rewind.ring.size();
+	pos = (start + 4) % rewind.ring.size();
+
+	const uint32_t ram_changes = ring_get(rewind, pos, 2);
+	for (uint32_t i = 0; i < ram_changes; i++)
+	{
+		const uint16_t addr = ring_get(rewind, pos, 2);
+		last.ram[addr] = ring_get(rewind, pos, 1);
+	}
+
+	const uint8_t group_mask = ring_get(rewind, pos, 1);
+	for (uint32_t group = 0; group < REWIND_DISPLAY_GROUPS; group++)
+	{
+		if (!((group_mask >> group) & 1))
+			continue;
+
+		const uint32_t word_mask = ring_get(rewind, pos, 4);
+		for (uint32_t i = 0; i < 32; i++)
+		{
+			if ((word_mask >> i) & 1)
+				last.display[group * 32 + i] = ring_get(rewind, pos, 8);
+		}
+	}
+
+	last.PC = ring_get(rewind, pos, 2);
+	last.regs.I = ring_get(rewind, pos, 2);
+	for (uint8_t& V : last.regs.V)
+	{
+		V = ring_get(rewind, pos, 1);
+	}
+	last.delay_timer = ring_get(rewind, pos, 1);
+	last.sound_timer = ring_get(rewind, pos, 1);
+	last.stack_ptr = ring_get(rewind, pos, 1);
+	for (uint16_t& entry : last.stack)
+	{
+		entry = ring_get(rewind, pos, 2);
+	}
+	last.rng = ring_get(rewind, pos, 4);
+	last.hires = ring_get(rewind, pos, 1);
+	last.planes = ring_get(rewind, pos, 1);
+
+	rewind.used -= length;
+	rewind.frames--;
+
+	// Everything but the input comes back; keys held right now stay held
+	const uint16_t keypad = chip8.keypad;
+	ram_changed = ram_changes > 0;
+	chip8 = last;
+	chip8.keypad = keypad;
+
+	clear_dirty(chip8);
+	mark_all_dirty(chip8);
+
+	return true;
+}
@@ -0,0 +1,414 @@
+#pragma once
+
+// ROM library: settings per ROM (quirk profile, speed, keymap) found by the hash of the ROM image,
+// so a known ROM starts right without any flags. Flags given on the command line still win.
+//
+// The index (--rom-index, default ROM/index.txt) is text, one ROM per line:
+//   hash             quirks  ips    keymap            name
+//   9d43f2c4b0a1e6f7 schip   1800   X123QWEASDZC4RFV  Blinky.ch8
+// chip8-library (src/rom_library.cpp) scans ROM directories and adds the ROMs it hasn't seen with
+// guessed settings; edit the lines to correct them.
+//
+// Launching doesn't parse the text. The index is compiled into a cache next to it (index + ".cache")
+// of sorted fixed-size records, which a launch maps and binary searches: one page fault and one
+// lookup. The cache holds the index's size and write time and is rebuilt when they change.
+//
+// Cache layout (little endian):
+//   "C8RX" | u16 version | u64 index size | u64 index write time | u32 count
+//   count x [u64 hash | u8 quirks | u32 ips | 16 x keymap], sorted by hash
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "structs.hpp"
+#include "init.hpp"
+#include "quirks.hpp"
+#include "mapped_file.hpp"
+
+
+const uint16_t ROM_CACHE_VERSION = 1;
+const uint32_t ROM_CACHE_HEADER_SIZE = 4 + 2 + 8 + 8 + 4;
+const uint32_t ROM_CACHE_RECORD_SIZE = 8 + 1 + 4 + 16;
+
+// Speed a newly scanned ROM gets for each profile
+const uint32_t QUIRKS_DEFAULT_IPS[QUIRKS_COUNT] = { 720, 720, 1800, 60000 };
+
+struct rom_entry_t
+{
+	uint64_t hash;
+	uint8_t quirks;
+	uint32_t ips;
+	char keymap[17];
+	std::string name;		// Index only, for people reading it
+};
+
+
+// FNV-1a over the ROM file
+uint64_t hash_rom(const uint8_t* data, const size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+uint64_t read_le(const uint8_t* data, const uint32_t bytes)
+{
+	uint64_t value = 0;
+	for (uint32_t i = 0; i < bytes; i++)
+	{
+		value |= (uint64_t)data[i] << (i * 8);
+	}
+
+	return value;
+}
+
+void write_le(std::vector<uint8_t>& out, const uint64_t value, const uint32_t bytes)
+{
+	for (uint32_t i = 0; i < bytes; i++)
+	{
+		out.push_back((value >> (i * 8)) & 0xFF);
+	}
+}
+
+// Size and write time of the index, what the cache is checked against
+bool index_stamp(const char* path, uint64_t& size, uint64_t& time)
+{
+	std::error_code error;
+	size = std::filesystem::file_size(path, error);
+	if (error)
+		return false;
+
+	time = (uint64_t)std::filesystem::last_write_time(path, error).time_since_epoch().count();
+	return !error;
+}
+
+
+bool read_rom_index(const char* path, std::vector<rom_entry_t>& entries)
+{
+	std::ifstream in(path);
+	if (!in)
+	{
+		printf("Could not open %s\n", path);
+		return false;
+	}
+
+	entries.clear();
+	std::string line;
+	for (uint32_t number = 1; std::getline(in, line); number++)
+	{
+		const size_t start = line.find_first_not_of(" \t\r");
+		if (start == std::string::npos || line[start] == '#')
+			continue;
+
+		std::istringstream fields(line);
+		std::string hash, quirks, keymap;
+		rom_entry_t entry{};
+		fields >> hash >> quirks >> entry.ips >> keymap;
+		const bool complete = !fields.fail();
+		std::getline(fields >> std::ws, entry.name);
+
+		entry.quirks = parse_quirks(quirks.c_str());
+		char* end = nullptr;
+		entry.hash = strtoull(hash.c_str(), &end, 16);
+
+		if (!complete || hash.size() != 16 || *end != '\0' || entry.quirks == QUIRKS_COUNT
+			|| entry.ips == 0 || !parse_keymap(keymap.c_str(), entry.keymap))
+		{
+			printf("%s:%u: expected: hash quirks ips keymap [name]\n", path, number);
+			return false;
+		}
+
+		entries.push_back(entry);
+	}
+
+	return true;
+}
+
+bool write_rom_index(const char* path, std::vector<rom_entry_t> entries)
+{
+	FILE* out = open_file(path, "w");
+	if (out == nullptr)
+	{
+		printf("Could not open %s for writing\n", path);
+		return false;
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const rom_entry_t& a, const rom_entry_t& b) { return a.name < b.name; });
+
+	fprintf(out, "# CHIP8 ROM library, see rom_library.hpp. One ROM per line, found by the hash of its file\n");
+	fprintf(out, "# %-16s %-7s %-6s %-17s %s\n", "hash", "quirks", "ips", "keymap", "name");
+	for (const rom_entry_t& entry : entries)
+	{
+		fprintf(out, "%016llx   %-7s %-6u %-17s %s\n", (long long unsigned)entry.hash, QUIRKS_NAMES[entry.quirks],
+			entry.ips, entry.keymap, entry.name.c_str());
+	}
+
+	fclose(out);
+	return true;
+}
+
+bool write_rom_cache(const char* index_path, const uint64_t size, const uint64_t time, std::vector<rom_entry_t> entries)
+{
+	std::sort(entries.begin(), entries.end(), [](const rom_entry_t& a, const rom_entry_t& b) { return a.hash < b.hash; });
+
+	std::vector<uint8_t> out;
+	out.reserve(ROM_CACHE_HEADER_SIZE + entries.size() * ROM_CACHE_RECORD_SIZE);
+	out.insert(out.end(), { 'C', '8', 'R', 'X' });
+	write_le(out, ROM_CACHE_VERSION, 2);
+	write_le(out, size, 8);
+	write_le(out, time, 8);
+	write_le(out, entries.size(), 4);
+
+	for (const rom_entry_t& entry : entries)
+	{
+		write_le(out, entry.hash, 8);
+		write_le(out, entry.quirks, 1);
+		write_le(out, entry.ips, 4);
+		out.insert(out.end(), entry.keymap, entry.keymap + 16);
+	}
+
+	const std::string path = std::string(index_path) + ".cache";
+	FILE* file = open_file(path.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+
+	const bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+	fclose(file);
+
+	return ok;
+}
+
+// Binary search the mapped cache. 1 found, 0 not in the library, -1 the cache is stale or damaged
+int32_t search_rom_cache(const mapped_file_t& cache, const uint64_t size, const uint64_t time, const uint64_t hash, rom_entry_t& entry)
+{
+	const uint8_t* data = cache.data;
+	if (cache.size < ROM_CACHE_HEADER_SIZE || memcmp(data, "C8RX", 4) != 0 || read_le(data + 4, 2) != ROM_CACHE_VERSION
+		|| read_le(data + 6, 8) != size || read_le(data + 14, 8) != time)
+		return -1;
+
+	const uint32_t count = (uint32_t)read_le(data + 22, 4);
+	if (cache.size != ROM_CACHE_HEADER_SIZE + (uint64_t)count * ROM_CACHE_RECORD_SIZE)
+		return -1;
+
+	const uint8_t* records = data + ROM_CACHE_HEADER_SIZE;
+	uint32_t lo = 0;
+	uint32_t hi = count;
+	while (lo < hi)
+	{
+		const uint32_t mid = lo + (hi - lo) / 2;
+		const uint8_t* record = records + (size_t)mid * ROM_CACHE_RECORD_SIZE;
+		const uint64_t record_hash = read_le(record, 8);
+
+		if (record_hash < hash)
+		{
+			lo = mid + 1;
+		}
+		else if (record_hash > hash)
+		{
+			hi = mid;
+		}
+		else
+		{
+			entry.hash = hash;
+			entry.quirks = std::min<uint8_t>(record[8], QUIRKS_COUNT - 1);
+			entry.ips = (uint32_t)read_le(record + 9, 4);
+			memcpy(entry.keymap, record + 13, 16);
+			entry.keymap[16] = '\0';
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Library settings for a ROM image. False if it isn't in the library, or there is no index
+bool lookup_rom(const char* index_path, const uint64_t hash, rom_entry_t& entry)
+{
+	uint64_t size, time;
+	if (!index_stamp(index_path, size, time))
+		return false;
+
+	const std::string cache_path = std::string(index_path) + ".cache";
+	mapped_file_t cache;
+	if (map_file(cache_path.c_str(), cache))
+	{
+		const int32_t found = search_rom_cache(cache, size, time, hash, entry);
+		unmap_file(cache);
+
+		if (found >= 0)
+			return found == 1;
+	}
+
+	// No cache yet, or the index changed since: rebuild it from the text.
+	// A read-only directory just means parsing every time
+	std::vector<rom_entry_t> entries;
+	if (!read_rom_index(index_path, entries))
+		return false;
+
+	write_rom_cache(index_path, size, time, entries);
+
+	for (const rom_entry_t& known : entries)
+	{
+		if (known.hash == hash)
+		{
+			entry = known;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Take the quirks, speed and keymap for config.rom_name from the library, except those given as flags
+void apply_rom_library(config_t& config)
+{
+	if (config.rom_name == nullptr || config.rom_index == nullptr)
+		return;
+
+	mapped_file_t rom;
+	if (!map_file(config.rom_name, rom))
+		return;		// init_chip8 says what is wrong with it
+
+	const uint64_t hash = hash_rom(rom.data, rom.size);
+	unmap_file(rom);
+
+	rom_entry_t entry;
+	if (!lookup_rom(config.rom_index, hash, entry))
+		return;
+
+	if (!(config.given & GIVEN_QUIRKS))
+		config.quirks = entry.quirks;
+
+	if (!(config.given & GIVEN_SPEED))
+		config.cycles_per_frame = std::max<uint32_t>(1, entry.ips / 60);
+
+	if (!(config.given & GIVEN_KEYMAP))
+		memcpy(config.keymap, entry.keymap, sizeof(config.keymap));
+}
+
+
+// Guess a profile from opcodes only one machine has. ROMs mix code and data, so this walks the code
+// reachable from 0x200 (following jumps, calls and both sides of skips) rather than every byte.
+// BNNN and self-modifying code hide the rest, which the guess then doesn't see
+uint8_t guess_quirks(const uint8_t* data, const size_t size)
+{
+	std::vector<bool> seen(size, false);
+	std::vector<uint32_t> pending = { 0 };
+	bool schip = false;
+
+	while (!pending.empty())
+	{
+		uint32_t offset = pending.back();
+		pending.pop_back();
+
+		while (offset + 1 < size && !seen[offset])
+		{
+			seen[offset] = true;
+			const uint16_t opcode = (data[offset] << 8) | data[offset + 1];
+			const uint16_t NNN = opcode & 0xFFF;
+			const uint8_t NN = opcode & 0xFF;
+			const uint8_t X = (opcode >> 8) & 0xF;
+			uint32_t next = offset + 2;
+
+			// F000 NNNN (long I), FN01 (planes), F002 (audio), 00DN (scroll up)
+			if (opcode == 0xF000 || opcode == 0xF002 || ((opcode & 0xF0FF) == 0xF001 && X <= 3) || (opcode & 0xFFF0) == 0x00D0)
+				return QUIRKS_XOCHIP;
+
+			// 00FE/00FF (modes), 00FB/00FC/00CN (scrolling), 00FD (exit), FX30 (big font), FX75/FX85 (flags)
+			schip |= opcode == 0x00FE || opcode == 0x00FF || opcode == 0x00FB || opcode == 0x00FC || opcode == 0x00FD
+				|| ((opcode & 0xFFF0) == 0x00C0 && (opcode & 0xF) != 0)
+				|| (opcode & 0xF0FF) == 0xF030 || (opcode & 0xF0FF) == 0xF075 || (opcode & 0xF0FF) == 0xF085;
+
+			switch (opcode >> 12)
+			{
+			case 0x0:
+				if (NN == 0xEE || NN == 0xFD || (opcode & 0xFF00) != 0)	// Return, exit, machine code
+					next = size;
+				break;
+			case 0x1:
+				next = NNN - 0x200;		// Out of the ROM when NNN < 0x200, which ends the walk
+				break;
+			case 0x2:
+				pending.push_back(NNN - 0x200);
+				break;
+			case 0x3: case 0x4: case 0x5: case 0x9:
+				pending.push_back(offset + 4);
+				break;
+			case 0xB:
+				next = size;
+				break;
+			case 0xE:
+				if (NN == 0x9E || NN == 0xA1)
+					pending.push_back(offset + 4);
+				break;
+			}
+
+			offset = next;
+		}
+	}
+
+	return schip ? QUIRKS_SCHIP : QUIRKS_VIP;
+}
+
+// Add every ROM file in dir that the library doesn't have yet. Returns how many were added
+uint32_t scan_rom_directory(const char* dir, std::vector<rom_entry_t>& entries)
+{
+	const char* extensions[] = { ".ch8", ".c8", ".sc8", ".xo8" };
+
+	std::vector<std::filesystem::path> paths;
+	std::error_code error;
+	for (const std::filesystem::directory_entry& file : std::filesystem::directory_iterator(dir, error))
+	{
+		const std::string extension = file.path().extension().string();
+		if (file.is_regular_file() && std::find(std::begin(extensions), std::end(extensions), extension) != std::end(extensions))
+			paths.push_back(file.path());
+	}
+
+	if (error)
+	{
+		printf("Could not read directory %s\n", dir);
+		return 0;
+	}
+
+	std::sort(paths.begin(), paths.end());
+
+	uint32_t added = 0;
+	for (const std::filesystem::path& path : paths)
+	{
+		mapped_file_t rom;
+		if (!map_file(path.string().c_str(), rom))
+		{
+			printf("Could not map %s\n", path.string().c_str());
+			continue;
+		}
+
+		rom_entry_t entry{};
+		entry.hash = hash_rom(rom.data, rom.size);
+		entry.quirks = guess_quirks(rom.data, rom.size);
+		unmap_file(rom);
+
+		const bool known = std::any_of(entries.begin(), entries.end(), [&](const rom_entry_t& e) { return e.hash == entry.hash; });
+		if (known)
+			continue;
+
+		entry.ips = QUIRKS_DEFAULT_IPS[entry.quirks];
+		memcpy(entry.keymap, "X123QWEASDZC4RFV", sizeof(entry.keymap));
+		entry.name = path.filename().string();
+		entries.push_back(entry);
+		added++;
+	}
+
+	return added;
+}
\ No newline at end of file
@@ -0,0 +1,322 @@
+#pragma once
+
+// ROM maps: what chip8-disasm (src/disasm.cpp) works out about a ROM before it runs, saved next to it
+// as ROM.c8map for the emulator to pick up. For each byte of RAM: whether it is code (reachable from
+// 0x200, see control_flow.hpp), sprite data DXYN can draw, data FX65 can load, and whether FX33/FX55
+// can store to it. The last three come from following the values I can hold through the control flow.
+//
+// When all of the control flow is known (no BNNN, nothing running off the ROM) and no store can reach
+// a byte of code, the code can never change. The emulator then translates every block up front, and
+// --dispatch block/jit stop checking each FX33/FX55 against the blocks they hold (config.code_fixed).
+//
+// Layout (little endian):
+//   "C8MP" | u16 version | u64 hash of the RAM after init_chip8 | u8 quirks | u8 code fixed
+//   4096 x u8 MAP_ bits, by address
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <array>
+#include <string>
+#include <vector>
+
+#include "CHIP8.hpp"
+#include "control_flow.hpp"
+#include "snapshot.hpp"
+
+
+const uint16_t ROM_MAP_VERSION = 1;
+
+enum
+{
+	MAP_CODE = 1 << 0,		// Part of a reachable opcode
+	MAP_OPCODE = 1 << 1,	// First byte of one
+	MAP_LEADER = 1 << 2,	// A block starts here
+	MAP_SPRITE = 1 << 3,	// DXYN can draw from it
+	MAP_READ = 1 << 4,		// FX65 can load it
+	MAP_WRITTEN = 1 << 5,	// FX33/FX55 can store to it
+};
+
+struct rom_map_t
+{
+	uint64_t rom_hash;					// hash_ram_image of the RAM after init_chip8
+	uint8_t quirks;						// Sprite sizes and how far FX55/FX65 move I depend on the profile
+	bool code_fixed;					// Proven that no opcode ever changes
+	std::array<uint8_t, 4096> bytes;	// MAP_ bits by address
+};
+
+// The values I can hold at an opcode, lo to hi
+struct index_range_t
+{
+	uint32_t lo;
+	uint32_t hi;
+};
+
+const index_range_t ANY_INDEX = { 0, 0xFFFF };
+
+// An opcode reached again with a new range this many times has every I from then on, so the walk ends
+const uint32_t INDEX_WIDEN_VISITS = 16;
+
+
+// range + [min, max]. I is 16 bits, a sum that can wrap could be anything
+index_range_t add_index(const index_range_t range, const uint32_t min, const uint32_t max)
+{
+	if (range.hi + max > 0xFFFF)
+		return ANY_INDEX;
+
+	return index_range_t{ range.lo + min, range.hi + max };
+}
+
+// I after inst, from I before it
+template <typename Q>
+index_range_t index_after(const instruction_t& inst, const index_range_t range)
+{
+	switch (opcode_kind(inst))
+	{
+	case OP_ANNN:
+		return index_range_t{ inst.NNN, inst.NNN };
+
+	case OP_FX1E:
+		return add_index(range, 0, 0xFF);
+
+	case OP_FX29:
+		return index_range_t{ 0, 15 * 5 };	// Font characters are 5 bytes from 0
+
+	case OP_FX55: case OP_FX65:
+		if constexpr (Q::memory == MEMORY_I_PLUS_X_PLUS_1)
+			return add_index(range, inst.X + 1, inst.X + 1);
+		else if constexpr (Q::memory == MEMORY_I_PLUS_X)
+			return add_index(range, inst.X, inst.X);
+		break;
+	}
+
+	return range;
+}
+
+// Bytes DXYN reads from I: 16x16 sprites for DXY0 with SUPER-CHIP, another sprite per extra XO-CHIP plane
+template <typename Q>
+uint32_t sprite_bytes(const instruction_t& inst)
+{
+	const uint32_t size = Q::hires && inst.N == 0 ? 32 : inst.N;
+	return Q::bitplanes ? size * DISPLAY_PLANES : size;
+}
+
+// Give count bytes from every I in range bits, wrapping at the end of RAM as the handlers do
+void mark_from_index(rom_map_t& map, const index_range_t range, const uint32_t count, const uint8_t bits)
+{
+	if (count == 0)
+		return;
+
+	const uint32_t span = std::min<uint32_t>(range.hi - range.lo + count, 4096);
+	for (uint32_t addr = range.lo; addr < range.lo + span; addr++)
+	{
+		map.bytes[addr & 0xFFF] |= bits;
+	}
+}
+
+// Find the range of I at every reachable opcode, then mark what the opcodes using it can touch.
+// 00EE goes back to the opcode after any call
+template <typename Q>
+void map_index_uses(rom_map_t& map, const control_flow_t& flow, const uint8_t* ram, const uint16_t boot_I)
+{
+	std::vector<index_range_t> at(4096, index_range_t{ 0, 0 });	// I on reaching each opcode
+	std::vector<uint8_t> visits(4096, 0);
+	std::bitset<4096> reached;
+
+	std::vector<uint16_t> returns;
+	for (uint32_t addr = flow.rom_start; addr < flow.rom_end; addr++)
+	{
+		if (flow.code[addr] && opcode_kind(decode_instruction((ram[addr] << 8) | ram[addr + 1])) == OP_2NNN && addr + 2 < 4096 && flow.code[addr + 2])
+			returns.push_back((uint16_t)(addr + 2));
+	}
+
+	std::vector<uint16_t> pending;
+	if (flow.code[flow.rom_start])
+	{
+		at[flow.rom_start] = index_range_t{ boot_I, boot_I };
+		reached[flow.rom_start] = true;
+		pending.push_back(flow.rom_start);
+	}
+
+	while (!pending.empty())
+	{
+		const uint32_t addr = pending.back();
+		pending.pop_back();
+
+		const instruction_t inst = decode_instruction((ram[addr] << 8) | ram[addr + 1]);
+		const index_range_t out = index_after<Q>(inst, at[addr]);
+
+		uint16_t next[2];
+		const uint32_t count = next_addresses(inst, addr, next);
+		const bool returning = opcode_kind(inst) == OP_00EE;
+
+		for (size_t i = 0; i < (returning ? returns.size() : count); i++)
+		{
+			const uint32_t target = returning ? returns[i] : next[i];
+			if (!flow.code[target])
+				continue;	// Left the ROM, the flow is incomplete already
+
+			index_range_t merged = out;
+			if (reached[target])
+			{
+				merged = index_range_t{ std::min(at[target].lo, out.lo), std::max(at[target].hi, out.hi) };
+				if (merged.lo == at[target].lo && merged.hi == at[target].hi)
+					continue;
+
+				if (++visits[target] > INDEX_WIDEN_VISITS)
+					merged = ANY_INDEX;
+			}
+
+			at[target] = merged;
+			reached[target] = true;
+			pending.push_back((uint16_t)target);
+		}
+	}
+
+	for (uint32_t addr = flow.rom_start; addr < flow.rom_end; addr++)
+	{
+		if (!reached[addr])
+			continue;
+
+		const instruction_t inst = decode_instruction((ram[addr] << 8) | ram[addr + 1]);
+		switch (opcode_kind(inst))
+		{
+		case OP_DXYN: mark_from_index(map, at[addr], sprite_bytes<Q>(inst), MAP_SPRITE); break;
+		case OP_FX33: mark_from_index(map, at[addr], 3, MAP_WRITTEN); break;
+		case OP_FX55: mark_from_index(map, at[addr], inst.X + 1, MAP_WRITTEN); break;
+		case OP_FX65: mark_from_index(map, at[addr], inst.X + 1, MAP_READ); break;
+		}
+	}
+}
+
+// Map the ROM chip8 has just been loaded with by init_chip8, size bytes of it. flow is left with its control flow
+void build_rom_map(rom_map_t& map, control_flow_t& flow, const chip8_t& chip8, const size_t size, const uint8_t quirks)
+{
+	map.rom_hash = hash_ram_image(chip8.ram);
+	map.quirks = quirks;
+	map.bytes.fill(0);
+
+	analyse_control_flow(flow, chip8.ram.data(), size);
+
+	for (uint32_t addr = flow.rom_start; addr < flow.rom_end; addr++)
+	{
+		if (!flow.code[addr])
+			continue;
+
+		map.bytes[addr] |= MAP_CODE | MAP_OPCODE | (flow.leaders[addr] ? MAP_LEADER : 0);
+		map.bytes[addr + 1] |= MAP_CODE;
+	}
+
+	with_quirks(quirks, [&]<typename Q>() { map_index_uses<Q>(map, flow, chip8.ram.data(), chip8.regs.I); });
+
+	map.code_fixed = flow.complete;
+	for (const uint8_t bits : map.bytes)
+	{
+		if ((bits & MAP_CODE) && (bits & MAP_WRITTEN))
+			map.code_fixed = false;
+	}
+}
+
+
+void save_rom_map(const rom_map_t& map, std::vector<uint8_t>& out)
+{
+	out.clear();
+	out.insert(out.end(), { 'C', '8', 'M', 'P' });
+	put_u16(out, ROM_MAP_VERSION);
+	put_u64(out, map.rom_hash);
+	put_u8(out, map.quirks);
+	put_u8(out, map.code_fixed);
+	out.insert(out.end(), map.bytes.begin(), map.bytes.end());
+}
+
+bool load_rom_map(rom_map_t& map, const uint8_t* data, const size_t size)
+{
+	state_reader_t in{ data, size, 0, true };
+
+	if (size < 4 || memcmp(data, "C8MP", 4) != 0)
+	{
+		printf("Not a ROM map\n");
+		return false;
+	}
+	in.pos = 4;
+
+	const uint16_t version = get_u16(in);
+	if (version != ROM_MAP_VERSION)
+	{
+		printf("ROM map version %u, expected %u (run chip8-disasm again)\n", version, ROM_MAP_VERSION);
+		return false;
+	}
+
+	map.rom_hash = get_u64(in);
+	map.quirks = get_u8(in);
+	map.code_fixed = get_u8(in) != 0;
+
+	if (!in.ok || in.pos + map.bytes.size() != size || map.quirks >= QUIRKS_COUNT)
+	{
+		printf("ROM map is corrupt\n");
+		return false;
+	}
+
+	memcpy(map.bytes.data(), data + in.pos, map.bytes.size());
+	return true;
+}
+
+// The map for config.rom_name: --rom-map, or ROM.c8map next to the ROM when there is one. A map made for
+// another ROM or quirk profile proves nothing about this run, so it is left out
+bool find_rom_map(rom_map_t& map, const config_t& config, const ram_image_t& boot_ram)
+{
+	std::string path;
+	if (config.rom_map)
+		path = config.rom_map;
+	else if (config.rom_name)
+	{
+		path = std::string(config.rom_name) + ".c8map";
+
+		FILE* file = open_file(path.c_str(), "rb");
+		if (file == nullptr)
+			return false;
+		fclose(file);
+	}
+	else
+		return false;
+
+	std::vector<uint8_t> data;
+	if (!read_state_file(path.c_str(), data) || !load_rom_map(map, data.data(), data.size()))
+		return false;
+
+	if (map.rom_hash != hash_ram_image(boot_ram) || map.quirks != config.quirks)
+	{
+		printf("%s was made for another ROM or quirk profile, not using it (run chip8-disasm again)\n", path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// Translate every block the map found for --dispatch block/jit, rather than on first run. Returns how many
+uint32_t prebuild_blocks(cpu_t& cpu, const chip8_t& chip8, const config_t& config, const rom_map_t& map)
+{
+	uint32_t built = 0;
+
+	for (uint32_t addr = 0; addr < map.bytes.size(); addr++)
+	{
+		if (!(map.bytes[addr] & MAP_LEADER))
+			continue;
+
+		if (config.dispatch == DISPATCH_BLOCK && !cpu.blocks.blocks[addr])
+		{
+			translate_block(cpu.blocks, *cpu.table, chip8, (uint16_t)addr);
+			built++;
+		}
+#ifdef CHIP8_JIT
+		else if (config.dispatch == DISPATCH_JIT && !cpu.jit.blocks[addr].code)
+		{
+			if (!with_quirks(config.quirks, [&]<typename Q>() { return compile_block<Q>(cpu.jit, *cpu.table, chip8, (uint16_t)addr); }))
+				break;	// No arena
+			built++;
+		}
+#endif
+	}
+
+	return built;
+}
\ No newline at end of file
@@ -0,0 +1,302 @@
+#pragma once
+
+// Save states: a chip8_t serialized into a small versioned binary blob.
+//
+// Layout (little endian):
+//   "C8SS" | u16 version | u64 hash of the base RAM image
+//   u16 PC | u16 I | V0-VF | u8 delay | u8 sound | u8 stack_ptr | 12 x u16 stack
+//   u16 keypad (bit N = key N) | u32 rng | u8 status | u8 hires | u8 planes
+//   display words of the current mode: for each plane, 32 rows x 1 u64 (lores) or 64 rows x 2 u64 (hires)
+//   RAM as a delta against the base image: runs of [u16 offset][u16 length][bytes], ended by a 0 length
+//
+// The base image is the RAM straight after init_chip8 (font + ROM), so a fresh state only costs
+// the bytes the ROM has written since
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <array>
+#include <vector>
+
+#include "structs.hpp"
+#include "init.hpp"
+
+
+const uint16_t SNAPSHOT_VERSION = 2;
+
+typedef std::array<uint8_t, 4096> ram_image_t;
+
+
+uint64_t hash_ram_image(const ram_image_t& ram)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (const uint8_t byte : ram)
+	{
+		hash ^= byte;
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+void put_u8(std::vector<uint8_t>& out, const uint8_t value)
+{
+	out.push_back(value);
+}
+
+void put_u16(std::vector<uint8_t>& out, const uint16_t value)
+{
+	out.push_back(value & 0xFF);
+	out.push_back(value >> 8);
+}
+
+void put_u32(std::vector<uint8_t>& out, const uint32_t value)
+{
+	put_u16(out, value & 0xFFFF);
+	put_u16(out, value >> 16);
+}
+
+void put_u64(std::vector<uint8_t>& out, const uint64_t value)
+{
+	put_u32(out, value & 0xFFFFFFFF);
+	put_u32(out, value >> 32);
+}
+
+// Bounds checked reader over a blob, ok goes false on the first read past the end
+struct state_reader_t
+{
+	const uint8_t* data;
+	size_t size;
+	size_t pos;
+	bool ok;
+};
+
+uint8_t get_u8(state_reader_t& in)
+{
+	if (in.pos + 1 > in.size)
+	{
+		in.ok = false;
+		return 0;
+	}
+
+	return in.data[in.pos++];
+}
+
+uint16_t get_u16(state_reader_t& in)
+{
+	const uint16_t lo = get_u8(in);
+	return lo | (get_u8(in) << 8);
+}
+
+uint32_t get_u32(state_reader_t& in)
+{
+	const uint32_t lo = get_u16(in);
+	return lo | ((uint32_t)get_u16(in) << 16);
+}
+
+uint64_t get_u64(state_reader_t& in)
+{
+	const uint64_t lo = get_u32(in);
+	return lo | ((uint64_t)get_u32(in) << 32);
+}
+
+
+void save_state(const chip8_t& chip8, const ram_image_t& base, std::vector<uint8_t>& out)
+{
+	out.clear();
+	out.reserve(512);
+
+	out.insert(out.end(), { 'C', '8', 'S', 'S' });
+	put_u16(out, SNAPSHOT_VERSION);
+	put_u64(out, hash_ram_image(base));
+
+	put_u16(out, chip8.PC & 0xFFF);	// Fetches wrap at 4K, so this runs the same
+	put_u16(out, chip8.regs.I);
+	out.insert(out.end(), chip8.regs.V.begin(), chip8.regs.V.end());
+	put_u8(out, chip8.delay_timer);
+	put_u8(out, chip8.sound_timer);
+	put_u8(out, chip8.stack_ptr);
+	for (const uint16_t entry : chip8.stack)
+	{
+		put_u16(out, entry);
+	}
+
+	put_u16(out, chip8.keypad);
+	put_u32(out, chip8.rng);
+	put_u8(out, chip8.status);
+	put_u8(out, chip8.hires);
+	put_u8(out, chip8.planes);
+
+	// The rest of the display is always clear
+	const uint32_t words = chip8.hires ? hires_t::words : lores_t::words;
+	for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+	{
+		for (uint32_t Y = 0; Y < display_height(chip8); Y++)
+		{
+			for (uint32_t word = 0; word < words; word++)
+			{
+				put_u64(out, display_row(chip8, plane, Y)[word]);
+			}
+		}
+	}
+
+	// RAM delta. Runs separated by fewer bytes than a run header are merged
+	const uint32_t merge_gap = 4;
+	uint32_t addr = 0;
+	while (addr < chip8.ram.size())
+	{
+		if (chip8.ram[addr] == base[addr])
+		{
+			addr++;
+			continue;
+		}
+
+		const uint32_t start = addr;
+		uint32_t end = addr + 1;	// One past the last differing byte
+		for (uint32_t scan = end; scan < chip8.ram.size() && scan < end + merge_gap; scan++)
+		{
+			if (chip8.ram[scan] != base[scan])
+				end = scan + 1;
+		}
+
+		put_u16(out, start);
+		put_u16(out, end - start);
+		out.insert(out.end(), chip8.ram.begin() + start, chip8.ram.begin() + end);
+		addr = end;
+	}
+
+	put_u16(out, 0);
+	put_u16(out, 0);
+}
+
+// Restores into chip8 only if the whole blob is valid for this base image
+bool load_state(chip8_t& chip8, const ram_image_t& base, const uint8_t* data, const size_t size)
+{
+	state_reader_t in = { data, size, 0, true };
+
+	if (size < 4 || data[0] != 'C' || data[1] != '8' || data[2] != 'S' || data[3] != 'S')
+	{
+		printf("Not a CHIP8 save state\n");
+		return false;
+	}
+	in.pos = 4;
+
+	const uint16_t version = get_u16(in);
+	if (version != SNAPSHOT_VERSION)
+	{
+		printf("Save state version %u is not supported (expected %u)\n", version, SNAPSHOT_VERSION);
+		return false;
+	}
+
+	if (get_u64(in) != hash_ram_image(base))
+	{
+		printf("Save state was taken with a different ROM\n");
+		return false;
+	}
+
+	chip8_t state = chip8;
+
+	state.PC = get_u16(in);
+	state.regs.I = get_u16(in);
+	for (uint8_t& V : state.regs.V)
+	{
+		V = get_u8(in);
+	}
+	state.delay_timer = get_u8(in);
+	state.sound_timer = get_u8(in);
+	state.stack_ptr = get_u8(in);
+	for (uint16_t& entry : state.stack)
+	{
+		entry = get_u16(in);
+	}
+
+	state.keypad = get_u16(in);
+	state.rng = get_u32(in);
+	state.status = get_u8(in);
+	state.hires = get_u8(in) != 0;
+	state.planes = get_u8(in) & ((1 << DISPLAY_PLANES) - 1);
+
+	state.display.fill(0);
+	const uint32_t words = state.hires ? hires_t::words : lores_t::words;
+	for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+	{
+		for (uint32_t Y = 0; Y < display_height(state); Y++)
+		{
+			for (uint32_t word = 0; word < words; word++)
+			{
+				display_row(state, plane, Y)[word] = get_u64(in);
+			}
+		}
+	}
+
+	state.ram = base;
+	for (;;)
+	{
+		const uint16_t start = get_u16(in);
+		const uint16_t length = get_u16(in);
+		if (!in.ok || length == 0)
+			break;
+
+		if (start + length > state.ram.size() || in.pos + length > in.size)
+		{
+			in.ok = false;
+			break;
+		}
+
+		memcpy(&state.ram[start], &in.data[in.pos], length);
+		in.pos += length;
+	}
+
+	if (!in.ok || state.stack_ptr > state.stack.size() || state.PC > 0xFFF || state.status > QUIT)
+	{
+		printf("Save state is truncated or corrupt\n");
+		return false;
+	}
+
+	chip8 = state;
+	clear_dirty(chip8);
+	mark_all_dirty(chip8);
+
+	return true;
+}
+
+
+bool write_state_file(const char* path, const std::vector<uint8_t>& state)
+{
+	FILE* file = open_file(path, "wb");
+	if (file == nullptr)
+	{
+		printf("Could not open %s for writing\n", path);
+		return false;
+	}
+
+	const bool ok = fwrite(state.data(), 1, state.size(), file) == state.size();
+	fclose(file);
+
+	if (!ok)
+		printf("Could not write %s\n", path);
+
+	return ok;
+}
+
+bool read_state_file(const char* path, std::vector<uint8_t>& state)
+{
+	FILE* file = open_file(path, "rb");
+	if (file == nullptr)
+	{
+		printf("Could not open %s\n", path);
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	state.resize(ftell(file));
+	rewind(file);
+
+	const bool ok = fread(state.data(), 1, state.size(), file) == state.size();
+	fclose(file);
+
+	if (!ok)
+		printf("Could not read %s\n", path);
+
+	return ok;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+// Fixed-size single-producer single-consumer ring. One thread pushes, one other thread pops, and
+// neither locks, waits or allocates: a push into a full ring fails, a pop from an empty one fails.
+// N must be a power of two
+
+#include <stdint.h>
+#include <array>
+#include <atomic>
+
+
+template <typename T, uint32_t N>
+struct spsc_ring_t
+{
+	static_assert((N & (N - 1)) == 0, "spsc_ring_t size must be a power of two");
+
+	std::array<T, N> items;
+	alignas(64) std::atomic<uint32_t> head;		// Next slot to push, written by the producer only
+	alignas(64) std::atomic<uint32_t> tail;		// Next slot to pop, written by the consumer only
+};
+
+template <typename T, uint32_t N>
+void init_spsc_ring(spsc_ring_t<T, N>& ring)
+{
+	ring.head.store(0);
+	ring.tail.store(0);
+}
+
+template <typename T, uint32_t N>
+bool spsc_push(spsc_ring_t<T, N>& ring, const T& item)
+{
+	const uint32_t head = ring.head.load(std::memory_order_relaxed);
+	if (head - ring.tail.load(std::memory_order_acquire) == N)
+		return false;
+
+	ring.items[head % N] = item;
+	ring.head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename T, uint32_t N>
+bool spsc_pop(spsc_ring_t<T, N>& ring, T& item)
+{
+	const uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+	if (tail == ring.head.load(std::memory_order_acquire))
+		return false;
+
+	item = ring.items[tail % N];
+	ring.tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
\ No newline at end of file
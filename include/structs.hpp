@@ -1,6 +1,8 @@
 #pragma once
 
+#include <stdint.h>
 #include <array>
+#include <algorithm>
 
 enum
 {
@@ -9,11 +11,26 @@ enum
 	QUIT
 };
 
-// sfml variables
-struct sfml_t
+// Which interpreter runs the opcodes (--dispatch)
+enum
+{
+	DISPATCH_SWITCH,	// Decode the fields and switch on them every cycle
+	DISPATCH_TABLE,		// Look the opcode up in a table decoded once at startup
+	DISPATCH_BLOCK,		// Run cached straight-line blocks of predecoded opcodes (block_cache.hpp)
+	DISPATCH_JIT		// The same blocks compiled to x86-64 machine code (jit.hpp)
+};
+
+// --dispatch jit is only built for x86-64
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT
+#endif
+
+// Settings that were given on the command line, which the ROM library (rom_library.hpp) leaves alone
+enum
 {
-	sf::RenderWindow window;
-	//sf::Sound sound;
+	GIVEN_QUIRKS = 1 << 0,
+	GIVEN_SPEED = 1 << 1,
+	GIVEN_KEYMAP = 1 << 2
 };
 
 // Configuration for the display
@@ -24,7 +41,32 @@ struct config_t
 	uint32_t scale_factor;
 	uint32_t fg_color;
 	uint32_t bg_color;
+	uint32_t plane2_color;		// XO-CHIP: pixels on in the second bitplane only
+	uint32_t overlap_color;		// XO-CHIP: pixels on in both bitplanes
+	uint32_t cycles_per_frame;	// Opcodes run per 60Hz frame (instructions per second / 60)
 	const char* rom_name;
+	bool headless;				// Run without a window as fast as the host allows
+	uint64_t max_cycles;		// Headless only: stop after this many opcodes
+	uint8_t dispatch;			// DISPATCH_SWITCH, DISPATCH_TABLE, DISPATCH_BLOCK or DISPATCH_JIT
+	uint8_t quirks;				// QUIRKS_ profile (quirks.hpp) the interpreters are specialised for
+	uint32_t seed;				// Seeds chip8_t::rng, so the same seed gives the same CXNN results
+	const char* load_state;		// Save state to restore right after loading the ROM
+	const char* save_state;		// Where to write a save state: end of a headless run, or F5 in the window
+	uint32_t rewind_mb;			// Memory for the rewind history (hold backspace), 0 turns it off
+	const char* record;			// Write the keypad input of this run here
+	const char* replay;			// Play back input recorded with --record, windowed or headless
+	const char* profile_report;	// PROFILE_ON builds: where the profile goes at exit or on F8 (default stdout)
+	const char* trace;			// Trace every opcode from the start and write the trace here at exit (F7 toggles)
+	uint32_t trace_records;		// Size of the trace ring, the most recent opcodes kept
+	const char* rom_index;		// ROM library index: quirks, speed and keymap per ROM hash
+	char keymap[17];			// Keyboard key for CHIP-8 keys 0-F, as letters/digits
+	uint8_t given;				// GIVEN_ bits
+	uint32_t volume;			// Buzzer volume, 0-100, 0 is silent
+	bool idle_skip;				// Jump over idle loops to the next frame instead of running them (CHIP8.hpp)
+	bool jit_check;				// --dispatch jit: run every compiled block on the interpreter too and compare
+	const char* rom_map;		// chip8-disasm map of the ROM (rom_map.hpp), default ROM.c8map when there is one
+	bool use_rom_map;
+	bool code_fixed;			// Set from the ROM map: no FX33/FX55 can write code, so stores aren't checked against cached blocks
 };
 
 struct registers_t
@@ -43,19 +85,121 @@ struct instruction_t
 	uint8_t  Y;      // 4 bit register identifier
 };
 
+// Display geometry. The display is DISPLAY_PLANES bitplanes of DISPLAY_HEIGHT rows, each row DISPLAY_WORDS
+// 64 bit words with the MSB of the first word as the leftmost pixel. Hires (00FF) uses all of it,
+// lores only the first word of the top 32 rows and the rest is kept clear
+const uint32_t DISPLAY_WIDTH = 128;
+const uint32_t DISPLAY_HEIGHT = 64;
+const uint32_t DISPLAY_WORDS = DISPLAY_WIDTH / 64;
+const uint32_t DISPLAY_PLANES = 2;			// XO-CHIP bitplanes, everything else only draws to the first
+
+// Each mode's geometry as compile-time constants, so drawing and scrolling fold to shifts and masks
+struct lores_t
+{
+	static constexpr uint32_t width = 64;
+	static constexpr uint32_t height = 32;
+	static constexpr uint32_t words = 1;
+};
+
+struct hires_t
+{
+	static constexpr uint32_t width = 128;
+	static constexpr uint32_t height = 64;
+	static constexpr uint32_t words = 2;
+};
+
+typedef std::array<uint64_t, DISPLAY_PLANES * DISPLAY_HEIGHT * DISPLAY_WORDS> display_t;	// Plane, row, word: see display_row
+
+// Bounding box of display pixels touched since the frontend last presented, inclusive, in the
+// current mode's pixels. Empty when x0 > x1
+struct dirty_rect_t
+{
+	uint8_t x0, y0;
+	uint8_t x1, y1;
+};
+
 // The chip8's internals
 struct chip8_t
 {
 	std::array<uint8_t, 4096> ram;		// 4kb of RAM
-	std::array<bool, 64 * 32> display;	// display pixels (1 = Pixel on, 0 = Pixel off)
+	display_t display;
 	std::array<uint16_t, 12> stack;		// stack with 12 subroutines
-	uint16_t* stack_ptr;
+	uint8_t stack_ptr;					// Index of the next free stack entry, so chip8_t can be copied as is
 	uint32_t PC;
 	instruction_t inst;					// Currently running opcode
 	registers_t regs;
 	uint8_t status;
-	std::array<bool, 16> keypad;
+	bool hires;							// 128x64 (00FF) rather than 64x32 (00FE)
+	uint8_t planes;						// XO-CHIP FN01: bit N set = draw, clear and scroll plane N
+	uint16_t keypad;					// Bit N set = key N held
 	uint8_t delay_timer;
 	uint8_t sound_timer;
+	uint32_t rng;						// xorshift32 state for CXNN, seeded from config.seed
 	bool draw;
-};
\ No newline at end of file
+	dirty_rect_t dirty;					// Where draw came from, so the frontend can skip the rest
+};
+
+// The DISPLAY_WORDS words of row Y of a plane, bit 63 - X of word X / 64 is pixel X (1 = on)
+inline uint64_t* display_row(display_t& display, const uint32_t plane, const uint32_t Y)
+{
+	return &display[(plane * DISPLAY_HEIGHT + Y) * DISPLAY_WORDS];
+}
+
+inline const uint64_t* display_row(const display_t& display, const uint32_t plane, const uint32_t Y)
+{
+	return &display[(plane * DISPLAY_HEIGHT + Y) * DISPLAY_WORDS];
+}
+
+inline uint64_t* display_row(chip8_t& chip8, const uint32_t plane, const uint32_t Y)
+{
+	return display_row(chip8.display, plane, Y);
+}
+
+inline const uint64_t* display_row(const chip8_t& chip8, const uint32_t plane, const uint32_t Y)
+{
+	return display_row(chip8.display, plane, Y);
+}
+
+// Size of the current mode
+inline uint32_t display_width(const chip8_t& chip8)
+{
+	return chip8.hires ? hires_t::width : lores_t::width;
+}
+
+inline uint32_t display_height(const chip8_t& chip8)
+{
+	return chip8.hires ? hires_t::height : lores_t::height;
+}
+
+// Pixel X, Y of the current mode: bit N set = on in plane N
+inline uint8_t display_pixel(const chip8_t& chip8, const uint32_t X, const uint32_t Y)
+{
+	uint8_t pixel = 0;
+	for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+	{
+		pixel |= ((display_row(chip8, plane, Y)[X / 64] >> (63 - X % 64)) & 1) << plane;
+	}
+
+	return pixel;
+}
+
+inline void mark_dirty(chip8_t& chip8, const uint8_t x0, const uint8_t y0, const uint8_t x1, const uint8_t y1)
+{
+	chip8.dirty.x0 = std::min(chip8.dirty.x0, x0);
+	chip8.dirty.y0 = std::min(chip8.dirty.y0, y0);
+	chip8.dirty.x1 = std::max(chip8.dirty.x1, x1);
+	chip8.dirty.y1 = std::max(chip8.dirty.y1, y1);
+	chip8.draw = true;
+}
+
+// The whole screen of the current mode
+inline void mark_all_dirty(chip8_t& chip8)
+{
+	mark_dirty(chip8, 0, 0, display_width(chip8) - 1, display_height(chip8) - 1);
+}
+
+inline void clear_dirty(chip8_t& chip8)
+{
+	chip8.dirty = { DISPLAY_WIDTH, DISPLAY_HEIGHT, 0, 0 };
+	chip8.draw = false;
+}
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+
+// Work-stealing pool for running many independent jobs (one chip8_t each) across all cores.
+// Every worker owns a deque of job indices: it pops from the back of its own and, once that is
+// empty, steals from the front of the others. Jobs are handed out round robin up front
+
+#include <stdint.h>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+struct worker_queue_t
+{
+	std::mutex lock;
+	std::deque<size_t> jobs;
+};
+
+bool pop_job(worker_queue_t& queue, size_t& job)
+{
+	std::lock_guard<std::mutex> guard(queue.lock);
+	if (queue.jobs.empty())
+		return false;
+
+	job = queue.jobs.back();
+	queue.jobs.pop_back();
+	return true;
+}
+
+bool steal_job(worker_queue_t& queue, size_t& job)
+{
+	std::lock_guard<std::mutex> guard(queue.lock);
+	if (queue.jobs.empty())
+		return false;
+
+	job = queue.jobs.front();
+	queue.jobs.pop_front();
+	return true;
+}
+
+// Run job(index, worker) for every index in [0, job_count) on thread_count threads (0 = one per core)
+void run_parallel(const size_t job_count, uint32_t thread_count, const std::function<void(size_t, uint32_t)>& job)
+{
+	if (thread_count == 0)
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector<worker_queue_t> queues(thread_count);
+	for (size_t i = 0; i < job_count; i++)
+	{
+		queues[i % thread_count].jobs.push_back(i);
+	}
+
+	auto worker = [&](const uint32_t id)
+	{
+		size_t index;
+		for (;;)
+		{
+			bool found = pop_job(queues[id], index);
+
+			for (uint32_t i = 1; !found && i < thread_count; i++)
+			{
+				found = steal_job(queues[(id + i) % thread_count], index);
+			}
+
+			// Nothing is ever added once started, so every queue being empty means we are done
+			if (!found)
+				return;
+
+			job(index, id);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (uint32_t id = 1; id < thread_count; id++)
+	{
+		threads.emplace_back(worker, id);
+	}
+
+	worker(0);
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
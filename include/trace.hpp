@@ -0,0 +1,153 @@
+#pragma once
+
+// Opcode trace: a fixed-size binary record per opcode run, kept in a preallocated ring so only the
+// most recent ones are held and tracing never allocates or prints while running.
+// Tracing is switched on at runtime (--trace FILE, or F7 in the window) and the ring is written to
+// a file when it stops. chip8-trace (src/trace_dump.cpp) turns the file back into text.
+//
+// File layout (little endian):
+//   "C8TR" | u16 version | u64 opcodes traced in total | u32 records kept
+//   records, oldest first: u16 PC | u16 opcode | u16 I | u8 VX | u8 VY | u8 stack_ptr | u8 key
+//                          | u8 VX after | u8 VF after
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "structs.hpp"
+#include "snapshot.hpp"
+
+
+const uint16_t TRACE_VERSION = 1;
+const uint32_t TRACE_RECORD_SIZE = 12;
+
+// Registers are as they were before the opcode ran, except the two it is most likely to change
+struct trace_record_t
+{
+	uint16_t PC;
+	uint16_t opcode;
+	uint16_t I;
+	uint8_t VX;
+	uint8_t VY;
+	uint8_t stack_ptr;
+	uint8_t key;			// keypad[VX & 0xF], for EX9E/EXA1
+	uint8_t VX_after;
+	uint8_t VF_after;
+};
+
+struct trace_t
+{
+	std::vector<trace_record_t> records;
+	uint64_t count;			// Records ever written, the newest is at (count - 1) % records.size()
+	bool enabled;
+};
+
+
+void init_trace(trace_t& trace, const uint32_t size)
+{
+	trace.records.assign(std::max(1u, size), {});
+	trace.count = 0;
+	trace.enabled = false;
+}
+
+// Fill in everything known before the opcode runs, finish_trace_record does the rest
+trace_record_t& begin_trace_record(trace_t& trace, const chip8_t& chip8, const instruction_t& inst)
+{
+	trace_record_t& record = trace.records[trace.count % trace.records.size()];
+	trace.count++;
+
+	record.PC = chip8.PC;
+	record.opcode = inst.opcode;
+	record.I = chip8.regs.I;
+	record.VX = chip8.regs.V[inst.X];
+	record.VY = chip8.regs.V[inst.Y];
+	record.stack_ptr = chip8.stack_ptr;
+	record.key = (chip8.keypad >> (chip8.regs.V[inst.X] & 0xF)) & 1;
+
+	return record;
+}
+
+void finish_trace_record(trace_record_t& record, const chip8_t& chip8, const instruction_t& inst)
+{
+	record.VX_after = chip8.regs.V[inst.X];
+	record.VF_after = chip8.regs.V[0xF];
+}
+
+bool write_trace_file(const char* path, const trace_t& trace)
+{
+	const uint64_t kept = std::min<uint64_t>(trace.count, trace.records.size());
+
+	std::vector<uint8_t> out;
+	out.reserve(20 + kept * TRACE_RECORD_SIZE);
+	out.insert(out.end(), { 'C', '8', 'T', 'R' });
+	put_u16(out, TRACE_VERSION);
+	put_u64(out, trace.count);
+	put_u32(out, kept);
+
+	for (uint64_t i = trace.count - kept; i < trace.count; i++)
+	{
+		const trace_record_t& record = trace.records[i % trace.records.size()];
+		put_u16(out, record.PC);
+		put_u16(out, record.opcode);
+		put_u16(out, record.I);
+		put_u8(out, record.VX);
+		put_u8(out, record.VY);
+		put_u8(out, record.stack_ptr);
+		put_u8(out, record.key);
+		put_u8(out, record.VX_after);
+		put_u8(out, record.VF_after);
+	}
+
+	if (!write_state_file(path, out))
+		return false;
+
+	printf("Wrote %llu trace records to %s\n", (long long unsigned)kept, path);
+	return true;
+}
+
+// Records oldest first, and how many opcodes were traced in total (more than were kept if the ring wrapped)
+bool read_trace_file(const char* path, std::vector<trace_record_t>& records, uint64_t& count)
+{
+	std::vector<uint8_t> data;
+	if (!read_state_file(path, data))
+		return false;
+
+	state_reader_t in = { data.data(), data.size(), 0, true };
+	if (data.size() < 4 || data[0] != 'C' || data[1] != '8' || data[2] != 'T' || data[3] != 'R')
+	{
+		printf("%s is not a CHIP8 trace\n", path);
+		return false;
+	}
+	in.pos = 4;
+
+	const uint16_t version = get_u16(in);
+	if (version != TRACE_VERSION)
+	{
+		printf("Trace version %u is not supported (expected %u)\n", version, TRACE_VERSION);
+		return false;
+	}
+
+	count = get_u64(in);
+	const uint32_t kept = get_u32(in);
+	if (!in.ok || in.size - in.pos != (uint64_t)kept * TRACE_RECORD_SIZE)
+	{
+		printf("Trace %s is truncated or corrupt\n", path);
+		return false;
+	}
+
+	records.resize(kept);
+	for (trace_record_t& record : records)
+	{
+		record.PC = get_u16(in);
+		record.opcode = get_u16(in);
+		record.I = get_u16(in);
+		record.VX = get_u8(in);
+		record.VY = get_u8(in);
+		record.stack_ptr = get_u8(in);
+		record.key = get_u8(in);
+		record.VX_after = get_u8(in);
+		record.VF_after = get_u8(in);
+	}
+
+	return true;
+}
\ No newline at end of file
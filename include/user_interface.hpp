@@ -1,48 +1,216 @@
 #pragma once
 
+// SFML frontend for the core in CHIP8.hpp. It runs on the main thread and talks to the emulation
+// thread only through frame_handoff.hpp
 
-void clear_screen(sfml_t& sfml, const config_t& config)
+#include <string.h>
+#include <array>
+#include <algorithm>
+#include <bit>
+#include <SFML/Graphics.hpp>
+#include <SFML/Audio.hpp>
+
+#include "structs.hpp"
+#include "frame_handoff.hpp"
+#include "audio.hpp"
+
+
+// sfml variables
+struct sfml_t
+{
+	sf::RenderWindow window;
+	beeper_t beeper;
+
+	// The display is expanded into a 128x64 RGBA texture and drawn as one scaled sprite.
+	// Lores shows only the top-left 64x32 of it, where the core draws in lores
+	sf::Texture texture;
+	sf::Sprite sprite;
+	bool hires;														// Mode the sprite is set up for
+	std::array<uint32_t, DISPLAY_WIDTH * DISPLAY_HEIGHT> pixels;	// Staging for the region being uploaded
+	display_t presented;											// Display words as they are in the texture
+	std::array<uint32_t, 1 << DISPLAY_PLANES> palette;				// Per plane bits, config colors in texture byte order (R, G, B, A)
+	sf::Color bg;
+	std::array<int8_t, sf::Keyboard::KeyCount> keymap;				// CHIP-8 key for each keyboard key, -1 if none
+
+	host_input_t input;			// Keys and hotkeys for the emulation thread
+	triple_buffer_t frames;		// Screens from the emulation thread
+};
+
+
+// 0xRRGGBBAA config color to the R, G, B, A bytes sf::Texture expects
+uint32_t color_to_rgba(const uint32_t color)
+{
+	const uint8_t bytes[4] =
+	{
+		(uint8_t)((color >> 24) & 0xFF),
+		(uint8_t)((color >> 16) & 0xFF),
+		(uint8_t)((color >> 8) & 0xFF),
+		(uint8_t)((color) & 0xFF)
+	};
+
+	uint32_t rgba;
+	memcpy(&rgba, bytes, sizeof(rgba));
+	return rgba;
+}
+
+// Show the part of the texture the mode uses, scaled to the window
+void set_sprite_mode(sfml_t& sfml, const bool hires)
 {
-	const uint8_t bg_r = (config.bg_color >> 24) & 0xFF;
-	const uint8_t bg_g = (config.bg_color >> 16) & 0xFF;
-	const uint8_t bg_b = (config.bg_color >> 8) & 0xFF;
-	const uint8_t bg_a = (config.bg_color) & 0xFF;
+	const uint32_t width = hires ? hires_t::width : lores_t::width;
+	const uint32_t height = hires ? hires_t::height : lores_t::height;
+	const sf::Vector2u window = sfml.window.getSize();
 
-	sfml.window.clear(sf::Color(bg_r, bg_g, bg_b, bg_a));
+	sfml.hires = hires;
+	sfml.sprite.setTextureRect(sf::IntRect(0, 0, width, height));
+	sfml.sprite.setScale((float)window.x / width, (float)window.y / height);
+}
+
+bool init_sfml(sfml_t& sfml, const config_t& config)
+{
+	uint16_t width = config.screen_width * config.scale_factor;
+	uint16_t height = config.screen_height * config.scale_factor;
+
+	sfml.window.create(sf::VideoMode(width, height), "CHIP-8");
+
+	init_host_input(sfml.input);
+	init_triple_buffer(sfml.frames);
+	init_beeper(sfml.beeper, config);
+
+	// config.keymap names the keyboard key for each CHIP-8 key, letters and digits only
+	sfml.keymap.fill(-1);
+	for (int8_t key = 0; key < 16; key++)
+	{
+		const char c = config.keymap[key];
+		if (c >= 'A' && c <= 'Z')
+			sfml.keymap[sf::Keyboard::A + (c - 'A')] = key;
+		else if (c >= '0' && c <= '9')
+			sfml.keymap[sf::Keyboard::Num0 + (c - '0')] = key;
+	}
+
+	if (!sfml.texture.create(DISPLAY_WIDTH, DISPLAY_HEIGHT))
+	{
+		printf("Could not create the display texture\n");
+		return false;
+	}
+
+	// Start the texture all background so later frames only need to upload what changed
+	sfml.pixels.fill(color_to_rgba(config.bg_color));
+	sfml.texture.update((const sf::Uint8*)sfml.pixels.data());
+	sfml.presented.fill(0);
+
+	sfml.sprite.setTexture(sfml.texture, true);
+	set_sprite_mode(sfml, false);
+
+	sfml.palette = { color_to_rgba(config.bg_color), color_to_rgba(config.fg_color),
+		color_to_rgba(config.plane2_color), color_to_rgba(config.overlap_color) };
+	sfml.bg = sf::Color((config.bg_color >> 24) & 0xFF, (config.bg_color >> 16) & 0xFF, (config.bg_color >> 8) & 0xFF, config.bg_color & 0xFF);
+
+	sfml.window.clear(sfml.bg);
+	sfml.window.draw(sfml.sprite);
 	sfml.window.display();
+
+	return true;
 }
 
-void update_screen(sfml_t& sfml, const config_t& config, chip8_t& chip8)
+// Expand the display rectangle at (x, y) of width x height into a tightly packed block of RGBA pixels,
+// one palette word per pixel picked by its plane bits
+void expand_framebuffer(const display_t& display, uint32_t* pixels, const uint32_t* palette,
+	const uint32_t x, const uint32_t y, const uint32_t width, const uint32_t height)
 {
-	const uint8_t bg_r = (config.bg_color >> 24) & 0xFF;
-	const uint8_t bg_g = (config.bg_color >> 16) & 0xFF;
-	const uint8_t bg_b = (config.bg_color >> 8) & 0xFF;
-	const uint8_t bg_a = (config.bg_color) & 0xFF;
+	for (uint32_t Y = 0; Y < height; Y++)
+	{
+		const uint64_t* planes[DISPLAY_PLANES];
+		for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+		{
+			planes[plane] = display_row(display, plane, y + Y);
+		}
 
-	sfml.window.clear(sf::Color(bg_r, bg_g, bg_b, bg_a));
+		uint32_t* out = &pixels[Y * width];
+		for (uint32_t X = 0; X < width; X++)
+		{
+			const uint32_t column = x + X;
+			uint32_t index = 0;
+			for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+			{
+				index |= ((planes[plane][column / 64] >> (63 - column % 64)) & 1) << plane;
+			}
+			out[X] = palette[index];
+		}
+	}
+}
+
+// Only the pixels that changed since the last present are expanded and uploaded, using the frame's
+// dirty rectangle to limit which rows are compared. If nothing changed (e.g. a sprite drawn and
+// erased again in the same frame) the frame is not presented at all.
+// Texture pixel (x, y) is display bit (x, y) in either mode, so a mode switch only moves the sprite's view
+void update_screen(sfml_t& sfml, const frame_t& frame)
+{
+	const dirty_rect_t dirty = frame.dirty;
 
-	const uint8_t fg_r = (config.fg_color >> 24) & 0xFF;
-	const uint8_t fg_g = (config.fg_color >> 16) & 0xFF;
-	const uint8_t fg_b = (config.fg_color >> 8) & 0xFF;
-	const uint8_t fg_a = (config.fg_color) & 0xFF;
+	if (sfml.hires != frame.hires)
+		set_sprite_mode(sfml, frame.hires);
 
-	sf::RectangleShape pixel(sf::Vector2f(config.scale_factor, config.scale_factor));
-	pixel.setFillColor(sf::Color(fg_r, fg_g, fg_b, fg_a));
+	if (dirty.x0 > dirty.x1)
+		return;
 
+	const uint32_t words = frame.hires ? hires_t::words : lores_t::words;
+	std::array<uint64_t, DISPLAY_WORDS> changed_columns = {};
+	uint32_t first_row = DISPLAY_HEIGHT;
+	uint32_t last_row = 0;
 
-	for (int X = 0; X < config.screen_width; X++)
+	for (uint32_t Y = dirty.y0; Y <= std::min<uint32_t>(dirty.y1, (frame.hires ? hires_t::height : lores_t::height) - 1); Y++)
 	{
-		for (int Y = 0; Y < config.screen_height; Y++)
+		uint64_t row_changed = 0;
+		for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
 		{
-			if (chip8.display[Y * config.screen_width + X] == true)
+			const uint32_t at = (plane * DISPLAY_HEIGHT + Y) * DISPLAY_WORDS;
+			for (uint32_t word = 0; word < words; word++)
 			{
-				pixel.setPosition(X * config.scale_factor, Y * config.scale_factor);
-				sfml.window.draw(pixel);
+				const uint64_t changed = frame.display[at + word] ^ sfml.presented[at + word];
+				changed_columns[word] |= changed;
+				row_changed |= changed;
 			}
 		}
+
+		if (row_changed)
+		{
+			first_row = std::min(first_row, Y);
+			last_row = Y;
+		}
 	}
 
+	if (first_row > last_row)
+		return;
+
+	// Leftmost and rightmost changed pixel across the row's words
+	uint32_t x = DISPLAY_WIDTH;
+	uint32_t x_end = 0;
+	for (uint32_t word = 0; word < words; word++)
+	{
+		if (!changed_columns[word])
+			continue;
+
+		x = std::min<uint32_t>(x, word * 64 + std::countl_zero(changed_columns[word]));
+		x_end = word * 64 + 64 - std::countr_zero(changed_columns[word]);
+	}
+
+	const uint32_t width = x_end - x;
+	const uint32_t height = last_row - first_row + 1;
+
+	expand_framebuffer(frame.display, sfml.pixels.data(), sfml.palette.data(), x, first_row, width, height);
+	sfml.texture.update((const sf::Uint8*)sfml.pixels.data(), width, height, x, first_row);
+
+	for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+	{
+		for (uint32_t Y = first_row; Y <= last_row; Y++)
+		{
+			const uint32_t at = (plane * DISPLAY_HEIGHT + Y) * DISPLAY_WORDS;
+			std::copy_n(&frame.display[at], words, &sfml.presented[at]);
+		}
+	}
 
+	sfml.window.clear(sfml.bg);
+	sfml.window.draw(sfml.sprite);
 	sfml.window.display();
 }
 
@@ -58,7 +226,7 @@ void update_screen(sfml_t& sfml, const config_t& config, chip8_t& chip8)
 *	A0BF		ZXCV
 */
 
-void user_input(sfml_t& sfml, chip8_t& chip8)
+void user_input(sfml_t& sfml)
 {
 	sf::Event event;
 	while (sfml.window.pollEvent(event))
@@ -81,60 +249,45 @@ void user_input(sfml_t& sfml, chip8_t& chip8)
 				break;
 
 			case sf::Keyboard::Space:
-				chip8.status = PAUSE;
+				sfml.input.pause = true;
 				break;
 
-				/* Map qwerty keys to CHIP8 keypad */
-			case sf::Keyboard::Num1: chip8.keypad[0x1] = true; break;
-			case sf::Keyboard::Num2: chip8.keypad[0x2] = true; break;
-			case sf::Keyboard::Num3: chip8.keypad[0x3] = true; break;
-			case sf::Keyboard::Num4: chip8.keypad[0xC] = true; break;
+			case sf::Keyboard::F5:
+				sfml.input.quick_save = true;
+				break;
 
-			case sf::Keyboard::Q:	 chip8.keypad[0x4] = true; break;
-			case sf::Keyboard::W:	 chip8.keypad[0x5] = true; break;
-			case sf::Keyboard::E:	 chip8.keypad[0x6] = true; break;
-			case sf::Keyboard::R:	 chip8.keypad[0xD] = true; break;
+			case sf::Keyboard::F7:
+				sfml.input.toggle_trace = true;
+				break;
 
-			case sf::Keyboard::A:	 chip8.keypad[0x7] = true; break;
-			case sf::Keyboard::S:	 chip8.keypad[0x8] = true; break;
-			case sf::Keyboard::D:	 chip8.keypad[0x9] = true; break;
-			case sf::Keyboard::F:	 chip8.keypad[0xE] = true; break;
+			case sf::Keyboard::F8:
+				sfml.input.profile_report = true;
+				break;
 
-			case sf::Keyboard::Z:	 chip8.keypad[0xA] = true; break;
-			case sf::Keyboard::X:	 chip8.keypad[0x0] = true; break;
-			case sf::Keyboard::C:	 chip8.keypad[0xB] = true; break;
-			case sf::Keyboard::V:	 chip8.keypad[0xF] = true; break;
+			case sf::Keyboard::F9:
+				sfml.input.quick_load = true;
+				break;
+
+			case sf::Keyboard::BackSpace:
+				sfml.input.rewinding = true;
+				break;
 
 			default:
+				if (event.key.code >= 0 && event.key.code < sf::Keyboard::KeyCount && sfml.keymap[event.key.code] >= 0)
+					sfml.input.keypad.fetch_or(1 << sfml.keymap[event.key.code], std::memory_order_relaxed);
 				break;
 			}
 
+			break;
+
 		case sf::Event::KeyReleased:
 			switch (event.key.code)
 			{
-
-				/* Map qwerty keys to CHIP8 keypad */
-			case sf::Keyboard::Num1: chip8.keypad[0x1] = false; break;
-			case sf::Keyboard::Num2: chip8.keypad[0x2] = false; break;
-			case sf::Keyboard::Num3: chip8.keypad[0x3] = false; break;
-			case sf::Keyboard::Num4: chip8.keypad[0xC] = false; break;
-
-			case sf::Keyboard::Q:	 chip8.keypad[0x4] = false; break;
-			case sf::Keyboard::W:	 chip8.keypad[0x5] = false; break;
-			case sf::Keyboard::E:	 chip8.keypad[0x6] = false; break;
-			case sf::Keyboard::R:	 chip8.keypad[0xD] = false; break;
-
-			case sf::Keyboard::A:	 chip8.keypad[0x7] = false; break;
-			case sf::Keyboard::S:	 chip8.keypad[0x8] = false; break;
-			case sf::Keyboard::D:	 chip8.keypad[0x9] = false; break;
-			case sf::Keyboard::F:	 chip8.keypad[0xE] = false; break;
-
-			case sf::Keyboard::Z:	 chip8.keypad[0xA] = false; break;
-			case sf::Keyboard::X:	 chip8.keypad[0x0] = false; break;
-			case sf::Keyboard::C:	 chip8.keypad[0xB] = false; break;
-			case sf::Keyboard::V:	 chip8.keypad[0xF] = false; break;
+			case sf::Keyboard::BackSpace: sfml.input.rewinding = false; break;
 
 			default:
+				if (event.key.code >= 0 && event.key.code < sf::Keyboard::KeyCount && sfml.keymap[event.key.code] >= 0)
+					sfml.input.keypad.fetch_and(~(1 << sfml.keymap[event.key.code]), std::memory_order_relaxed);
 				break;
 			}
 
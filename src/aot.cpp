@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <string>
+
+#include <CHIP8.hpp>
+#include <control_flow.hpp>
+#include <mapped_file.hpp>
+
+
+// chip8-aot: compile a ROM ahead of time into a C++ program that runs it headless like chip8-batch,
+// with every block control_flow.hpp can find as a function of its own (see aot.hpp).
+//
+//   chip8-aot [--quirks vip/chip48/schip/xochip] ROM OUT.cpp
+//
+// Build OUT.cpp on its own with include/ on the include path, in C++20. The ROM is compiled in,
+// the program doesn't need the file
+
+
+// The handler call run_single_opcode_table would make for inst with profile quirks, empty for op_unknown
+std::string handler_call(const instruction_t& inst, const uint8_t quirks)
+{
+	const uint8_t kind = opcode_kind(inst);
+	const bool hires = with_quirks(quirks, []<typename Q>() { return Q::hires; });
+	const bool bitplanes = with_quirks(quirks, []<typename Q>() { return Q::bitplanes; });
+
+	switch (kind)
+	{
+	case OP_UNKNOWN:
+		return "";
+
+	case OP_00CN: case OP_00FB: case OP_00FC: case OP_00FE: case OP_00FF:
+		if (!hires)
+			return "";
+		break;
+
+	case OP_00DN: case OP_FN01:
+		if (!bitplanes)
+			return "";
+		break;
+	}
+
+	// The handlers in opcodes.hpp that are templated on the profile
+	bool templated = false;
+	switch (kind)
+	{
+	case OP_00CN: case OP_00DN: case OP_00FB: case OP_00FC:
+	case OP_8XY1: case OP_8XY2: case OP_8XY3: case OP_8XY6: case OP_8XYE:
+	case OP_BNNN: case OP_DXYN: case OP_FX55: case OP_FX65:
+		templated = true;
+		break;
+	}
+
+	char call[80];
+	snprintf(call, sizeof(call), "op_%s%s(chip8, config, aot_inst<0x%04X>);", OPCODE_NAMES[kind], templated ? "<Q>" : "", inst.opcode);
+	return call;
+}
+
+// One block as a function taking an opcode to start at and one to stop before. Only the opcodes that
+// branch read PC, so it is only set before those and when leaving
+void write_block(FILE* out, const chip8_t& chip8, const code_block_t& block, const uint8_t quirks)
+{
+	const uint32_t ops = (block.end - block.start) / 2;
+
+	fprintf(out, "static uint32_t block_%03X(chip8_t& chip8, const config_t& config, aot_t& aot, const uint32_t entry, const uint32_t stop)\n{\n", block.start);
+	fprintf(out, "\tswitch (entry)\n\t{\n");
+
+	for (uint32_t index = 0; index < ops; index++)
+	{
+		const uint32_t addr = block.start + index * 2;
+		const instruction_t inst = decode_instruction((chip8.ram[addr] << 8) | chip8.ram[addr + 1]);
+		const std::string call = handler_call(inst, quirks);
+		const bool last = index + 1 == ops;
+
+		fprintf(out, "\tcase %u:\t\t// 0x%03X: %04X\n", index, addr, inst.opcode);
+
+		if (last && ends_block(inst))
+		{
+			fprintf(out, "\t\tchip8.PC = 0x%03X;\n", addr + 2);
+			if (!call.empty())
+				fprintf(out, "\t\t%s\n", call.c_str());
+		}
+		else if (last && writes_ram(inst))
+		{
+			fprintf(out, "\t\t{\n");
+			fprintf(out, "\t\t\tconst uint32_t lo = chip8.regs.I & 0xFFF;\n");
+			fprintf(out, "\t\t\t%s\n", call.c_str());
+			fprintf(out, "\t\t\tchip8.PC = 0x%03X;\n", addr + 2);
+			fprintf(out, "\t\t\taot_stored(aot, chip8, lo, lo + %u);\n", inst.NN == 0x33 ? 2 : inst.X);
+			fprintf(out, "\t\t}\n");
+		}
+		else
+		{
+			if (!call.empty())
+				fprintf(out, "\t\t%s\n", call.c_str());
+			if (!last)
+				fprintf(out, "\t\tif (stop == %u) { chip8.PC = 0x%03X; return %u - entry; }\n\t\t[[fallthrough]];\n", index + 1, addr + 2, index + 1);
+			else
+				fprintf(out, "\t\tchip8.PC = 0x%03X;\n", addr + 2);
+		}
+	}
+
+	fprintf(out, "\t}\n\n\treturn %u - entry;\n}\n\n", ops);
+}
+
+// A string literal for text
+std::string quoted(const char* text)
+{
+	std::string literal = "\"";
+	for (; *text; text++)
+	{
+		if (*text == '\\' || *text == '"')
+			literal += '\\';
+		literal += *text;
+	}
+
+	return literal + "\"";
+}
+
+bool write_program(const char* path, const char* rom_name, const chip8_t& chip8, const size_t rom_size, const control_flow_t& flow, const uint8_t quirks)
+{
+	FILE* out = open_file(path, "w");
+	if (out == nullptr)
+	{
+		printf("Could not write %s\n", path);
+		return false;
+	}
+
+	fprintf(out, "// Compiled from %s (--quirks %s) by chip8-aot. Do not edit, run chip8-aot again\n\n", rom_name, QUIRKS_NAMES[quirks]);
+	fprintf(out, "#include <aot.hpp>\n\n\n");
+	fprintf(out, "typedef quirks_%s_t Q;\n\n", QUIRKS_NAMES[quirks]);
+
+	fprintf(out, "static const uint8_t ROM_IMAGE[%zu] =\n{", std::max<size_t>(rom_size, 1));
+	for (size_t byte = 0; byte < rom_size; byte++)
+	{
+		fprintf(out, "%s0x%02X,", byte % 16 ? " " : "\n\t", chip8.ram[0x200 + byte]);
+	}
+	fprintf(out, "\n};\n\n");
+
+	for (const code_block_t& block : flow.blocks)
+	{
+		write_block(out, chip8, block, quirks);
+	}
+
+	fprintf(out, "static const aot_block_info_t BLOCKS[] =\n{\n");
+	for (const code_block_t& block : flow.blocks)
+	{
+		fprintf(out, "\t{ 0x%03X, %u, block_%03X },\n", block.start, (block.end - block.start) / 2, block.start);
+	}
+	if (flow.blocks.empty())
+		fprintf(out, "\t{ 0, 0, nullptr },\n");
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "int main(int argc, char* argv[])\n{\n");
+	fprintf(out, "\tconst aot_program_t program = { %s, %u, ROM_IMAGE, %zu, BLOCKS, %zu };\n",
+		quoted(rom_name).c_str(), quirks, rom_size, flow.blocks.size());
+	fprintf(out, "\treturn aot_main(program, argc, argv);\n}\n");
+
+	fclose(out);
+	return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+	uint8_t quirks = QUIRKS_VIP;
+	const char* paths[2] = { nullptr, nullptr };
+	uint32_t given = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+
+		if (arg == "--quirks" && i + 1 < argc)
+		{
+			quirks = parse_quirks(argv[++i]);
+			if (quirks == QUIRKS_COUNT)
+			{
+				printf("Unknown --quirks %s, expected vip, chip48, schip or xochip\n", argv[i]);
+				return -1;
+			}
+		}
+		else if (given < 2)
+			paths[given++] = argv[i];
+	}
+
+	if (given < 2)
+	{
+		printf("Usage: chip8-aot [--quirks vip/chip48/schip/xochip] ROM OUT.cpp\n");
+		return -1;
+	}
+
+	char name[] = "chip8-aot";
+	char* defaults[] = { name };
+	config_t config{ 0 };
+	init_config(config, 1, defaults);
+	config.rom_name = paths[0];
+	config.quirks = quirks;
+
+	// Load it the way the program will, to analyse the RAM it starts from
+	mapped_file_t rom;
+	if (!map_file(paths[0], rom))
+	{
+		printf("Rom file %s is invalid or does not exist\n", paths[0]);
+		return -1;
+	}
+
+	chip8_t* chip8 = new chip8_t;
+	const bool loaded = init_chip8(*chip8, config, rom.data, rom.size);
+	const size_t rom_size = rom.size;
+	unmap_file(rom);
+
+	if (!loaded)
+	{
+		delete chip8;
+		return -1;
+	}
+
+	control_flow_t* flow = new control_flow_t;
+	analyse_control_flow(*flow, chip8->ram.data(), rom_size);
+
+	const bool written = write_program(paths[1], paths[0], *chip8, rom_size, *flow, quirks);
+	if (written)
+	{
+		uint32_t ops = 0;
+		for (const code_block_t& block : flow->blocks)
+		{
+			ops += (block.end - block.start) / 2;
+		}
+
+		printf("%s: %zu blocks, %u opcodes of %zu ROM bytes compiled to %s\n",
+			paths[0], flow->blocks.size(), ops, rom_size, paths[1]);
+	}
+
+	delete flow;
+	delete chip8;
+
+	return written ? 0 : -1;
+}
\ No newline at end of file
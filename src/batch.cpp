@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <CHIP8.hpp>
+#include <headless.hpp>
+#include <batch.hpp>
+#include <lockstep.hpp>
+#include <thread_pool.hpp>
+
+
+// chip8-batch: run many ROM/seed jobs headless on every core for a fixed cycle budget and print
+// the final framebuffer hash and registers of each one, for regression sweeps and fuzzing.
+//
+//   chip8-batch [--threads N] [--seeds N] [--cycles N] [--dispatch ...] [--lockstep] (--jobs FILE | --rom ROM ...)
+//
+// A jobs file has one job per line: <rom> [seed] [cycles], # starts a comment.
+// Each --rom runs with seeds 0 to --seeds - 1.
+// --lockstep runs jobs with the same ROM and cycle budget LOCKSTEP_LANES at a time on the lockstep
+// engine (lockstep.hpp) instead of one by one, with the same results
+
+bool read_jobs(const char* path, const uint64_t default_cycles, std::vector<batch_job_t>& jobs)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		printf("Could not open jobs file %s\n", path);
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		line = line.substr(0, line.find('#'));
+
+		std::istringstream fields(line);
+		batch_job_t job{};
+		if (!(fields >> job.rom))
+			continue;
+
+		job.seed = 0;
+		job.cycles = default_cycles;
+		fields >> job.seed >> job.cycles;
+
+		jobs.push_back(job);
+	}
+
+	return true;
+}
+
+void run_job(batch_job_t& job, const config_t& base_config)
+{
+	config_t config = base_config;
+	config.rom_name = job.rom.c_str();
+	config.seed = job.seed;
+	config.max_cycles = job.cycles;
+
+	chip8_t* chip8 = new chip8_t;
+	job.loaded = init_chip8(*chip8, config);
+
+	if (job.loaded)
+	{
+		job.result = run_headless(*chip8, config);
+		job.display_hash = hash_display(*chip8);
+		job.final = *chip8;
+	}
+
+	delete chip8;
+}
+
+// Jobs that can share a lockstep_t: same ROM, same cycle budget, at most LOCKSTEP_LANES of them
+std::vector<std::vector<size_t>> lockstep_units(const std::vector<batch_job_t>& jobs)
+{
+	std::vector<std::vector<size_t>> units;
+	std::map<std::pair<std::string, uint64_t>, size_t> filling;	// Unit still taking jobs for each ROM and budget
+
+	for (size_t index = 0; index < jobs.size(); index++)
+	{
+		const auto key = std::make_pair(jobs[index].rom, jobs[index].cycles);
+		const auto unit = filling.find(key);
+		if (unit == filling.end() || units[unit->second].size() == LOCKSTEP_LANES)
+		{
+			filling[key] = units.size();
+			units.emplace_back();
+		}
+
+		units[filling[key]].push_back(index);
+	}
+
+	return units;
+}
+
+// Every job of a unit as one lane of a lockstep_t. Returns the lane opcodes that ran vectorised
+uint64_t run_lockstep_unit(std::vector<batch_job_t>& jobs, const std::vector<size_t>& unit, const config_t& base_config)
+{
+	config_t config = base_config;
+	config.max_cycles = jobs[unit[0]].cycles;
+
+	std::vector<chip8_t*> lanes;
+	std::vector<size_t> lane_jobs;
+	for (const size_t index : unit)
+	{
+		batch_job_t& job = jobs[index];
+		config.rom_name = job.rom.c_str();
+		config.seed = job.seed;
+
+		chip8_t* chip8 = new chip8_t;
+		job.loaded = init_chip8(*chip8, config);
+
+		if (!job.loaded)
+		{
+			delete chip8;
+			continue;
+		}
+
+		lanes.push_back(chip8);
+		lane_jobs.push_back(index);
+	}
+
+	lockstep_t* ls = new lockstep_t;
+	init_lockstep(*ls, lanes.data(), (uint32_t)lanes.size());
+	run_lockstep(*ls, config);
+
+	for (uint32_t lane = 0; lane < lanes.size(); lane++)
+	{
+		batch_job_t& job = jobs[lane_jobs[lane]];
+		job.result = ls->results[lane];
+		job.display_hash = hash_display(*lanes[lane]);
+		job.final = *lanes[lane];
+		delete lanes[lane];
+	}
+
+	const uint64_t vector_opcodes = ls->vector_opcodes;
+	delete ls;
+
+	return vector_opcodes;
+}
+
+
+void print_usage()
+{
+	printf("Usage: chip8-batch [--threads N] [--seeds N] [--cycles N] [--dispatch switch/table/block/jit] [--lockstep] (--jobs FILE | --rom ROM ...)\n"
+		"--threads: worker threads (default: one per core)\n--seeds: runs of each --rom, seeds 0 to N - 1 (default 1)\n"
+		"--cycles: instructions each job runs unless it halts first\n--jobs: file of jobs, one <rom> [seed] [cycles] per line\n"
+		"--lockstep: run jobs sharing a ROM and budget together on the lockstep engine, with the same output\n"
+		"Also --ips/-cpf, --quirks, --no-idle-skip and --jit-check as for the emulator\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h")
+		{
+			print_usage();
+			return 0;
+		}
+	}
+
+	config_t config{ 0 };
+	if (!init_config(config, argc, argv))	// Shared flags: --cycles, --ips/-cpf, --dispatch
+	{
+		return -1;
+	}
+
+	uint32_t threads = 0;
+	uint32_t seeds = 1;
+	bool lockstep = false;
+	const char* jobs_file = nullptr;
+	std::vector<std::string> roms;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+
+		if (arg == "--threads" && i + 1 < argc)
+			threads = std::stoi(argv[++i]);
+		else if (arg == "--seeds" && i + 1 < argc)
+			seeds = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--jobs" && i + 1 < argc)
+			jobs_file = argv[++i];
+		else if (arg == "--rom" && i + 1 < argc)
+			roms.push_back(argv[++i]);
+		else if (arg == "--lockstep")
+			lockstep = true;
+	}
+
+	std::vector<batch_job_t> jobs;
+	if (jobs_file && !read_jobs(jobs_file, config.max_cycles, jobs))
+	{
+		return -1;
+	}
+
+	for (const std::string& rom : roms)
+	{
+		for (uint32_t seed = 0; seed < seeds; seed++)
+		{
+			batch_job_t job{};
+			job.rom = rom;
+			job.seed = seed;
+			job.cycles = config.max_cycles;
+			jobs.push_back(job);
+		}
+	}
+
+	if (jobs.empty())
+	{
+		print_usage();
+		return -1;
+	}
+
+	decode_table(config.quirks); // Build it once before the workers race for it
+
+	const auto start = std::chrono::steady_clock::now();
+
+	const std::vector<std::vector<size_t>> units = lockstep ? lockstep_units(jobs) : std::vector<std::vector<size_t>>();
+	std::vector<uint64_t> vector_opcodes(units.size(), 0);
+
+	if (lockstep)
+	{
+		run_parallel(units.size(), threads, [&](const size_t index, const uint32_t worker)
+		{
+			vector_opcodes[index] = run_lockstep_unit(jobs, units[index], config);
+		});
+	}
+	else
+	{
+		run_parallel(jobs.size(), threads, [&](const size_t index, const uint32_t worker)
+		{
+			run_job(jobs[index], config);
+		});
+	}
+
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	uint64_t total_cycles = 0;
+	for (const batch_job_t& job : jobs)
+	{
+		print_job(job);
+		total_cycles += job.loaded ? job.result.cycles : 0;
+	}
+
+	fprintf(stderr, "%zu jobs, %llu instructions in %.3fs (%.0f instructions per second)\n",
+		jobs.size(), (long long unsigned)total_cycles, seconds, seconds > 0 ? total_cycles / seconds : 0);
+
+	if (lockstep)
+	{
+		uint64_t vectorised = 0;
+		for (const uint64_t count : vector_opcodes)
+		{
+			vectorised += count;
+		}
+
+		fprintf(stderr, "Lockstep: %zu units of up to %u lanes, %.1f%% of instructions ran vectorised\n",
+			units.size(), LOCKSTEP_LANES, total_cycles ? 100.0 * vectorised / total_cycles : 0);
+	}
+
+	return 0;
+}
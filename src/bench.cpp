@@ -0,0 +1,531 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <CHIP8.hpp>
+#include <headless.hpp>
+#ifndef HEADLESS_ONLY
+#include <user_interface.hpp>
+#endif
+
+
+// chip8-bench: times the core and writes the results as JSON, one result per line, so two builds
+// can be compared. Three groups:
+//   opcode  every case of run_single_opcode, through the switch and the decode table
+//   kernel  DXYN at several heights and positions (including clipping at the edges), 00E0,
+//           expanding the framebuffer, and update_screen (needs a window)
+//   rom     every ROM in --rom-dir run headless for --cycles opcodes with each interpreter. iterations
+//           is that budget; cycles and halt say what ran, a ROM that halts early is flagged
+//
+//   chip8-bench [--out FILE] [--baseline FILE] [--iterations N] [--runs N] [--cycles N]
+//               [--rom-dir DIR] [--filter TEXT] [--no-window]
+//
+// Build it as Release, a DEBUG_ON build traces every opcode
+
+struct bench_result_t
+{
+	std::string group;
+	std::string name;
+	uint64_t iterations;	// Opcodes (or kernel calls) per timed run. For the rom group, the --cycles budget
+	double ns_per_op;		// Best of the runs
+	uint64_t cycles;		// rom group: opcodes the ROM ran, fewer than iterations if it halted
+	const char* halt;		// rom group: why the run stopped, nullptr for the other groups
+};
+
+struct bench_options_t
+{
+	uint64_t iterations;
+	uint32_t runs;
+	std::string rom_dir;
+	std::string filter;
+	bool window;
+};
+
+// One opcode to time on its own, and the state it needs to run again and again
+struct opcode_case_t
+{
+	const char* name;
+	uint16_t opcode;
+	uint8_t stack_ptr;		// 00EE needs something to return to, 2NNN room to call
+};
+
+const opcode_case_t OPCODE_CASES[] =
+{
+	{ "00E0", 0x00E0, 0 }, { "00EE", 0x00EE, 1 }, { "1NNN", 0x1200, 0 }, { "2NNN", 0x2200, 0 },
+	{ "3XNN", 0x3112, 0 }, { "4XNN", 0x4112, 0 }, { "5XY0", 0x5120, 0 }, { "6XNN", 0x6123, 0 },
+	{ "7XNN", 0x7101, 0 }, { "8XY0", 0x8120, 0 }, { "8XY1", 0x8121, 0 }, { "8XY2", 0x8122, 0 },
+	{ "8XY3", 0x8123, 0 }, { "8XY4", 0x8124, 0 }, { "8XY5", 0x8125, 0 }, { "8XY6", 0x8126, 0 },
+	{ "8XY7", 0x8127, 0 }, { "8XYE", 0x812E, 0 }, { "9XY0", 0x9120, 0 }, { "ANNN", 0xA300, 0 },
+	{ "BNNN", 0xB200, 0 }, { "CXNN", 0xC1FF, 0 }, { "DXYN", 0xD125, 0 }, { "EX9E", 0xE19E, 0 },
+	{ "EXA1", 0xE1A1, 0 }, { "FX07", 0xF107, 0 }, { "FX0A", 0xF10A, 0 }, { "FX15", 0xF115, 0 },
+	{ "FX18", 0xF118, 0 }, { "FX1E", 0xF11E, 0 }, { "FX29", 0xF129, 0 }, { "FX33", 0xF133, 0 },
+	{ "FX55", 0xF555, 0 }, { "FX65", 0xF565, 0 },
+};
+
+
+// Best time per call over several runs of body(), in nanoseconds
+template <typename F>
+double time_best(const uint64_t iterations, const uint32_t runs, F&& body)
+{
+	double best = 1e300;
+	for (uint32_t run = 0; run < runs; run++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			body();
+		}
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		best = std::min(best, seconds * 1e9 / iterations);
+	}
+
+	return best;
+}
+
+bool wanted(const bench_options_t& options, const std::string& group, const std::string& name)
+{
+	return options.filter.empty() || (group + "/" + name).find(options.filter) != std::string::npos;
+}
+
+// A chip8 with a font, registers that make every opcode take its common path, and the opcode at 0x200
+void init_bench_chip8(chip8_t& chip8, const uint16_t opcode)
+{
+	chip8 = {};
+	chip8.planes = 1;
+	clear_dirty(chip8);
+	chip8.rng = 0x12345678;
+	chip8.status = RUNNING;
+
+	for (uint8_t i = 0; i < 16; i++)
+	{
+		chip8.regs.V[i] = i * 3 + 1;
+	}
+	chip8.stack.fill(0x200);
+
+	// Sprite data for DXYN, anything with set bits will do
+	for (uint32_t addr = 0; addr < chip8.ram.size(); addr++)
+	{
+		chip8.ram[addr] = (uint8_t)(addr * 37 + 11);
+	}
+
+	chip8.ram[0x200] = opcode >> 8;
+	chip8.ram[0x201] = opcode & 0xFF;
+}
+
+void bench_opcodes(const bench_options_t& options, const config_t& config, std::vector<bench_result_t>& results)
+{
+	const decode_table_t& table = decode_table(config.quirks);
+	const interpreter_t run_switch = switch_interpreter(config.quirks);
+	chip8_t* chip8 = new chip8_t;
+
+	for (const opcode_case_t& test : OPCODE_CASES)
+	{
+		const char* dispatch_names[] = { "switch", "table" };
+		for (uint32_t dispatch = 0; dispatch < 2; dispatch++)
+		{
+			const std::string name = std::string(dispatch_names[dispatch]) + "/" + test.name;
+			if (!wanted(options, "opcode", name))
+				continue;
+
+			init_bench_chip8(*chip8, test.opcode);
+
+			// Put back what the opcode moves so it runs the same way every time.
+			// The same three stores are in every case, so they cancel out when comparing opcodes
+			const double ns = time_best(options.iterations, options.runs, [&]()
+			{
+				chip8->PC = 0x200;
+				chip8->stack_ptr = test.stack_ptr;
+				chip8->regs.I = 0x300;
+
+				if (dispatch == 0)
+					run_switch(*chip8, config);
+				else
+					run_single_opcode_table(*chip8, config, table);
+			});
+
+			results.push_back({ "opcode", name, options.iterations, ns });
+		}
+	}
+
+	delete chip8;
+}
+
+void bench_kernels(const bench_options_t& options, const config_t& config, std::vector<bench_result_t>& results)
+{
+	const decode_table_t& table = decode_table(config.quirks);
+	chip8_t* chip8 = new chip8_t;
+
+	// DXYN: aligned to a byte, straddling two bytes, and clipped at the right/bottom edges
+	struct draw_case_t { const char* where; uint8_t x, y; };
+	const draw_case_t draws[] = { { "aligned", 8, 8 }, { "unaligned", 13, 8 }, { "clipped", 60, 28 } };
+	const uint8_t heights[] = { 1, 5, 15 };
+
+	for (const draw_case_t& draw : draws)
+	{
+		for (const uint8_t height : heights)
+		{
+			const std::string name = "DXYN/" + std::string(draw.where) + "/h" + std::to_string(height);
+			if (!wanted(options, "kernel", name))
+				continue;
+
+			init_bench_chip8(*chip8, 0xD120 | height);
+			chip8->regs.V[1] = draw.x;
+			chip8->regs.V[2] = draw.y;
+			chip8->regs.I = 0x40;
+
+			const decoded_t& decoded = table[0xD120 | height];
+			const double ns = time_best(options.iterations, options.runs, [&]()
+			{
+				decoded.handler(*chip8, config, decoded.inst);
+			});
+
+			results.push_back({ "kernel", name, options.iterations, ns });
+		}
+	}
+
+	if (wanted(options, "kernel", "00E0"))
+	{
+		init_bench_chip8(*chip8, 0x00E0);
+		const decoded_t& decoded = table[0x00E0];
+		const double ns = time_best(options.iterations, options.runs, [&]()
+		{
+			chip8->display[0] ^= 1;	// So the clear has something to do
+			decoded.handler(*chip8, config, decoded.inst);
+		});
+
+		results.push_back({ "kernel", "00E0", options.iterations, ns });
+	}
+
+	// SUPER-CHIP hires: a 16x16 sprite straddling the two words of a row, and the scrolls.
+	// These always use the schip table, the --quirks one may not have them
+	const decode_table_t& hires_table = decode_table(QUIRKS_SCHIP);
+	const uint16_t hires_opcodes[] = { 0xD120, 0x00C4, 0x00FB, 0x00FC };
+	const char* hires_names[] = { "DXY0/hires", "00CN/hires", "00FB/hires", "00FC/hires" };
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		if (!wanted(options, "kernel", hires_names[i]))
+			continue;
+
+		init_bench_chip8(*chip8, hires_opcodes[i]);
+		chip8->hires = true;
+		chip8->regs.V[1] = 57;
+		chip8->regs.V[2] = 20;
+		chip8->regs.I = 0x40;
+
+		const decoded_t& decoded = hires_table[hires_opcodes[i]];
+		const double ns = time_best(options.iterations, options.runs, [&]()
+		{
+			chip8->display[DISPLAY_WORDS * 40] ^= 1;	// Something for the scrolls to move
+			decoded.handler(*chip8, config, decoded.inst);
+		});
+
+		results.push_back({ "kernel", hires_names[i], options.iterations, ns });
+	}
+
+#ifndef HEADLESS_ONLY
+	// Display bits to RGBA for the whole screen, the CPU side of update_screen
+	if (wanted(options, "kernel", "expand_framebuffer"))
+	{
+		init_bench_chip8(*chip8, 0);
+		for (uint32_t row = 0; row < lores_t::height; row++)
+		{
+			display_row(*chip8, 0, row)[0] = 0xF0F0A5A5C3C3FF00ull >> row;
+		}
+
+		const uint32_t palette[4] = { 0xFF000000, 0xFFFFFFFF, 0xFF00FF00, 0xFF00FFFF };
+		std::vector<uint32_t> pixels(lores_t::width * lores_t::height);
+		const uint64_t iterations = std::max<uint64_t>(1, options.iterations / 100);
+		const double ns = time_best(iterations, options.runs, [&]()
+		{
+			expand_framebuffer(chip8->display, pixels.data(), palette, 0, 0, lores_t::width, lores_t::height);
+			chip8->display[0] ^= pixels[5];
+		});
+
+		results.push_back({ "kernel", "expand_framebuffer", iterations, ns });
+	}
+
+	// Includes the window present, so it also measures the driver
+	if (options.window && (wanted(options, "kernel", "update_screen/full") || wanted(options, "kernel", "update_screen/sprite")))
+	{
+		sfml_t* sfml = new sfml_t;
+		if (init_sfml(*sfml, config))
+		{
+			const uint64_t iterations = std::max<uint64_t>(1, options.iterations / 10000);
+			init_bench_chip8(*chip8, 0);
+			frame_t frame;
+
+			// Every pixel changes every frame
+			double ns = time_best(iterations, options.runs, [&]()
+			{
+				for (uint32_t row = 0; row < lores_t::height; row++)
+				{
+					display_row(*chip8, 0, row)[0] = ~display_row(*chip8, 0, row)[0];
+				}
+				mark_all_dirty(*chip8);
+				capture_frame(frame, *chip8);
+				update_screen(*sfml, frame);
+			});
+			results.push_back({ "kernel", "update_screen/full", iterations, ns });
+
+			// One 8x5 sprite moves, the common case
+			ns = time_best(iterations, options.runs, [&]()
+			{
+				display_row(*chip8, 0, 10)[0] ^= 0xFFull << 20;
+				mark_dirty(*chip8, 36, 10, 43, 14);
+				capture_frame(frame, *chip8);
+				update_screen(*sfml, frame);
+			});
+			results.push_back({ "kernel", "update_screen/sprite", iterations, ns });
+
+			sfml->window.close();
+		}
+		delete sfml;
+	}
+#endif
+
+	delete chip8;
+}
+
+void bench_roms(const bench_options_t& options, const config_t& base_config, std::vector<bench_result_t>& results)
+{
+	std::vector<std::string> roms;
+	std::error_code error;
+	for (const auto& entry : std::filesystem::directory_iterator(options.rom_dir, error))
+	{
+		if (entry.is_regular_file() && entry.path().extension() == ".ch8")
+			roms.push_back(entry.path().string());
+	}
+	std::sort(roms.begin(), roms.end());
+
+	if (error)
+		printf("Could not list ROMs in %s\n", options.rom_dir.c_str());
+
+	const char* dispatch_names[] = { "switch", "table", "block", "jit" };
+#ifdef CHIP8_JIT
+	const uint8_t last_dispatch = DISPATCH_JIT;
+#else
+	const uint8_t last_dispatch = DISPATCH_BLOCK;
+#endif
+	for (const std::string& rom : roms)
+	{
+		for (uint8_t dispatch = DISPATCH_SWITCH; dispatch <= last_dispatch; dispatch++)
+		{
+			const std::string name = std::filesystem::path(rom).filename().string() + "/" + dispatch_names[dispatch];
+			if (!wanted(options, "rom", name))
+				continue;
+
+			config_t config = base_config;
+			config.rom_name = rom.c_str();
+			config.dispatch = dispatch;
+			config.seed = 0;
+			config.idle_skip = false;	// Time the interpreter, not how much of the ROM is waiting
+
+			// Best of the runs, each from a fresh boot. A ROM that halts before --cycles is timed over
+			// what it ran, which is mostly startup (and compiling, for the JIT): it is kept but flagged
+			double best = 1e300;
+			uint64_t cycles = 0;
+			uint8_t halt = HALT_NONE;
+			chip8_t* chip8 = new chip8_t;
+			for (uint32_t run = 0; run < options.runs; run++)
+			{
+				if (!init_chip8(*chip8, config))
+					break;
+
+				const headless_result_t result = run_headless(*chip8, config);
+				if (result.cycles > 0)
+				{
+					best = std::min(best, result.seconds * 1e9 / result.cycles);
+					cycles = result.cycles;
+					halt = result.halt;
+				}
+			}
+			delete chip8;
+
+			const char* halt_names[] = { "budget", "stuck", "quit", "replay-end" };
+			if (cycles > 0)
+				results.push_back({ "rom", name, config.max_cycles, best, cycles, halt_names[halt] });
+		}
+	}
+}
+
+
+std::string json_escape(const std::string& text)
+{
+	std::string out;
+	for (const char c : text)
+	{
+		if (c == '"' || c == '\\')
+			out += '\\';
+		out += c;
+	}
+
+	return out;
+}
+
+void write_json(FILE* out, const std::vector<bench_result_t>& results)
+{
+#ifdef DEBUG_ON
+	const bool debug = true;
+#else
+	const bool debug = false;
+#endif
+
+	fprintf(out, "{\n\"debug\": %s,\n\"results\": [\n", debug ? "true" : "false");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const bench_result_t& result = results[i];
+		char halt[64] = "";
+		if (result.halt)
+			snprintf(halt, sizeof(halt), ", \"cycles\": %llu, \"halt\": \"%s\"", (long long unsigned)result.cycles, result.halt);
+
+		fprintf(out, "{\"group\": \"%s\", \"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.4f, \"ops_per_second\": %.0f%s}%s\n",
+			result.group.c_str(),
+			json_escape(result.name).c_str(),
+			(long long unsigned)result.iterations,
+			result.ns_per_op,
+			result.ns_per_op > 0 ? 1e9 / result.ns_per_op : 0,
+			halt,
+			i + 1 < results.size() ? "," : "");
+	}
+	fprintf(out, "]\n}\n");
+}
+
+// Reads ns_per_op back out of a file write_json wrote, keyed by group/name
+bool read_baseline(const char* path, std::map<std::string, double>& baseline)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		printf("Could not open baseline %s\n", path);
+		return false;
+	}
+
+	auto field = [](const std::string& line, const std::string& key) -> std::string
+	{
+		const size_t at = line.find("\"" + key + "\": ");
+		if (at == std::string::npos)
+			return "";
+
+		size_t start = at + key.size() + 4;
+		if (line[start] == '"')
+			return line.substr(start + 1, line.find('"', start + 1) - start - 1);
+
+		return line.substr(start, line.find_first_of(",}", start) - start);
+	};
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		const std::string group = field(line, "group");
+		const std::string ns = field(line, "ns_per_op");
+		if (!group.empty() && !ns.empty())
+			baseline[group + "/" + field(line, "name")] = std::stod(ns);
+	}
+
+	return true;
+}
+
+// Table of every result that is in both runs, slower is positive
+void print_comparison(const std::vector<bench_result_t>& results, const std::map<std::string, double>& baseline)
+{
+	fprintf(stderr, "%-40s %12s %12s %8s\n", "benchmark", "baseline ns", "ns", "change");
+	for (const bench_result_t& result : results)
+	{
+		const auto old = baseline.find(result.group + "/" + result.name);
+		if (old == baseline.end() || old->second <= 0)
+			continue;
+
+		// A ROM that halted early times its startup, not the interpreter
+		const bool halted = result.halt && result.cycles < result.iterations;
+		fprintf(stderr, "%-40s %12.3f %12.3f %+7.1f%%%s\n", (result.group + "/" + result.name).c_str(),
+			old->second, result.ns_per_op, (result.ns_per_op / old->second - 1) * 100, halted ? "  (halted)" : "");
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+		{
+			printf("Usage: chip8-bench [--out FILE] [--baseline FILE] [--runs N] [--iterations N] [--cycles N]\n"
+				"                   [--rom-dir DIR] [--filter TEXT] [--no-window] [emulator flags such as --ips]\n"
+				"Writes best-of-runs ns per opcode for each group/name as JSON, and compares with --baseline.\n"
+				"rom rows run each ROM for --cycles; one that halts first is flagged with its \"halt\" reason.\n");
+			return 0;
+		}
+	}
+
+	config_t config{ 0 };
+	if (!init_config(config, argc, argv))	// Shared flags: --cycles, --ips/-cpf
+	{
+		return -1;
+	}
+
+	bench_options_t options = { 2000000, 5, "ROM", "", true };
+	config.max_cycles = 5000000;
+	const char* out_path = nullptr;
+	const char* baseline_path = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+
+		if (arg == "--out" && i + 1 < argc)
+			out_path = argv[++i];
+		else if (arg == "--baseline" && i + 1 < argc)
+			baseline_path = argv[++i];
+		else if (arg == "--iterations" && i + 1 < argc)
+			options.iterations = std::max(1ll, std::stoll(argv[++i]));
+		else if (arg == "--runs" && i + 1 < argc)
+			options.runs = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--cycles" && i + 1 < argc)
+			config.max_cycles = std::stoull(argv[++i]);
+		else if (arg == "--rom-dir" && i + 1 < argc)
+			options.rom_dir = argv[++i];
+		else if (arg == "--filter" && i + 1 < argc)
+			options.filter = argv[++i];
+		else if (arg == "--no-window")
+			options.window = false;
+	}
+
+	std::map<std::string, double> baseline;
+	if (baseline_path && !read_baseline(baseline_path, baseline))
+	{
+		return -1;
+	}
+
+	decode_table(config.quirks);
+
+	std::vector<bench_result_t> results;
+	bench_opcodes(options, config, results);
+	bench_kernels(options, config, results);
+	bench_roms(options, config, results);
+
+	FILE* out = stdout;
+	if (out_path)
+	{
+		out = open_file(out_path, "w");
+		if (out == nullptr)
+		{
+			printf("Could not open %s for writing\n", out_path);
+			return -1;
+		}
+	}
+
+	write_json(out, results);
+	if (out != stdout)
+		fclose(out);
+
+	if (baseline_path)
+		print_comparison(results, baseline);
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <string>
+
+#include <CHIP8.hpp>
+#include <rom_library.hpp>
+#include <rom_map.hpp>
+#include <mapped_file.hpp>
+
+
+// chip8-disasm: disassemble a ROM without running it. Lists the code reachable from 0x200 block by block,
+// the sprites and other data between it, and which bytes FX33/FX55 can write, then saves that as the
+// ROM map the emulator looks for next to the ROM (see rom_map.hpp).
+//
+//   chip8-disasm [--quirks vip/chip48/schip/xochip] [--rom-index FILE] [--map FILE] [--no-listing] ROM
+//
+// The profile is the ROM library's for the ROM unless --quirks says otherwise, as when launching it
+
+
+// Mnemonic and operands of inst, in the usual CHIP-8 assembler syntax
+std::string disassemble(const instruction_t& inst, const uint8_t quirks)
+{
+	const bool jump_uses_vx = with_quirks(quirks, []<typename Q>() { return Q::jump_uses_vx; });
+	char text[32];
+
+	switch (opcode_kind(inst))
+	{
+	case OP_00E0: return "CLS";
+	case OP_00EE: return "RET";
+	case OP_00CN: snprintf(text, sizeof(text), "SCD %u", inst.N); break;
+	case OP_00DN: snprintf(text, sizeof(text), "SCU %u", inst.N); break;
+	case OP_00FB: return "SCR";
+	case OP_00FC: return "SCL";
+	case OP_00FE: return "LOW";
+	case OP_00FF: return "HIGH";
+	case OP_1NNN: snprintf(text, sizeof(text), "JP 0x%03X", inst.NNN); break;
+	case OP_2NNN: snprintf(text, sizeof(text), "CALL 0x%03X", inst.NNN); break;
+	case OP_3XNN: snprintf(text, sizeof(text), "SE V%X, 0x%02X", inst.X, inst.NN); break;
+	case OP_4XNN: snprintf(text, sizeof(text), "SNE V%X, 0x%02X", inst.X, inst.NN); break;
+	case OP_5XY0: snprintf(text, sizeof(text), "SE V%X, V%X", inst.X, inst.Y); break;
+	case OP_6XNN: snprintf(text, sizeof(text), "LD V%X, 0x%02X", inst.X, inst.NN); break;
+	case OP_7XNN: snprintf(text, sizeof(text), "ADD V%X, 0x%02X", inst.X, inst.NN); break;
+	case OP_8XY0: snprintf(text, sizeof(text), "LD V%X, V%X", inst.X, inst.Y); break;
+	case OP_8XY1: snprintf(text, sizeof(text), "OR V%X, V%X", inst.X, inst.Y); break;
+	case OP_8XY2: snprintf(text, sizeof(text), "AND V%X, V%X", inst.X, inst.Y); break;
+	case OP_8XY3: snprintf(text, sizeof(text), "XOR V%X, V%X", inst.X, inst.Y); break;
+	case OP_8XY4: snprintf(text, sizeof(text), "ADD V%X, V%X", inst.X, inst.Y); break;
+	case OP_8XY5: snprintf(text, sizeof(text), "SUB V%X, V%X", inst.X, inst.Y); break;
+	case OP_8XY6: snprintf(text, sizeof(text), "SHR V%X, V%X", inst.X, inst.Y); break;
+	case OP_8XY7: snprintf(text, sizeof(text), "SUBN V%X, V%X", inst.X, inst.Y); break;
+	case OP_8XYE: snprintf(text, sizeof(text), "SHL V%X, V%X", inst.X, inst.Y); break;
+	case OP_9XY0: snprintf(text, sizeof(text), "SNE V%X, V%X", inst.X, inst.Y); break;
+	case OP_ANNN: snprintf(text, sizeof(text), "LD I, 0x%03X", inst.NNN); break;
+	case OP_BNNN: snprintf(text, sizeof(text), "JP V%X, 0x%03X", jump_uses_vx ? inst.X : 0, inst.NNN); break;
+	case OP_CXNN: snprintf(text, sizeof(text), "RND V%X, 0x%02X", inst.X, inst.NN); break;
+	case OP_DXYN: snprintf(text, sizeof(text), "DRW V%X, V%X, %u", inst.X, inst.Y, inst.N); break;
+	case OP_EX9E: snprintf(text, sizeof(text), "SKP V%X", inst.X); break;
+	case OP_EXA1: snprintf(text, sizeof(text), "SKNP V%X", inst.X); break;
+	case OP_FX07: snprintf(text, sizeof(text), "LD V%X, DT", inst.X); break;
+	case OP_FX0A: snprintf(text, sizeof(text), "LD V%X, K", inst.X); break;
+	case OP_FX15: snprintf(text, sizeof(text), "LD DT, V%X", inst.X); break;
+	case OP_FX18: snprintf(text, sizeof(text), "LD ST, V%X", inst.X); break;
+	case OP_FX1E: snprintf(text, sizeof(text), "ADD I, V%X", inst.X); break;
+	case OP_FX29: snprintf(text, sizeof(text), "LD F, V%X", inst.X); break;
+	case OP_FX33: snprintf(text, sizeof(text), "LD B, V%X", inst.X); break;
+	case OP_FX55: snprintf(text, sizeof(text), "LD [I], V%X", inst.X); break;
+	case OP_FX65: snprintf(text, sizeof(text), "LD V%X, [I]", inst.X); break;
+	case OP_FN01: snprintf(text, sizeof(text), "PLANE %u", inst.X); break;
+	default: snprintf(text, sizeof(text), "DW 0x%04X", inst.opcode); break;
+	}
+
+	return text;
+}
+
+// S(prite), R(ead by FX65), W(ritten by FX33/FX55)
+std::string map_flags(const uint8_t bits)
+{
+	std::string flags;
+	flags += bits & MAP_SPRITE ? 'S' : ' ';
+	flags += bits & MAP_READ ? 'R' : ' ';
+	flags += bits & MAP_WRITTEN ? 'W' : ' ';
+	return flags;
+}
+
+// The runs of addresses with all of bits, as "0x300-0x30F, 0xEA0"
+std::string address_ranges(const rom_map_t& map, const uint8_t bits)
+{
+	std::string ranges;
+	for (uint32_t addr = 0; addr < map.bytes.size(); addr++)
+	{
+		if ((map.bytes[addr] & bits) != bits)
+			continue;
+
+		uint32_t last = addr;
+		while (last + 1 < map.bytes.size() && (map.bytes[last + 1] & bits) == bits)
+		{
+			last++;
+		}
+
+		char range[24];
+		if (last == addr)
+			snprintf(range, sizeof(range), "0x%03X", addr);
+		else
+			snprintf(range, sizeof(range), "0x%03X-0x%03X", addr, last);
+
+		ranges += ranges.empty() ? range : std::string(", ") + range;
+		addr = last;
+	}
+
+	return ranges.empty() ? "none" : ranges;
+}
+
+void print_listing(const char* rom_name, const chip8_t& chip8, const control_flow_t& flow, const rom_map_t& map)
+{
+	uint32_t ops = 0;
+	for (const code_block_t& block : flow.blocks)
+	{
+		ops += (block.end - block.start) / 2;
+	}
+
+	printf("; %s, --quirks %s: %u bytes, %u opcodes in %zu blocks\n", rom_name, QUIRKS_NAMES[map.quirks],
+		flow.rom_end - flow.rom_start, ops, flow.blocks.size());
+	printf("; Sprites: %s\n", address_ranges(map, MAP_SPRITE).c_str());
+	printf("; Loaded by FX65: %s\n", address_ranges(map, MAP_READ).c_str());
+	printf("; Written by FX33/FX55: %s\n", address_ranges(map, MAP_WRITTEN).c_str());
+
+	if (map.code_fixed)
+		printf("; Code never changes: all control flow is known and no store reaches it\n");
+	else if (!flow.complete)
+		printf("; Code may change: control goes where it can't be followed (BNNN, or off the end of the ROM)\n");
+	else
+		printf("; Code may change: stores can reach code at %s\n", address_ranges(map, MAP_CODE | MAP_WRITTEN).c_str());
+
+	uint32_t addr = flow.rom_start;
+	while (addr < flow.rom_end)
+	{
+		const uint8_t bits = map.bytes[addr];
+
+		if (bits & MAP_OPCODE)
+		{
+			if (bits & MAP_LEADER)
+				printf("\nL%03X:\n", addr);
+
+			const instruction_t inst = decode_instruction((chip8.ram[addr] << 8) | chip8.ram[addr + 1]);
+			printf("  %03X  %s  %04X  %s\n", addr, map_flags(bits | map.bytes[addr + 1]).c_str(), inst.opcode, disassemble(inst, map.quirks).c_str());
+			addr += 2;
+		}
+		else if (bits & MAP_SPRITE)
+		{
+			// A row of pixels per byte
+			char pixels[9];
+			for (uint32_t bit = 0; bit < 8; bit++)
+			{
+				pixels[bit] = (chip8.ram[addr] >> (7 - bit)) & 1 ? '#' : '.';
+			}
+			pixels[8] = '\0';
+
+			printf("  %03X  %s  %02X    %s\n", addr, map_flags(bits).c_str(), chip8.ram[addr], pixels);
+			addr++;
+		}
+		else
+		{
+			// Up to 8 bytes of other data with the same flags, that aren't code
+			printf("  %03X  %s ", addr, map_flags(bits).c_str());
+			uint32_t count = 0;
+			while (count < 8 && addr < flow.rom_end && map.bytes[addr] == bits)
+			{
+				printf(" %02X", chip8.ram[addr]);
+				addr++;
+				count++;
+			}
+			printf("\n");
+		}
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	char name[] = "chip8-disasm";
+	char* defaults[] = { name };
+	config_t config{ 0 };
+	init_config(config, 1, defaults);
+
+	const char* map_path = nullptr;
+	bool listing = true;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+
+		if (arg == "--quirks" && i + 1 < argc)
+		{
+			config.quirks = parse_quirks(argv[++i]);
+			if (config.quirks == QUIRKS_COUNT)
+			{
+				printf("Unknown --quirks %s, expected vip, chip48, schip or xochip\n", argv[i]);
+				return -1;
+			}
+			config.given |= GIVEN_QUIRKS;
+		}
+		else if (arg == "--rom-index" && i + 1 < argc)
+			config.rom_index = argv[++i];
+		else if (arg == "--map" && i + 1 < argc)
+			map_path = argv[++i];
+		else if (arg == "--no-listing")
+			listing = false;
+		else
+			config.rom_name = argv[i];
+	}
+
+	if (config.rom_name == nullptr)
+	{
+		printf("Usage: chip8-disasm [--quirks vip/chip48/schip/xochip] [--rom-index FILE] [--map FILE] [--no-listing] ROM\n");
+		return -1;
+	}
+
+	apply_rom_library(config);
+
+	// Load it the way the emulator does, the map is of the RAM it starts from
+	mapped_file_t rom;
+	if (!map_file(config.rom_name, rom))
+	{
+		printf("Rom file %s is invalid or does not exist\n", config.rom_name);
+		return -1;
+	}
+
+	chip8_t* chip8 = new chip8_t;
+	const bool loaded = init_chip8(*chip8, config, rom.data, rom.size);
+	const size_t rom_size = rom.size;
+	unmap_file(rom);
+
+	if (!loaded)
+	{
+		delete chip8;
+		return -1;
+	}
+
+	control_flow_t* flow = new control_flow_t;
+	rom_map_t* map = new rom_map_t;
+	build_rom_map(*map, *flow, *chip8, rom_size, config.quirks);
+
+	if (listing)
+		print_listing(config.rom_name, *chip8, *flow, *map);
+
+	const std::string path = map_path ? map_path : std::string(config.rom_name) + ".c8map";
+	std::vector<uint8_t> data;
+	save_rom_map(*map, data);
+	const bool written = write_state_file(path.c_str(), data);
+
+	if (written && !listing)
+		printf("%s: map written to %s, code %s\n", config.rom_name, path.c_str(), map->code_fixed ? "never changes" : "may change");
+
+	delete map;
+	delete flow;
+	delete chip8;
+
+	return written ? 0 : -1;
+}
\ No newline at end of file
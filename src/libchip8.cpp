@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <string.h>
+#include <array>
+#include <vector>
+
+#include <libchip8.h>
+#include <CHIP8.hpp>
+
+
+// libchip8: the C ABI in include/libchip8.h over the same core as the window and chip8-batch.
+// Build as a static library, or as a DLL/shared object with CHIP8_SHARED and CHIP8_BUILD defined
+
+struct chip8_envs
+{
+	config_t config;
+	chip8_t boot;						// Right after loading the ROM, what chip8_reset goes back to
+	std::vector<chip8_t> machines;
+	cpu_t cpu;							// Shared: the table interpreter keeps nothing per machine in it
+};
+
+
+// Byte N of entry B is bit 7 - N of B: eight pixels of a display row to eight observation bytes
+const std::array<uint64_t, 256> PIXEL_BYTES = []()
+{
+	std::array<uint64_t, 256> bytes{};
+	for (uint32_t bits = 0; bits < 256; bits++)
+	{
+		for (uint32_t pixel = 0; pixel < 8; pixel++)
+		{
+			bytes[bits] |= (uint64_t)((bits >> (7 - pixel)) & 1) << (pixel * 8);
+		}
+	}
+	return bytes;
+}();
+
+// 64 hires pixels to 32, each on when either of its pair is
+inline uint32_t halve_pixels(const uint64_t pixels)
+{
+	uint64_t x = (pixels | (pixels >> 1)) & 0x5555555555555555ull;
+	x = (x | (x >> 1)) & 0x3333333333333333ull;
+	x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+	x = (x | (x >> 4)) & 0x00FF00FF00FF00FFull;
+	x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull;
+	x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+	return (uint32_t)x;
+}
+
+// Row Y of a plane as 64 pixels, the halved pair of rows in hires
+inline uint64_t observation_row(const chip8_t& chip8, const uint32_t plane, const uint32_t Y)
+{
+	if (!chip8.hires)
+		return display_row(chip8, plane, Y)[0];
+
+	const uint64_t* top = display_row(chip8, plane, Y * 2);
+	const uint64_t* bottom = display_row(chip8, plane, Y * 2 + 1);
+	return ((uint64_t)halve_pixels(top[0] | bottom[0]) << 32) | halve_pixels(top[1] | bottom[1]);
+}
+
+
+extern "C" void chip8_default_options(chip8_options_t* options)
+{
+	options->quirks = nullptr;
+	options->ips = 0;
+	options->seed = 0;
+	options->idle_skip = 1;
+}
+
+extern "C" chip8_envs_t* chip8_create(const char* rom, const uint32_t count, const chip8_options_t* options)
+{
+	chip8_options_t defaults;
+	chip8_default_options(&defaults);
+	if (options == nullptr)
+		options = &defaults;
+
+	chip8_envs_t* envs = new chip8_envs_t;
+
+	char name[] = "libchip8";
+	char* argv[] = { name };
+	init_config(envs->config, 1, argv);
+
+	config_t& config = envs->config;
+	config.rom_name = rom;
+	config.headless = true;
+	config.trace = nullptr;
+	config.dispatch = DISPATCH_TABLE;	// Blocks would allocate as they get translated
+	config.seed = options->seed;
+	config.idle_skip = options->idle_skip != 0;
+
+	if (options->ips)
+		config.cycles_per_frame = std::max(1u, options->ips / 60);
+
+	if (options->quirks)
+	{
+		config.quirks = parse_quirks(options->quirks);
+		if (config.quirks == QUIRKS_COUNT)
+		{
+			printf("Unknown quirks %s\n", options->quirks);
+			delete envs;
+			return nullptr;
+		}
+	}
+
+	if (!init_chip8(envs->boot, config))
+	{
+		delete envs;
+		return nullptr;
+	}
+
+	envs->machines.resize(count);
+	for (uint32_t env = 0; env < count; env++)
+	{
+		chip8_reset(envs, env, options->seed + env);
+	}
+
+	init_cpu(envs->cpu, config);
+
+	return envs;
+}
+
+extern "C" void chip8_destroy(chip8_envs_t* envs)
+{
+	delete envs;
+}
+
+extern "C" void chip8_reset(chip8_envs_t* envs, const uint32_t env, const uint32_t seed)
+{
+	chip8_t& chip8 = envs->machines[env];
+	chip8 = envs->boot;
+	seed_rng(chip8, seed);
+}
+
+extern "C" void chip8_step(chip8_envs_t* envs, const uint16_t* actions, const uint32_t frames)
+{
+	for (size_t env = 0; env < envs->machines.size(); env++)
+	{
+		chip8_t& chip8 = envs->machines[env];
+		chip8.keypad = actions ? actions[env] : 0;
+
+		for (uint32_t frame = 0; frame < frames; frame++)
+		{
+			run_frame(chip8, envs->config, envs->cpu);
+		}
+	}
+}
+
+extern "C" void chip8_observe(const chip8_envs_t* envs, uint8_t* pixels)
+{
+	const bool bitplanes = envs->config.quirks == QUIRKS_XOCHIP;
+
+	for (const chip8_t& chip8 : envs->machines)
+	{
+		for (uint32_t Y = 0; Y < CHIP8_OBSERVATION_HEIGHT; Y++)
+		{
+			const uint64_t first = observation_row(chip8, 0, Y);
+			const uint64_t second = bitplanes ? observation_row(chip8, 1, Y) : 0;
+
+			// Eight pixels at a time, plane 2 adding 2 to its pixels' bytes. Little-endian hosts
+			for (uint32_t byte = 0; byte < 8; byte++)
+			{
+				const uint32_t shift = 56 - byte * 8;
+				const uint64_t out = PIXEL_BYTES[(first >> shift) & 0xFF] + 2 * PIXEL_BYTES[(second >> shift) & 0xFF];
+				memcpy(pixels + byte * 8, &out, 8);
+			}
+
+			pixels += CHIP8_OBSERVATION_WIDTH;
+		}
+	}
+}
+
+extern "C" const uint8_t* chip8_ram(const chip8_envs_t* envs, const uint32_t env)
+{
+	return envs->machines[env].ram.data();
+}
\ No newline at end of file
@@ -1,6 +1,16 @@
 ﻿#include <iostream>
 #include <CHIP8.hpp>
+#include <headless.hpp>
+#include <snapshot.hpp>
+#include <rewind.hpp>
+#include <replay.hpp>
+#include <rom_library.hpp>
+#include <rom_map.hpp>
+#ifndef HEADLESS_ONLY	// Define to build without SFML; only --headless is available then
+#include <user_interface.hpp>
+#endif
 #include <iomanip> // For std::setw and std::setfill
+#include <thread>
 
 
 int main(int argc, char* argv[])
@@ -18,10 +28,21 @@ int main(int argc, char* argv[])
 	{
 		return -1;
 	}
-		
 
-	sfml_t sfml;
-	init_sfml(sfml, config);
+	// Known ROMs bring their quirks, speed and keymap from the ROM library
+	apply_rom_library(config);
+
+	// A replay brings its own seed and timing, so read it before the chip8 is seeded
+	input_log_t* replay = nullptr;
+	if (config.replay)
+	{
+		replay = new input_log_t;
+		if (!read_input_log(config.replay, *replay))
+		{
+			return -1;
+		}
+		apply_input_log(*replay, config);
+	}
 
 	chip8_t chip8;
 	if (!init_chip8(chip8, config))
@@ -29,30 +50,271 @@ int main(int argc, char* argv[])
 		printf("Failed to init chip8\n");
 		return -1;
 	}
-	
-	chip8.draw = true;
 
+	// RAM as loaded, save states only store what differs from it
+	const ram_image_t boot_ram = chip8.ram;
+	std::vector<uint8_t> state;
 
-	
-	srand(time(NULL)); // Get seed for random number
+	if (replay)
+	{
+		if (!check_input_log(*replay, boot_ram))
+		{
+			return -1;
+		}
+		state = replay->start_state;	// Start where the recording started
+	}
+	else if (config.load_state && !read_state_file(config.load_state, state))
+	{
+		return -1;
+	}
 
-	while (sfml.window.isOpen())
+	if (!state.empty() && !load_state(chip8, boot_ram, state.data(), state.size()))
+	{
+		return -1;
+	}
+
+	cpu_t* cpu = new cpu_t;
+	init_cpu(*cpu, config);
+
+	// chip8-disasm's map of the ROM, for the interpreters that cache blocks. What it proves holds for runs
+	// from the boot state only
+	if (config.use_rom_map && state.empty() && (config.dispatch == DISPATCH_BLOCK || config.dispatch == DISPATCH_JIT))
+	{
+		rom_map_t* map = new rom_map_t;
+		if (find_rom_map(*map, config, boot_ram))
+		{
+			config.code_fixed = map->code_fixed;
+			const uint32_t built = prebuild_blocks(*cpu, chip8, config, *map);
+			printf("ROM map: %u blocks translated up front, %s\n", built,
+				map->code_fixed ? "code never changes so stores go unchecked" : "code may change so stores are checked");
+		}
+		delete map;
+	}
+
+	const char* trace_path = config.trace ? config.trace : "trace.c8tr";
+	if (config.trace)
+	{
+		init_trace(cpu->trace, config.trace_records);
+		cpu->trace.enabled = true;
+	}
+
+	if (config.headless)
+	{
+		if (config.record)
+			printf("--record does nothing with --headless, there is no input to record\n");
+
+		const headless_result_t result = replay ? run_replay(chip8, config, *cpu, *replay) : run_headless(chip8, config, *cpu);
+		print_headless_result(result, chip8);
+#ifdef CHIP8_JIT
+		if (config.dispatch == DISPATCH_JIT)
+			print_jit_stats(cpu->jit);
+#endif
+#ifdef PROFILE_ON
+		write_profile(config, cpu->profile, chip8);
+#endif
+		if (cpu->trace.enabled)
+			write_trace_file(trace_path, cpu->trace);
+
+		delete replay;
+		delete cpu;
+
+		if (config.save_state)
+		{
+			save_state(chip8, boot_ram, state);
+			if (!write_state_file(config.save_state, state))
+				return -1;
+		}
+
+		return 0;
+	}
+
+#ifdef HEADLESS_ONLY
+	printf("Built without a frontend, run with --headless\n");
+	return -1;
+#else
+	sfml_t sfml;
+	if (!init_sfml(sfml, config))
+	{
+		return -1;
+	}
+
+	input_log_t* record = nullptr;
+	if (config.record)
 	{
-		user_input(sfml, chip8);
+		record = new input_log_t;
+		init_input_log(*record, config, boot_ram, state);
+	}
 
-		sf::sleep(sf::milliseconds(1000 / 60)); // Adjust 60 to desired FPS limit
+	// Rewinding or loading a state would break the timeline a recording or replay is built on
+	const bool live = record == nullptr && replay == nullptr;
 
-		run_single_opcode(chip8, config, sfml);
+	rewind_t* rewind = new rewind_t;
+	init_rewind(*rewind, live ? (size_t)config.rewind_mb << 20 : 0, chip8);
 
-		if (chip8.draw)
+	// The core runs on its own thread so a slow present or a vsync stall never holds it back. It hands
+	// finished screens to this thread through sfml.frames and takes keys and hotkeys from sfml.input
+	std::thread emulation([&]()
+	{
+		// Frame scheduler: timers run at 60Hz off a monotonic clock,
+		// the CPU runs config.cycles_per_frame opcodes for every elapsed frame
+		using frame_clock = std::chrono::steady_clock;
+		const auto frame_time = std::chrono::nanoseconds(1000000000 / 60);
+		const uint32_t max_catch_up = 4;	// Frames to run back to back before dropping time (e.g. after a window drag)
+		auto next_frame = frame_clock::now();
+
+		while (sfml.input.running.load(std::memory_order_relaxed))
 		{
-			update_screen(sfml, config, chip8);
-			chip8.draw = false;
+			if (sfml.input.pause.exchange(false))
+				chip8.status = PAUSE;
+
+			if (sfml.input.quick_save.exchange(false))
+			{
+				save_state(chip8, boot_ram, state);
+				if (config.save_state)
+					write_state_file(config.save_state, state);
+			}
+
+			if (sfml.input.toggle_trace.exchange(false))
+			{
+				// Off writes out what was traced, on starts a fresh ring. Traced opcodes skip the block cache
+				// and JIT, stores included, so what those translated may be stale by now
+				if (cpu->trace.enabled)
+				{
+					write_trace_file(trace_path, cpu->trace);
+					cpu->trace.enabled = false;
+					flush_cpu(*cpu);
+				}
+				else
+				{
+					init_trace(cpu->trace, config.trace_records);
+					cpu->trace.enabled = true;
+				}
+			}
+
+			if (sfml.input.profile_report.exchange(false))
+			{
+#ifdef PROFILE_ON
+				write_profile(config, cpu->profile, chip8);
+#endif
+			}
+
+			if (sfml.input.quick_load.exchange(false))
+			{
+				// The RAM may not match what the block cache translated any more
+				if (live && !state.empty() && load_state(chip8, boot_ram, state.data(), state.size()))
+				{
+					flush_cpu(*cpu);
+					reset_rewind(*rewind, chip8);
+				}
+			}
+
+			uint32_t frames_run = 0;
+			while (frame_clock::now() >= next_frame)
+			{
+				if (sfml.input.rewinding.load(std::memory_order_relaxed) && live)
+				{
+					// Step back one frame per frame, in real time
+					bool ram_changed;
+					if (rewind_frame(*rewind, chip8, ram_changed) && ram_changed)
+						flush_cpu(*cpu);
+
+					update_beeper(sfml.beeper, chip8);
+				}
+				else
+				{
+					chip8.keypad = sfml.input.keypad.load(std::memory_order_relaxed);
+
+					if (replay && !replay_input(*replay, chip8))
+					{
+						printf("Replay finished after %u frames\n", replay->frames);
+						delete replay;
+						replay = nullptr;	// Input is live from here
+					}
+
+					if (record)
+						record_input(*record, chip8);
+
+					run_frame_opcodes(chip8, config, *cpu);
+					update_beeper(sfml.beeper, chip8);
+					update_timers(chip8);
+					record_frame(*rewind, chip8);
+				}
+
+				next_frame += frame_time;
+
+				if (++frames_run >= max_catch_up)
+				{
+					next_frame = frame_clock::now() + frame_time;
+					break;
+				}
+			}
+
+			// Publish at most once per frame, however many opcodes drew
+			if (chip8.draw)
+				publish_frame(sfml.frames, chip8);
+
+			const auto wait = std::chrono::duration_cast<std::chrono::microseconds>(next_frame - frame_clock::now());
+			if (wait.count() > 0)
+				sf::sleep(sf::microseconds(wait.count()));
+		}
+	});
+
+	// Render thread: input and presenting at 60Hz. Timed here rather than in cpu->profile, which
+	// belongs to the emulation thread, and added to it once that has stopped
+#ifdef PROFILE_ON
+	profile_timer_t screen_time = {};
+	profile_timer_t input_time = {};
+#endif
+	const auto present_time = std::chrono::microseconds(1000000 / 60);
+	auto next_present = std::chrono::steady_clock::now();
+
+	while (sfml.window.isOpen())
+	{
+		{
+			PROFILE_TIME(input_time);
+			user_input(sfml);
+		}
+
+		if (const frame_t* frame = take_frame(sfml.frames))
+		{
+			PROFILE_TIME(screen_time);
+			update_screen(sfml, *frame);
 		}
 
-		update_timers(chip8);
+		next_present += present_time;
+		const auto wait = std::chrono::duration_cast<std::chrono::microseconds>(next_present - std::chrono::steady_clock::now());
+		if (wait.count() > 0)
+			sf::sleep(sf::microseconds(wait.count()));
+		else
+			next_present = std::chrono::steady_clock::now();
 	}
+
+	sfml.input.running = false;
+	emulation.join();
+
+#ifdef PROFILE_ON
+	cpu->profile.screen.ns += screen_time.ns;
+	cpu->profile.screen.calls += screen_time.calls;
+	cpu->profile.input.ns += input_time.ns;
+	cpu->profile.input.calls += input_time.calls;
+#endif
 	
+	if (record)
+	{
+		write_input_log(config.record, *record);
+		delete record;
+	}
+
+#ifdef PROFILE_ON
+	write_profile(config, cpu->profile, chip8);
+#endif
+	if (cpu->trace.enabled)
+		write_trace_file(trace_path, cpu->trace);
+
+	delete replay;
+	delete rewind;
+	delete cpu;
 	
 	return 0;
+#endif
 }
\ No newline at end of file
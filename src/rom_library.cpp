@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <rom_library.hpp>
+
+
+// chip8-library: add the ROMs in some directories to the ROM library index, with the quirk profile
+// guessed from the opcodes they use, and compile the index's lookup cache.
+//
+//   chip8-library [--index FILE] DIR...
+//
+// ROMs already in the index keep their lines, so corrections made by hand survive a rescan.
+// With no DIR it only lists the index and rebuilds the cache
+
+int main(int argc, char* argv[])
+{
+	const char* index_path = "ROM/index.txt";
+	std::vector<const char*> dirs;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+
+		if (arg == "--index" && i + 1 < argc)
+			index_path = argv[++i];
+		else if (arg == "-h" || arg == "--help")
+		{
+			printf("Usage: chip8-library [--index FILE] DIR...\n");
+			return 0;
+		}
+		else
+			dirs.push_back(argv[i]);
+	}
+
+	// A missing index is an empty library
+	std::vector<rom_entry_t> entries;
+	uint64_t size, time;
+	if (index_stamp(index_path, size, time) && !read_rom_index(index_path, entries))
+	{
+		return -1;
+	}
+
+	uint32_t added = 0;
+	for (const char* dir : dirs)
+	{
+		added += scan_rom_directory(dir, entries);
+	}
+
+	if (added > 0 || !index_stamp(index_path, size, time))
+	{
+		if (!write_rom_index(index_path, entries) || !index_stamp(index_path, size, time))
+		{
+			return -1;
+		}
+	}
+
+	if (!write_rom_cache(index_path, size, time, entries))
+	{
+		printf("Could not write %s.cache\n", index_path);
+		return -1;
+	}
+
+	for (const rom_entry_t& entry : entries)
+	{
+		printf("%016llx  %-7s %6u  %s  %s\n", (long long unsigned)entry.hash, QUIRKS_NAMES[entry.quirks],
+			entry.ips, entry.keymap, entry.name.c_str());
+	}
+	printf("%zu ROMs in %s, %u new\n", entries.size(), index_path, added);
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <structs.hpp>
+#include <trace.hpp>
+
+
+// chip8-trace: print a trace written by --trace / F7 as one line of text per opcode, in the same
+// form the old DEBUG_ON printer used.
+//
+//   chip8-trace FILE [--last N] [--pc ADDR]
+//
+// --last prints only the N most recent records, --pc only the ones at one address (hex)
+
+void print_trace_record(const trace_record_t& r)
+{
+	const uint8_t X = (r.opcode >> 8) & 0xF;
+	const uint8_t Y = (r.opcode >> 4) & 0xF;
+	const uint8_t N = r.opcode & 0xF;
+	const uint8_t NN = r.opcode & 0xFF;
+	const uint16_t NNN = r.opcode & 0xFFF;
+
+	printf("<0x%04X> PC = 0x%03X:  ", r.opcode, r.PC);
+
+	switch ((r.opcode >> 12) & 0xF)
+	{
+	case 0x0:
+		if (NN == 0xE0)
+			printf("Clear screen\n");
+		else if (NN == 0xEE)
+			printf("Return from subroutine, popping stack at %u\n", r.stack_ptr);
+		else if ((NN & 0xF0) == 0xC0)
+			printf("Scroll down %u rows\n", N);
+		else if ((NN & 0xF0) == 0xD0)
+			printf("Scroll up %u rows\n", N);
+		else if (NN == 0xFB || NN == 0xFC)
+			printf("Scroll %s 4 pixels\n", NN == 0xFB ? "right" : "left");
+		else if (NN == 0xFE || NN == 0xFF)
+			printf("Switch to %s\n", NN == 0xFF ? "hires (128x64)" : "lores (64x32)");
+		else
+			printf("Unimplemented opcode 0x%04X\n", r.opcode);
+		break;
+
+	case 0x1:
+		printf("Jumping to address 0x%X\n", NNN);
+		break;
+
+	case 0x2:
+		printf("Calling to address 0x%X and pushing to stack at %u\n", NNN, r.stack_ptr);
+		break;
+
+	case 0x3:
+		printf("if (V%X (0x%X) == 0x%X)\n", X, r.VX, NN);
+		break;
+
+	case 0x4:
+		printf("if (V%X (0x%X) != 0x%X)\n", X, r.VX, NN);
+		break;
+
+	case 0x5:
+		printf("if (V%X (0x%X) == V%X (0x%X))\n", X, r.VX, Y, r.VY);
+		break;
+
+	case 0x6:
+		printf("V%X = 0x%X\n", X, NN);
+		break;
+
+	case 0x7:
+		printf("V%X += 0x%X (V%X = 0x%X)\n", X, NN, X, r.VX_after);
+		break;
+
+	case 0x8:
+	{
+		const char* ops[16] = { "=", "|=", "&=", "^=", "+=", "-=", ">>= 1", 0, 0, 0, 0, 0, 0, 0, "<<= 1", 0 };
+		if (N == 0x7)
+		{
+			printf("V%X = V%X (0x%X) - V%X (0x%X) -> V%X = 0x%X, VF = 0x%X\n", X, Y, r.VY, X, r.VX, X, r.VX_after, r.VF_after);
+			break;
+		}
+
+		if (ops[N] == nullptr)
+		{
+			printf("Unimplemented opcode 0x%04X\n", r.opcode);
+			break;
+		}
+
+		if (N == 0x6 || N == 0xE)
+			printf("V%X (0x%X) %s", X, r.VX, ops[N]);
+		else
+			printf("V%X (0x%X) %s V%X (0x%X)", X, r.VX, ops[N], Y, r.VY);
+
+		printf(" -> V%X = 0x%X, VF = 0x%X\n", X, r.VX_after, r.VF_after);
+		break;
+	}
+
+	case 0x9:
+		printf("if (V%X (0x%X) != V%X (0x%X))\n", X, r.VX, Y, r.VY);
+		break;
+
+	case 0xA:
+		printf("I = 0x%X\n", NNN);
+		break;
+
+	case 0xB:
+		printf("PC = 0x%X + V0\n", NNN);
+		break;
+
+	case 0xC:
+		printf("V%X = rand() & 0x%02X (V%X = 0x%X)\n", X, NN, X, r.VX_after);
+		break;
+
+	case 0xD:
+		if (N == 0)
+			printf("Displaying 16x16 sprite at address 0x%X (X, Y = %d, %d), VF = %d\n", r.I, r.VX, r.VY, r.VF_after);
+		else
+			printf("Displaying sprite at address 0x%X (X, Y = %d, %d) of %d rows, VF = %d\n", r.I, r.VX, r.VY, N, r.VF_after);
+		break;
+
+	case 0xE:
+		if (NN == 0x9E)
+			printf("Skip next instruction if key in V%X (0x%X) is pressed; Keypad value: %d\n", X, r.VX, r.key);
+		else if (NN == 0xA1)
+			printf("Skip next instruction if key in V%X (0x%X) is NOT pressed; Keypad value: %d\n", X, r.VX, r.key);
+		else
+			printf("Unimplemented opcode 0x%04X\n", r.opcode);
+		break;
+
+	case 0xF:
+		switch (NN)
+		{
+		case 0x07: printf("V%X = delay timer (0x%X)\n", X, r.VX_after); break;
+		case 0x0A: printf("Await until a key is pressed; store key in V%X\n", X); break;
+		case 0x15: printf("delay timer = V%X (0x%X)\n", X, r.VX); break;
+		case 0x18: printf("sound timer = V%X (0x%X)\n", X, r.VX); break;
+		case 0x1E: printf("I += V%X (0x%X += 0x%X)\n", X, r.I, r.VX); break;
+		case 0x29: printf("I = font sprite for V%X (0x%X)\n", X, r.VX); break;
+		case 0x33: printf("Store BCD of V%X (%d) at I (0x%X)\n", X, r.VX, r.I); break;
+		case 0x55: printf("Store V0-V%X at I (0x%X)\n", X, r.I); break;
+		case 0x65: printf("Load V0-V%X from I (0x%X)\n", X, r.I); break;
+		case 0x01: printf("Select planes %X\n", X); break;
+		default: printf("Unimplemented opcode 0x%04X\n", r.opcode); break;
+		}
+		break;
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	const char* path = nullptr;
+	uint64_t last = 0;
+	int32_t only_pc = -1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+
+		if (arg == "--last" && i + 1 < argc)
+			last = std::stoull(argv[++i]);
+		else if (arg == "--pc" && i + 1 < argc)
+			only_pc = std::stoi(argv[++i], nullptr, 16);
+		else
+			path = argv[i];
+	}
+
+	if (path == nullptr)
+	{
+		printf("Usage: chip8-trace FILE [--last N] [--pc ADDR]\n");
+		return -1;
+	}
+
+	std::vector<trace_record_t> records;
+	uint64_t count;
+	if (!read_trace_file(path, records, count))
+	{
+		return -1;
+	}
+
+	if (count > records.size())
+		printf("(%llu earlier opcodes were dropped from the ring)\n", (long long unsigned)(count - records.size()));
+
+	const size_t first = last && last < records.size() ? records.size() - last : 0;
+	for (size_t i = first; i < records.size(); i++)
+	{
+		if (only_pc < 0 || records[i].PC == only_pc)
+			print_trace_record(records[i]);
+	}
+
+	return 0;
+}
\ No newline at end of file